@@ -0,0 +1,515 @@
+// Copyright satoren
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "kaguya/config.hpp"
+
+namespace kaguya
+{
+	//! memory statistics of Allocator. sizes are Lua requested sizes.
+	struct AllocatorStats
+	{
+		enum
+		{
+			SIZE_CLASS_GRANULARITY = 16,//!< size class step in bytes
+			SIZE_CLASS_NUM = 16,//!< number of small size classes. up to SIZE_CLASS_GRANULARITY * SIZE_CLASS_NUM bytes
+			LARGE_SIZE_CLASS = SIZE_CLASS_NUM//!< index of allocation larger than small size classes
+		};
+		AllocatorStats() :live_bytes(0), peak_bytes(0), allocation_count(0), deallocation_count(0)
+		{
+			std::memset(size_class_count, 0, sizeof(size_class_count));
+		}
+
+		size_t live_bytes;
+		size_t peak_bytes;
+		size_t allocation_count;
+		size_t deallocation_count;
+		//! allocation count by size class. last element is large allocation
+		size_t size_class_count[SIZE_CLASS_NUM + 1];
+
+		//! size class index of size
+		static size_t sizeClass(size_t size)
+		{
+			if (size == 0) { return 0; }
+			size_t index = (size - 1) / SIZE_CLASS_GRANULARITY;
+			return index < SIZE_CLASS_NUM ? index : size_t(LARGE_SIZE_CLASS);
+		}
+		//! block size of size class
+		static size_t sizeClassBytes(size_t index)
+		{
+			return (index + 1) * SIZE_CLASS_GRANULARITY;
+		}
+	};
+
+	/**
+	* Memory allocation policy of kaguya::State. Passed to lua_newstate as lua_Alloc.
+	* Allocator is not thread safe. Share an allocator only between States used from the same thread,
+	* and keep it alive until all these States are closed(State holds shared_ptr of allocator).
+	*/
+	class Allocator
+	{
+	public:
+		virtual ~Allocator() {}
+
+		//! return 0 on failure
+		virtual void* allocate(size_t size) = 0;
+		virtual void deallocate(void* ptr, size_t size) = 0;
+		//! return 0 on failure. must not fail when nsize <= osize.
+		virtual void* reallocate(void* ptr, size_t osize, size_t nsize)
+		{
+			void* newptr = allocate(nsize);
+			if (!newptr)
+			{
+				return nsize <= osize ? ptr : 0;
+			}
+			std::memcpy(newptr, ptr, osize < nsize ? osize : nsize);
+			deallocate(ptr, osize);
+			return newptr;
+		}
+
+		const AllocatorStats& stats()const { return stats_; }
+
+		//! called by State after lua_State using this allocator is created
+		virtual void attach(lua_State*) {}
+		//! called by State before the lua_State is closed
+		virtual void detach(lua_State*) {}
+		//! called by State::GCType::stop() and restart() of the lua_State
+		virtual void collectorChanged(lua_State*, bool) {}
+
+		//! lua_Alloc function. ud is Allocator*
+		static void* lua_alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+		{
+			Allocator* self = static_cast<Allocator*>(ud);
+			if (!ptr)
+			{
+				osize = 0;//osize is object type code when ptr is NULL
+			}
+			if (nsize == 0)
+			{
+				if (ptr)
+				{
+					self->deallocate(ptr, osize);
+					self->recordDeallocate(osize);
+				}
+				return 0;
+			}
+			void* result = ptr ? self->reallocate(ptr, osize, nsize) : self->allocate(nsize);
+			if (result)
+			{
+				if (ptr) { self->recordDeallocate(osize); }
+				self->recordAllocate(nsize);
+			}
+			return result;
+		}
+	protected:
+		void recordAllocate(size_t size)
+		{
+			stats_.live_bytes += size;
+			if (stats_.live_bytes > stats_.peak_bytes)
+			{
+				stats_.peak_bytes = stats_.live_bytes;
+			}
+			stats_.allocation_count++;
+			stats_.size_class_count[AllocatorStats::sizeClass(size)]++;
+		}
+		void recordDeallocate(size_t size)
+		{
+			stats_.live_bytes -= size;
+			stats_.deallocation_count++;
+		}
+		void resetStats()
+		{
+			stats_ = AllocatorStats();
+		}
+	private:
+		AllocatorStats stats_;
+	};
+
+	//! malloc/realloc/free allocator with statistics
+	class DefaultAllocator :public Allocator
+	{
+	public:
+		virtual void* allocate(size_t size)
+		{
+			return std::malloc(size);
+		}
+		virtual void deallocate(void* ptr, size_t)
+		{
+			std::free(ptr);
+		}
+		virtual void* reallocate(void* ptr, size_t osize, size_t nsize)
+		{
+			void* newptr = std::realloc(ptr, nsize);
+			return (newptr || nsize > osize) ? newptr : ptr;
+		}
+	};
+
+	/**
+	* Size class pool allocator for Lua small objects(strings, tables, closures, userdata).
+	* Small blocks are carved from chunks and recycled by per size class free list.
+	* Allocations larger than the largest size class use malloc.
+	* Chunks are released when the allocator is destroyed.
+	*/
+	class PoolAllocator :public Allocator
+	{
+		struct FreeNode
+		{
+			FreeNode* next;
+		};
+	public:
+		explicit PoolAllocator(size_t chunk_size = 64 * 1024) :chunk_size_(chunk_size)
+		{
+			for (size_t i = 0; i < AllocatorStats::SIZE_CLASS_NUM; ++i)
+			{
+				free_list_[i] = 0;
+			}
+		}
+		~PoolAllocator()
+		{
+			for (std::vector<void*>::iterator it = chunks_.begin(); it != chunks_.end(); ++it)
+			{
+				std::free(*it);
+			}
+		}
+
+		virtual void* allocate(size_t size)
+		{
+			size_t index = AllocatorStats::sizeClass(size);
+			if (index == AllocatorStats::LARGE_SIZE_CLASS)
+			{
+				return std::malloc(size);
+			}
+			if (!free_list_[index] && !refill(index))
+			{
+				return 0;
+			}
+			FreeNode* node = free_list_[index];
+			free_list_[index] = node->next;
+			return node;
+		}
+		virtual void deallocate(void* ptr, size_t size)
+		{
+			size_t index = AllocatorStats::sizeClass(size);
+			if (index == AllocatorStats::LARGE_SIZE_CLASS)
+			{
+				std::free(ptr);
+				return;
+			}
+			FreeNode* node = static_cast<FreeNode*>(ptr);
+			node->next = free_list_[index];
+			free_list_[index] = node;
+		}
+		virtual void* reallocate(void* ptr, size_t osize, size_t nsize)
+		{
+			size_t oindex = AllocatorStats::sizeClass(osize);
+			size_t nindex = AllocatorStats::sizeClass(nsize);
+			if (oindex == nindex)
+			{
+				if (oindex != AllocatorStats::LARGE_SIZE_CLASS)
+				{
+					return ptr;
+				}
+				void* newptr = std::realloc(ptr, nsize);
+				return (newptr || nsize > osize) ? newptr : ptr;
+			}
+			return Allocator::reallocate(ptr, osize, nsize);
+		}
+
+		//! bytes reserved by chunks
+		size_t reservedBytes()const
+		{
+			return chunks_.size() * chunk_size_;
+		}
+	private:
+		bool refill(size_t index)
+		{
+			size_t block_size = AllocatorStats::sizeClassBytes(index);
+			size_t count = chunk_size_ / block_size;
+			if (count == 0) { count = 1; }
+			char* chunk = static_cast<char*>(std::malloc(count * block_size));
+			if (!chunk)
+			{
+				return false;
+			}
+			chunks_.push_back(chunk);
+			for (size_t i = count; i > 0; --i)
+			{
+				FreeNode* node = reinterpret_cast<FreeNode*>(chunk + (i - 1) * block_size);
+				node->next = free_list_[index];
+				free_list_[index] = node;
+			}
+			return true;
+		}
+
+		size_t chunk_size_;
+		FreeNode* free_list_[AllocatorStats::SIZE_CLASS_NUM];
+		std::vector<void*> chunks_;
+	};
+
+	/**
+	* Bump pointer arena allocator for throwaway States.
+	* Freed memory is not reused until reset(), except the most recent allocation.
+	* Call reset() after all States using the arena are closed, then the arena blocks are reused by next State.
+	*/
+	class ArenaAllocator :public Allocator
+	{
+		struct Block
+		{
+			char* data;
+			size_t size;
+		};
+		enum { ALIGNMENT = AllocatorStats::SIZE_CLASS_GRANULARITY };
+	public:
+		explicit ArenaAllocator(size_t block_size = 256 * 1024) :block_size_(block_size), current_(0), used_(0), last_(0)
+		{
+		}
+		~ArenaAllocator()
+		{
+			release(blocks_);
+			release(spare_blocks_);
+		}
+
+		virtual void* allocate(size_t size)
+		{
+			size = align(size);
+			if (!current_ || used_ + size > current_->size)
+			{
+				if (!nextBlock(size)) { return 0; }
+			}
+			last_ = current_->data + used_;
+			used_ += size;
+			return last_;
+		}
+		virtual void deallocate(void* ptr, size_t size)
+		{
+			if (ptr == last_)
+			{
+				used_ -= align(size);
+				last_ = 0;
+			}
+		}
+		virtual void* reallocate(void* ptr, size_t osize, size_t nsize)
+		{
+			if (ptr == last_ && used_ - align(osize) + align(nsize) <= current_->size)
+			{
+				used_ = used_ - align(osize) + align(nsize);
+				return ptr;
+			}
+			if (nsize <= osize)
+			{
+				return ptr;//shrink in place. the tail is released by reset()
+			}
+			return Allocator::reallocate(ptr, osize, nsize);
+		}
+
+		//! discard all allocations. Blocks are kept for reuse.
+		void reset()
+		{
+			for (std::vector<Block>::iterator it = blocks_.begin(); it != blocks_.end(); ++it)
+			{
+				if (it->size == block_size_)
+				{
+					spare_blocks_.push_back(*it);
+				}
+				else
+				{
+					std::free(it->data);
+				}
+			}
+			blocks_.clear();
+			current_ = 0;
+			used_ = 0;
+			last_ = 0;
+			resetStats();
+		}
+
+		//! bytes reserved by blocks
+		size_t reservedBytes()const
+		{
+			size_t size = 0;
+			for (std::vector<Block>::const_iterator it = blocks_.begin(); it != blocks_.end(); ++it)
+			{
+				size += it->size;
+			}
+			for (std::vector<Block>::const_iterator it = spare_blocks_.begin(); it != spare_blocks_.end(); ++it)
+			{
+				size += it->size;
+			}
+			return size;
+		}
+	private:
+		static size_t align(size_t size)
+		{
+			return (size + ALIGNMENT - 1) & ~static_cast<size_t>(ALIGNMENT - 1);
+		}
+		bool nextBlock(size_t size)
+		{
+			Block block;
+			if (size <= block_size_ && !spare_blocks_.empty())
+			{
+				block = spare_blocks_.back();
+				spare_blocks_.pop_back();
+			}
+			else
+			{
+				block.size = size <= block_size_ ? block_size_ : size;
+				block.data = static_cast<char*>(std::malloc(block.size));
+				if (!block.data) { return false; }
+			}
+			blocks_.push_back(block);
+			current_ = &blocks_.back();
+			used_ = 0;
+			last_ = 0;
+			return true;
+		}
+		static void release(std::vector<Block>& blocks)
+		{
+			for (std::vector<Block>::iterator it = blocks.begin(); it != blocks.end(); ++it)
+			{
+				std::free(it->data);
+			}
+			blocks.clear();
+		}
+
+		size_t block_size_;
+		std::vector<Block> blocks_;
+		std::vector<Block> spare_blocks_;
+		Block* current_;
+		size_t used_;
+		char* last_;
+	};
+
+	/**
+	* Memory budget of a State. Wraps another allocator and enforces byte limits on Lua requested sizes.
+	* Hard limit: allocation over the limit fails, and Lua raises memory error(LUA_ERRMEM).
+	*  Errors in kaguya protected calls are reported to ErrorHandler(or thrown as LuaMemoryError).
+	*  Allocation failure outside protected calls(e.g. pushing values from C++ without pcall) ends with Lua panic, keep headroom for them.
+	* Soft limit: first growth over the limit fails once, and Lua runs emergency full garbage collection(same as GCType::collect()) and retries.
+	*  Not refused while the collector is stopped(tracked through State::gc() or setCollectorRunning, not collectgarbage in Lua)
+	*  or the allocator is shared by several States. The allocator does not call Lua API, so allocation in finalizers may be refused.
+	*  When not refused, the allocation succeeds and collectPending() becomes true. Call GCType::collect() at a safe point.
+	*  Rearmed after usage falls below the soft limit. Lua 5.1 has no emergency collection, and soft limit only sets collectPending().
+	* @code
+	* kaguya::standard::shared_ptr<kaguya::LimitedAllocator> budget(new kaguya::LimitedAllocator(16 * 1024 * 1024, 8 * 1024 * 1024));
+	* kaguya::State state(budget);
+	* @endcode
+	*/
+	class LimitedAllocator :public Allocator
+	{
+	public:
+		/**
+		* @param hard_limit hard limit in bytes. 0 is unlimited
+		* @param soft_limit soft limit in bytes. 0 is disabled
+		* @param base underlying allocator. DefaultAllocator if null
+		*/
+		explicit LimitedAllocator(size_t hard_limit, size_t soft_limit = 0, const standard::shared_ptr<Allocator>& base = standard::shared_ptr<Allocator>())
+			:base_(base ? base : standard::shared_ptr<Allocator>(new DefaultAllocator())), hard_limit_(hard_limit), soft_limit_(soft_limit), soft_armed_(true)
+			, collect_pending_(false), soft_collect_count_(0), limit_failure_count_(0), state_(0), attached_count_(0), collector_running_(true)
+		{
+		}
+
+		virtual void attach(lua_State* l)
+		{
+			//which State allocates is unknown if shared
+			state_ = attached_count_++ == 0 ? l : 0;
+			collector_running_ = true;
+		}
+		virtual void detach(lua_State* l)
+		{
+			attached_count_--;
+			if (state_ == l) { state_ = 0; }
+		}
+		virtual void collectorChanged(lua_State* l, bool running)
+		{
+			if (state_ == l) { collector_running_ = running; }
+		}
+
+		virtual void* allocate(size_t size)
+		{
+			if (!admit(0, size)) { return 0; }
+			return base_->allocate(size);
+		}
+		virtual void deallocate(void* ptr, size_t size)
+		{
+			base_->deallocate(ptr, size);
+			if (soft_limit_ && stats().live_bytes - size < soft_limit_)
+			{
+				soft_armed_ = true;
+				collect_pending_ = false;
+			}
+		}
+		virtual void* reallocate(void* ptr, size_t osize, size_t nsize)
+		{
+			if (nsize > osize && !admit(osize, nsize)) { return 0; }
+			return base_->reallocate(ptr, osize, nsize);
+		}
+
+		size_t hardLimit()const { return hard_limit_; }
+		void setHardLimit(size_t limit) { hard_limit_ = limit; }
+		size_t softLimit()const { return soft_limit_; }
+		void setSoftLimit(size_t limit) { soft_limit_ = limit; soft_armed_ = true; collect_pending_ = false; }
+		//! usage is over soft limit and Lua could not collect by itself
+		bool collectPending()const { return collect_pending_; }
+		//! tell collector state changed without State::gc(). e.g. collectgarbage("stop") in Lua
+		void setCollectorRunning(bool running) { collector_running_ = running; }
+
+		//! bytes in use by Lua
+		size_t liveBytes()const { return stats().live_bytes; }
+		//! peak bytes in use by Lua
+		size_t peakBytes()const { return stats().peak_bytes; }
+		//! count of garbage collection triggered by soft limit
+		size_t softCollectCount()const { return soft_collect_count_; }
+		//! count of allocation refused by hard limit
+		size_t limitFailureCount()const { return limit_failure_count_; }
+	private:
+		bool admit(size_t osize, size_t nsize)
+		{
+			size_t next = stats().live_bytes - osize + nsize;
+			if (hard_limit_ && next > hard_limit_)
+			{
+				limit_failure_count_++;
+				return false;
+			}
+			if (soft_limit_ && soft_armed_ && next > soft_limit_)
+			{
+				if (!emergencyCollectable())
+				{
+					collect_pending_ = true;
+					return true;
+				}
+				soft_armed_ = false;
+				collect_pending_ = false;
+				soft_collect_count_++;
+				return false;//Lua performs emergency collection and retries
+			}
+			return true;
+		}
+		//! Lua runs emergency collection if allocation fails now
+		bool emergencyCollectable()const
+		{
+#if LUA_VERSION_NUM >= 502
+			return state_ && collector_running_;
+#else
+			return false;
+#endif
+		}
+
+		standard::shared_ptr<Allocator> base_;
+		size_t hard_limit_;
+		size_t soft_limit_;
+		bool soft_armed_;
+		bool collect_pending_;
+		size_t soft_collect_count_;
+		size_t limit_failure_count_;
+		lua_State* state_;
+		size_t attached_count_;
+		bool collector_running_;
+	};
+}
@@ -0,0 +1,410 @@
+// Copyright satoren
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include "kaguya/config.hpp"
+
+#if KAGUYA_USE_BINDING_PROFILER
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <ctime>
+#include <new>
+#if KAGUYA_USE_CPP11
+#include <chrono>
+#endif
+
+#include "kaguya/utility.hpp"
+
+namespace kaguya
+{
+	//! profile of one bound function(each overload) or Lua function called by LuaRef::call. times are inclusive nanoseconds
+	struct BindingProfileEntry
+	{
+		BindingProfileEntry() :native(false), call_count(0), argument_check_ns(0), overload_select_ns(0), argument_convert_ns(0), body_ns(0), result_ns(0) {}
+
+		//! registered name found from global table. signature if not found
+		std::string name;
+		//! argument types of bound function, or source:line of Lua function
+		std::string signature;
+		//! bound C++ function, or Lua function called by LuaRef::call
+		bool native;
+		size_t call_count;
+		//! type check of overload candidates
+		double argument_check_ns;
+		//! overload selection except type check
+		double overload_select_ns;
+		//! conversion of arguments(with C++03, included in body_ns) / push arguments of LuaRef::call
+		double argument_convert_ns;
+		//! C++ function body / lua_pcall
+		double body_ns;
+		//! push results to Lua / conversion of results of LuaRef::call
+		double result_ns;
+
+		double total_ns()const { return argument_check_ns + overload_select_ns + argument_convert_ns + body_ns + result_ns; }
+	};
+
+	/**
+	* Per State profiler of the binding layer. Enabled by KAGUYA_USE_BINDING_PROFILER.
+	* Records bound functions called through functor_dispatcher or function_trampoline, and LuaRef::call.
+	* Entries are keyed by address of the bound object or Lua function, and named at report time by searching global table.
+	* Functions having entries are kept alive(pinned in the registry) until reset(), so an address is not reused by other function.
+	* With C++03, profile calls from one thread only.
+	* @code
+	* state.bindingProfiler().start();
+	* state.dofile("game.lua");
+	* state.bindingProfiler().stop();
+	* std::cout << state.bindingProfiler().report();
+	* @endcode
+	*/
+	class BindingProfiler
+	{
+	public:
+		typedef std::string(*signature_function)(const void* key);
+
+		void start() { running_ = true; }
+		void stop() { running_ = false; }
+		bool running()const { return running_; }
+		//! remove recorded entries and release pinned functions
+		void reset()
+		{
+			entries_.clear();
+			util::ScopedSavedStack save(state_);
+			lua_pushlightuserdata(state_, pinKey());
+			lua_pushnil(state_);
+			lua_rawset(state_, LUA_REGISTRYINDEX);
+		}
+
+		//! entries sorted by total time descending
+		std::vector<BindingProfileEntry> entries()const
+		{
+			std::map<const void*, std::string> names = util::registered_function_names(state_);
+			std::vector<BindingProfileEntry> result;
+			result.reserve(entries_.size());
+			for (EntryMap::const_iterator it = entries_.begin(); it != entries_.end(); ++it)
+			{
+				result.push_back(it->second);
+				std::map<const void*, std::string>::const_iterator name = names.find(it->first);
+				result.back().name = name != names.end() ? name->second : it->second.signature;
+			}
+			std::stable_sort(result.begin(), result.end(), &greater_total);
+			return result;
+		}
+		//! text table of entries(). times are milliseconds
+		std::string report()const
+		{
+			std::vector<BindingProfileEntry> list = entries();
+			std::ostringstream os;
+			os << std::left << std::setw(32) << "name" << std::right << std::setw(10) << "calls"
+				<< std::setw(12) << "total_ms" << std::setw(12) << "check_ms" << std::setw(12) << "select_ms"
+				<< std::setw(12) << "convert_ms" << std::setw(12) << "body_ms" << std::setw(12) << "result_ms"
+				<< std::setw(12) << "ns/call" << "  signature\n";
+			os << std::fixed;
+			for (size_t i = 0; i < list.size(); ++i)
+			{
+				const BindingProfileEntry& e = list[i];
+				os << std::left << std::setw(32) << (e.native ? e.name : "[lua] " + e.name) << std::right << std::setw(10) << e.call_count
+					<< std::setprecision(3) << std::setw(12) << e.total_ns() / 1e6 << std::setw(12) << e.argument_check_ns / 1e6
+					<< std::setw(12) << e.overload_select_ns / 1e6 << std::setw(12) << e.argument_convert_ns / 1e6
+					<< std::setw(12) << e.body_ns / 1e6 << std::setw(12) << e.result_ns / 1e6
+					<< std::setprecision(0) << std::setw(12) << (e.call_count ? e.total_ns() / e.call_count : 0)
+					<< "  " << e.signature << "\n";
+			}
+			return os.str();
+		}
+
+		//! profiler of the State. null if not created
+		static BindingProfiler* find(lua_State* l)
+		{
+			lua_pushlightuserdata(l, key());
+			lua_rawget(l, LUA_REGISTRYINDEX);
+			BindingProfiler* profiler = static_cast<BindingProfiler*>(lua_touserdata(l, -1));
+			lua_pop(l, 1);
+			return profiler;
+		}
+		//! profiler of the State. created at first call
+		static BindingProfiler& get(lua_State* l)
+		{
+			BindingProfiler* profiler = find(l);
+			if (profiler) { return *profiler; }
+			util::ScopedSavedStack save(l);
+			lua_pushlightuserdata(l, key());
+			profiler = new(lua_newuserdata(l, sizeof(BindingProfiler))) BindingProfiler(util::toMainThread(l));
+			lua_newtable(l);
+			lua_pushcfunction(l, &destructor);
+			lua_setfield(l, -2, "__gc");
+			lua_setmetatable(l, -2);
+			lua_rawset(l, LUA_REGISTRYINDEX);
+			return *profiler;
+		}
+
+		//! entry of key for instrumentation. signature is set at first call
+		BindingProfileEntry& entry(const void* key, bool native, signature_function signature)
+		{
+			EntryMap::iterator it = entries_.find(key);
+			if (it == entries_.end())
+			{
+				it = entries_.insert(std::make_pair(key, BindingProfileEntry())).first;
+				it->second.native = native;
+				if (signature) { it->second.signature = signature(key); }
+			}
+			return it->second;
+		}
+		bool hasEntry(const void* key)const { return entries_.find(key) != entries_.end(); }
+		//! keep value at index(function of an entry) alive until reset
+		void pin(lua_State* l, int index)
+		{
+			util::ScopedSavedStack save(l);
+			index = lua_absindex(l, index);
+			lua_pushlightuserdata(l, pinKey());
+			lua_rawget(l, LUA_REGISTRYINDEX);
+			if (lua_isnil(l, -1))
+			{
+				lua_pop(l, 1);
+				lua_newtable(l);
+				lua_pushlightuserdata(l, pinKey());
+				lua_pushvalue(l, -2);
+				lua_rawset(l, LUA_REGISTRYINDEX);
+			}
+			lua_pushvalue(l, index);
+			lua_pushboolean(l, 1);
+			lua_rawset(l, -3);
+		}
+	private:
+		typedef std::map<const void*, BindingProfileEntry> EntryMap;
+
+		explicit BindingProfiler(lua_State* state) :state_(state), running_(false) {}
+		BindingProfiler(const BindingProfiler&);
+		BindingProfiler& operator=(const BindingProfiler&);
+
+		static void* key()
+		{
+			static char key_[2];
+			return &key_[0];
+		}
+		//! registry key of table of pinned functions
+		static void* pinKey()
+		{
+			return static_cast<char*>(key()) + 1;
+		}
+		//! objects collected later by lua_close still call bound __gc, so find() must return null from now
+		static int destructor(lua_State* l)
+		{
+			BindingProfiler* profiler = static_cast<BindingProfiler*>(lua_touserdata(l, 1));
+			profiler->running_ = false;
+			lua_pushlightuserdata(l, key());
+			lua_pushnil(l);
+			lua_rawset(l, LUA_REGISTRYINDEX);
+			profiler->~BindingProfiler();
+			return 0;
+		}
+		static bool greater_total(const BindingProfileEntry& a, const BindingProfileEntry& b)
+		{
+			return a.total_ns() > b.total_ns();
+		}
+
+		lua_State* state_;
+		bool running_;
+		EntryMap entries_;
+	};
+
+	namespace binding_profiler
+	{
+		inline double now()
+		{
+#if KAGUYA_USE_CPP11
+			return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+			return double(std::clock()) * (1e9 / CLOCKS_PER_SEC);
+#endif
+		}
+
+		//! timestamps of a native call in progress. profiler is null if not running
+		struct Frame
+		{
+			Frame(BindingProfiler* p, double t) :profiler(p), key(0), signature(0), start(t), selected(t), check(0), body_begin(0), body_end(0) {}
+			BindingProfiler* profiler;
+			const void* key;
+			BindingProfiler::signature_function signature;
+			double start;
+			double selected;
+			double check;
+			double body_begin;
+			double body_end;
+		};
+		/**
+		* Native calls in progress on this thread. Frames are values, not pointers to C stack,
+		* so a frame skipped by longjmp is only discarded by the enclosing call.
+		*/
+		inline std::vector<Frame>& frames()
+		{
+#if KAGUYA_USE_CPP11
+			static thread_local std::vector<Frame> frames_;
+#else
+			static std::vector<Frame> frames_;
+#endif
+			return frames_;
+		}
+		inline Frame* active_frame()
+		{
+			std::vector<Frame>& f = frames();
+			return !f.empty() && f.back().profiler ? &f.back() : 0;
+		}
+
+		//! one call of functor_dispatcher or function_trampoline
+		class NativeCallScope
+		{
+		public:
+			explicit NativeCallScope(lua_State* l) :l_(l), index_(frames().size())
+			{
+				BindingProfiler* profiler = BindingProfiler::find(l);
+				if (profiler && !profiler->running()) { profiler = 0; }
+				frames().push_back(Frame(profiler, profiler ? now() : 0));
+			}
+			~NativeCallScope() { finish(); }
+
+			void selected(const void* key, BindingProfiler::signature_function signature)
+			{
+				Frame& frame = frames()[index_];
+				if (!frame.profiler) { return; }
+				frame.key = key;
+				frame.signature = signature;
+				lua_Debug ar;
+				if (!frame.profiler->hasEntry(key) && lua_checkstack(l_, 4) && lua_getstack(l_, 0, &ar) && lua_getinfo(l_, "f", &ar))
+				{
+					//running closure holds key object by upvalue
+					frame.profiler->pin(l_, -1);
+					lua_pop(l_, 1);
+				}
+				frame.selected = now();
+			}
+			//! record the call. must be called before lua_error
+			void finish()
+			{
+				std::vector<Frame>& f = frames();
+				if (f.size() <= index_) { return; }
+				Frame frame = f[index_];
+				f.erase(f.begin() + index_, f.end());
+				if (!frame.profiler || !frame.key) { return; }
+				double end = now();
+				BindingProfileEntry& entry = frame.profiler->entry(frame.key, true, frame.signature);
+				entry.call_count++;
+				entry.argument_check_ns += frame.check;
+				entry.overload_select_ns += frame.selected - frame.start - frame.check;
+				if (frame.body_begin > 0 && frame.body_end >= frame.body_begin)
+				{
+					entry.argument_convert_ns += frame.body_begin - frame.selected;
+					entry.body_ns += frame.body_end - frame.body_begin;
+					entry.result_ns += end - frame.body_end;
+				}
+				else
+				{
+					entry.body_ns += end - frame.selected;
+				}
+			}
+		private:
+			NativeCallScope(const NativeCallScope&);
+			NativeCallScope& operator=(const NativeCallScope&);
+			lua_State* l_;
+			size_t index_;
+		};
+
+		//! type check of overload candidate
+		class ArgumentCheckScope
+		{
+		public:
+			ArgumentCheckScope() :start_(active_frame() ? now() : 0) {}
+			~ArgumentCheckScope()
+			{
+				Frame* frame = active_frame();
+				if (frame && start_ > 0) { frame->check += now() - start_; }
+			}
+		private:
+			double start_;
+		};
+
+		//! C++ function body. arguments are already converted
+		class BodyScope
+		{
+		public:
+			BodyScope()
+			{
+				Frame* frame = active_frame();
+				if (frame && frame->body_begin == 0) { frame->body_begin = now(); }
+			}
+			~BodyScope()
+			{
+				Frame* frame = active_frame();
+				if (frame) { frame->body_end = now(); }
+			}
+		};
+
+		//! LuaRef::call. function is at index
+		class LuaCallScope
+		{
+		public:
+			LuaCallScope(lua_State* l, int index) :profiler_(BindingProfiler::find(l)), key_(lua_topointer(l, index)), pushed_(0), returned_(0)
+			{
+				if (profiler_ && (!profiler_->running() || !key_)) { profiler_ = 0; }
+				if (!profiler_) { return; }
+				if (!profiler_->hasEntry(key_))
+				{
+					lua_Debug ar;
+					lua_pushvalue(l, index);
+					lua_getinfo(l, ">S", &ar);
+					std::ostringstream signature;
+					signature << ar.short_src << ":" << ar.linedefined;
+					profiler_->entry(key_, false, 0).signature = signature.str();
+					profiler_->pin(l, index);
+				}
+				start_ = now();
+			}
+			void pushed() { if (profiler_) { pushed_ = now(); } }
+			void returned() { if (profiler_) { returned_ = now(); } }
+			~LuaCallScope()
+			{
+				if (!profiler_ || pushed_ == 0) { return; }
+				double end = now();
+				if (returned_ == 0) { returned_ = end; }
+				BindingProfileEntry& entry = profiler_->entry(key_, false, 0);
+				entry.call_count++;
+				entry.argument_convert_ns += pushed_ - start_;
+				entry.body_ns += returned_ - pushed_;
+				entry.result_ns += end - returned_;
+			}
+		private:
+			LuaCallScope(const LuaCallScope&);
+			LuaCallScope& operator=(const LuaCallScope&);
+			BindingProfiler* profiler_;
+			const void* key_;
+			double start_;
+			double pushed_;
+			double returned_;
+		};
+	}
+}
+
+#define KAGUYA_PROFILE_NATIVE_CALL(L) ::kaguya::binding_profiler::NativeCallScope kaguya_profile_call_(L)
+#define KAGUYA_PROFILE_NATIVE_SELECTED(KEY, SIGNATURE) kaguya_profile_call_.selected(KEY, SIGNATURE)
+#define KAGUYA_PROFILE_NATIVE_FINISH() kaguya_profile_call_.finish()
+#define KAGUYA_PROFILE_ARGUMENT_CHECK() ::kaguya::binding_profiler::ArgumentCheckScope kaguya_profile_check_
+#define KAGUYA_PROFILE_NATIVE_BODY() ::kaguya::binding_profiler::BodyScope kaguya_profile_body_
+#define KAGUYA_PROFILE_LUA_CALL(L, INDEX) ::kaguya::binding_profiler::LuaCallScope kaguya_profile_lua_call_(L, INDEX)
+#define KAGUYA_PROFILE_LUA_CALL_PUSHED() kaguya_profile_lua_call_.pushed()
+#define KAGUYA_PROFILE_LUA_CALL_RETURNED() kaguya_profile_lua_call_.returned()
+#else
+#define KAGUYA_PROFILE_NATIVE_CALL(L)
+#define KAGUYA_PROFILE_NATIVE_SELECTED(KEY, SIGNATURE)
+#define KAGUYA_PROFILE_NATIVE_FINISH()
+#define KAGUYA_PROFILE_ARGUMENT_CHECK()
+#define KAGUYA_PROFILE_NATIVE_BODY()
+#define KAGUYA_PROFILE_LUA_CALL(L, INDEX)
+#define KAGUYA_PROFILE_LUA_CALL_PUSHED()
+#define KAGUYA_PROFILE_LUA_CALL_RETURNED()
+#endif
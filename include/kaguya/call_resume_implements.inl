@@ -17,9 +17,12 @@ template<class Result, class...Args> Result call(Args&&... args)
 {
 	int argstart = lua_gettop(state_) + 1;
 	push(state_);
+	KAGUYA_PROFILE_LUA_CALL(state_, argstart);
 	util::push_args(state_, std::forward<Args>(args)...);
 	int argnum = lua_gettop(state_) - argstart;
+	KAGUYA_PROFILE_LUA_CALL_PUSHED();
 	int result = lua_pcall(state_, argnum, LUA_MULTRET, 0);
+	KAGUYA_PROFILE_LUA_CALL_RETURNED();
 	except::checkErrorAndThrow(result, state_);
 	return returnvalue_(state_, argstart, types::typetag<Result>());
 }
@@ -66,9 +69,12 @@ template<class...Args> FunctionResults operator()(Args&&... args)
 		{\
 			int argstart = lua_gettop(state_) + 1;\
 			push(state_);\
+			KAGUYA_PROFILE_LUA_CALL(state_, argstart);\
 			util::push_args(state_ KAGUYA_PP_REPEAT(N,KAGUYA_PUSH_ARG_DEF));\
 			int argnum = lua_gettop(state_) - argstart;\
+			KAGUYA_PROFILE_LUA_CALL_PUSHED();\
 			int result = lua_pcall(state_, argnum, LUA_MULTRET, 0);\
+			KAGUYA_PROFILE_LUA_CALL_RETURNED();\
 			except::checkErrorAndThrow(result, state_);\
 			return returnvalue_(state_, argstart, types::typetag<Result>());\
 		}
@@ -0,0 +1,339 @@
+// Copyright satoren
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <string>
+#include <map>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "kaguya/config.hpp"
+#include "kaguya/utility.hpp"
+
+#if KAGUYA_USE_CPP11
+#include <mutex>
+#endif
+
+namespace kaguya
+{
+	//! statistics of ChunkCache
+	struct ChunkCacheStats
+	{
+		ChunkCacheStats() :hit_count(0), miss_count(0), disk_hit_count(0), entry_count(0), bytecode_bytes(0) {}
+
+		//! loaded from cached bytecode(include disk_hit_count)
+		size_t hit_count;
+		//! compiled by parser
+		size_t miss_count;
+		//! bytecode read from cache directory
+		size_t disk_hit_count;
+		size_t entry_count;
+		//! total size of bytecode in memory
+		size_t bytecode_bytes;
+	};
+
+	/**
+	* Cache of compiled chunks(lua_dump output) shared by States.
+	* Strings are keyed by size and hash of content, files by path, size and hash of content. File is read at every load, but not parsed on hit.
+	* Source is not kept, so different code having same size and 64bit hash is not detected.
+	* If cache directory is given, bytecode is also written to(and read from) the directory.
+	* Cache file keeps the key, and bytecode is used only if the key matches.
+	* Bytecode is not verified by Lua. Do not use cache directory writable by untrusted users.
+	* With C++11, ChunkCache is thread safe.
+	* @code
+	* kaguya::standard::shared_ptr<kaguya::ChunkCache> cache(new kaguya::ChunkCache());
+	* kaguya::State state;
+	* state.setChunkCache(cache);
+	* state.dofile("rules.lua");//parsed once for all States using cache
+	* @endcode
+	*/
+	class ChunkCache
+	{
+	public:
+		/**
+		* @param directory cache directory for bytecode files. empty is memory only
+		*/
+		explicit ChunkCache(const std::string& directory = std::string()) :directory_(directory), temp_count_(0) {}
+
+		/**
+		* @brief same as luaL_loadbuffer. push compiled function(or error message) and return status.
+		*/
+		int loadbuffer(lua_State* l, const char* code, size_t size, const char* chunkname)
+		{
+			std::string key = stringKey(code, size);
+			if (loadCached(l, key, chunkname))
+			{
+				return 0;
+			}
+			int status = luaL_loadbuffer(l, code, size, chunkname);
+			if (status == 0)
+			{
+				store(l, key);
+			}
+			return status;
+		}
+		//! same as luaL_loadstring
+		int loadstring(lua_State* l, const char* code)
+		{
+			return loadbuffer(l, code, std::strlen(code), code);
+		}
+		//! same as luaL_loadfile
+		int loadfile(lua_State* l, const char* path)
+		{
+			std::string source;
+			if (!readSource(path, source))
+			{
+				return luaL_loadfile(l, path);//report error by Lua
+			}
+			std::string key = fileKey(path, source);
+			std::string chunkname = std::string("@") + path;
+			if (loadCached(l, key, chunkname.c_str()))
+			{
+				return 0;
+			}
+			int status = luaL_loadbuffer(l, source.data(), source.size(), chunkname.c_str());
+			if (status == 0)
+			{
+				store(l, key);
+			}
+			return status;
+		}
+
+		ChunkCacheStats stats()const
+		{
+			Lock lock(mutex_);
+			ChunkCacheStats result = stats_;
+			result.entry_count = entries_.size();
+			return result;
+		}
+		//! remove cached bytecode from memory. cache files are not removed.
+		void clear()
+		{
+			Lock lock(mutex_);
+			entries_.clear();
+			stats_.bytecode_bytes = 0;
+		}
+
+		//! cache key of Lua code
+		static std::string stringKey(const char* code, size_t size)
+		{
+			std::ostringstream key;
+			key << "string:" << size << ":" << hashString(code, size);
+			return key.str();
+		}
+		//! cache key of file. empty if file can not be read
+		static std::string fileKey(const char* path)
+		{
+			std::string source;
+			return readSource(path, source) ? fileKey(path, source) : std::string();
+		}
+		//! cache file path of key. empty if no cache directory
+		std::string diskPath(const std::string& key)const
+		{
+			if (directory_.empty()) { return std::string(); }
+			return directory_ + "/" + hashString(key.data(), key.size()) + ".luac";
+		}
+	private:
+#if KAGUYA_USE_CPP11
+		typedef std::mutex Mutex;
+		typedef std::lock_guard<std::mutex> Lock;
+#else
+		struct Mutex {};
+		struct Lock { Lock(Mutex&) {} };
+#endif
+		typedef standard::shared_ptr<const std::string> Bytecode;
+		typedef std::map<std::string, Bytecode> EntryMap;
+
+		ChunkCache(const ChunkCache&);
+		ChunkCache& operator=(const ChunkCache&);
+
+		struct BufferReader
+		{
+			const char* data;
+			size_t size;
+		};
+		static const char* read_buffer(lua_State*, void* data, size_t* size)
+		{
+			BufferReader* buffer = static_cast<BufferReader*>(data);
+			*size = buffer->size;
+			buffer->size = 0;
+			return *size ? buffer->data : 0;
+		}
+		static int write_string(lua_State*, const void* p, size_t size, void* data)
+		{
+			static_cast<std::string*>(data)->append(static_cast<const char*>(p), size);
+			return 0;
+		}
+
+		static std::string fileKey(const char* path, const std::string& source)
+		{
+			std::ostringstream key;
+			key << "file:" << source.size() << ":" << hashString(source.data(), source.size()) << ":" << path;
+			return key.str();
+		}
+		//! read file as luaL_loadfile does. UTF-8 BOM is removed, and first line beginning with # is removed except newline
+		static bool readSource(const char* path, std::string& source)
+		{
+			FILE* file = path ? std::fopen(path, "rb") : 0;
+			if (!file) { return false; }
+			char buffer[4096];
+			size_t size;
+			while ((size = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+			{
+				source.append(buffer, size);
+			}
+			bool failed = std::ferror(file) != 0;
+			std::fclose(file);
+			if (failed) { return false; }
+			if (source.compare(0, 3, "\xEF\xBB\xBF") == 0)
+			{
+				source.erase(0, 3);
+			}
+			if (!source.empty() && source[0] == '#')
+			{
+				source.erase(0, source.find('\n'));
+			}
+			return true;
+		}
+		static int processId()
+		{
+#if defined(_WIN32)
+			return _getpid();
+#else
+			return static_cast<int>(getpid());
+#endif
+		}
+
+		//! FNV-1a 64bit as hex string
+		static std::string hashString(const char* data, size_t size)
+		{
+			unsigned long long hash = 14695981039346656037ULL;
+			for (size_t i = 0; i < size; ++i)
+			{
+				hash ^= static_cast<unsigned char>(data[i]);
+				hash *= 1099511628211ULL;
+			}
+			std::ostringstream os;
+			os << std::hex << std::setw(16) << std::setfill('0') << hash;
+			return os.str();
+		}
+
+		//! cache file is key line and bytecode
+		Bytecode readFile(const std::string& key)const
+		{
+			std::string path = diskPath(key);
+			if (path.empty()) { return Bytecode(); }
+			FILE* file = std::fopen(path.c_str(), "rb");
+			if (!file) { return Bytecode(); }
+			std::string contents;
+			char buffer[4096];
+			size_t size;
+			while ((size = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+			{
+				contents.append(buffer, size);
+			}
+			std::fclose(file);
+			if (contents.size() <= key.size() || contents.compare(0, key.size(), key) != 0 || contents[key.size()] != '\n')
+			{
+				return Bytecode();
+			}
+			return Bytecode(new std::string(contents, key.size() + 1));
+		}
+		void writeFile(const std::string& key, const std::string& bytecode)
+		{
+			std::string path = diskPath(key);
+			if (path.empty()) { return; }
+			std::ostringstream temp_name;
+			{
+				Lock lock(mutex_);
+				//unique per process, cache and write
+				temp_name << path << "." << processId() << "." << static_cast<const void*>(this) << "." << ++temp_count_ << ".tmp";
+			}
+			std::string temp = temp_name.str();
+			FILE* file = std::fopen(temp.c_str(), "wb");
+			if (!file) { return; }
+			bool written = std::fwrite(key.data(), 1, key.size(), file) == key.size()
+				&& std::fputc('\n', file) != EOF
+				&& std::fwrite(bytecode.data(), 1, bytecode.size(), file) == bytecode.size();
+			written = std::fclose(file) == 0 && written;
+			if (!written || std::rename(temp.c_str(), path.c_str()) != 0)
+			{
+				std::remove(temp.c_str());
+			}
+		}
+
+		//! push cached function if exists
+		bool loadCached(lua_State* l, const std::string& key, const char* chunkname)
+		{
+			Bytecode bytecode;
+			{
+				Lock lock(mutex_);
+				EntryMap::const_iterator it = entries_.find(key);
+				if (it != entries_.end())
+				{
+					bytecode = it->second;
+				}
+			}
+			bool from_disk = false;
+			if (!bytecode)
+			{
+				bytecode = readFile(key);
+				from_disk = bytecode.get() != 0;
+			}
+			if (bytecode)
+			{
+				BufferReader reader = { bytecode->data(), bytecode->size() };
+				if (util::lua_load_compat(l, &read_buffer, &reader, chunkname, "b") == 0)
+				{
+					Lock lock(mutex_);
+					stats_.hit_count++;
+					if (from_disk)
+					{
+						stats_.disk_hit_count++;
+						insert(key, bytecode);
+					}
+					return true;
+				}
+				lua_pop(l, 1);//incompatible bytecode. compile again
+			}
+			Lock lock(mutex_);
+			stats_.miss_count++;
+			return false;
+		}
+		//! dump compiled function at stack top
+		void store(lua_State* l, const std::string& key)
+		{
+			std::string bytecode;
+			if (util::lua_dump_compat(l, &write_string, &bytecode, false) != 0)
+			{
+				return;
+			}
+			writeFile(key, bytecode);
+			Lock lock(mutex_);
+			insert(key, Bytecode(new std::string(bytecode)));
+		}
+		void insert(const std::string& key, const Bytecode& bytecode)
+		{
+			Bytecode& entry = entries_[key];
+			if (entry) { stats_.bytecode_bytes -= entry->size(); }
+			entry = bytecode;
+			stats_.bytecode_bytes += bytecode->size();
+		}
+
+		std::string directory_;
+		size_t temp_count_;
+		EntryMap entries_;
+		ChunkCacheStats stats_;
+		mutable Mutex mutex_;
+	};
+}
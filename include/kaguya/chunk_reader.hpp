@@ -0,0 +1,295 @@
+// Copyright satoren
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+#include "kaguya/config.hpp"
+#include "kaguya/utility.hpp"
+
+#if KAGUYA_USE_MMAP
+#if defined(_WIN32)
+//do not leak min and max macros to users
+#ifndef NOMINMAX
+#define NOMINMAX
+#define KAGUYA_DEFINED_NOMINMAX
+#endif
+#include <windows.h>
+#ifdef KAGUYA_DEFINED_NOMINMAX
+#undef NOMINMAX
+#undef KAGUYA_DEFINED_NOMINMAX
+#endif
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#endif
+
+namespace kaguya
+{
+	/**
+	* Streaming source of Lua chunk for State::loadstream and State::dostream.
+	* read() is called by lua_load until it returns 0 size. read() must not throw.
+	*/
+	class ChunkReader
+	{
+	public:
+		virtual ~ChunkReader() {}
+
+		/**
+		* @brief return next block of chunk. the block must be valid until next call.
+		* @param size set size of block. 0 is end of chunk
+		*/
+		virtual const char* read(size_t& size) = 0;
+	};
+
+	/**
+	* Read Lua script file by memory mapped window(or stdio if KAGUYA_USE_MMAP is 0).
+	* Only one window of block size is mapped at a time, so memory usage does not grow with file size.
+	* Like luaL_loadfile, UTF-8 BOM and first line starting with '#' are skipped.
+	*/
+	class MappedFileReader :public ChunkReader
+	{
+	public:
+		/**
+		* @param path file path
+		* @param block_size size of mapped window. rounded up to mapping granularity
+		*/
+		explicit MappedFileReader(const char* path, size_t block_size = 1024 * 1024)
+			:file_size_(0), offset_(0), block_size_(block_size ? block_size : 1), view_(0), view_size_(0), header_(HEADER_BOM), open_(false)
+#if KAGUYA_USE_MMAP
+#if defined(_WIN32)
+			, file_(INVALID_HANDLE_VALUE), mapping_(0)
+#else
+			, fd_(-1)
+#endif
+#else
+			, file_(0)
+#endif
+		{
+			open(path);
+		}
+		~MappedFileReader()
+		{
+			close();
+		}
+
+		bool isOpen()const { return open_; }
+		size_t fileSize()const { return file_size_; }
+
+		virtual const char* read(size_t& size)
+		{
+			for (;;)
+			{
+				const char* block = nextBlock(size);
+				if (!block || size == 0)
+				{
+					size = 0;
+					return 0;
+				}
+				block = skipHeader(block, size);
+				if (size > 0)
+				{
+					return block;
+				}
+			}
+		}
+	private:
+		MappedFileReader(const MappedFileReader&);
+		MappedFileReader& operator=(const MappedFileReader&);
+
+		enum HeaderState
+		{
+			HEADER_BOM,
+			HEADER_COMMENT_START,
+			HEADER_COMMENT,
+			HEADER_DONE
+		};
+		//! skip BOM and '#' line. line feed is kept for line numbers
+		const char* skipHeader(const char* block, size_t& size)
+		{
+			if (header_ == HEADER_BOM)
+			{
+				if (size >= 3 && std::memcmp(block, "\xEF\xBB\xBF", 3) == 0)
+				{
+					block += 3;
+					size -= 3;
+				}
+				header_ = HEADER_COMMENT_START;
+			}
+			if (header_ == HEADER_COMMENT_START && size > 0)
+			{
+				header_ = block[0] == '#' ? HEADER_COMMENT : HEADER_DONE;
+			}
+			if (header_ == HEADER_COMMENT)
+			{
+				const char* newline = static_cast<const char*>(std::memchr(block, '\n', size));
+				if (!newline)
+				{
+					size = 0;
+					return block;
+				}
+				size -= newline - block;
+				block = newline;
+				header_ = HEADER_DONE;
+			}
+			return block;
+		}
+
+#if KAGUYA_USE_MMAP
+		static size_t granularity()
+		{
+#if defined(_WIN32)
+			SYSTEM_INFO info;
+			GetSystemInfo(&info);
+			return info.dwAllocationGranularity;
+#else
+			return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+		}
+		void open(const char* path)
+		{
+			size_t unit = granularity();
+			block_size_ = (block_size_ + unit - 1) / unit * unit;
+#if defined(_WIN32)
+			file_ = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+			if (file_ == INVALID_HANDLE_VALUE) { return; }
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(file_, &size)) { return; }
+			file_size_ = static_cast<size_t>(size.QuadPart);
+			if (file_size_ > 0)
+			{
+				mapping_ = CreateFileMappingA(file_, 0, PAGE_READONLY, 0, 0, 0);
+				if (!mapping_) { return; }
+			}
+#else
+			fd_ = ::open(path, O_RDONLY);
+			if (fd_ < 0) { return; }
+			struct stat status;
+			if (fstat(fd_, &status) != 0) { return; }
+			file_size_ = static_cast<size_t>(status.st_size);
+#endif
+			open_ = true;
+		}
+		void unmap()
+		{
+			if (!view_) { return; }
+#if defined(_WIN32)
+			UnmapViewOfFile(view_);
+#else
+			munmap(view_, view_size_);
+#endif
+			view_ = 0;
+		}
+		const char* nextBlock(size_t& size)
+		{
+			unmap();
+			if (!open_ || offset_ >= file_size_) { return 0; }
+			view_size_ = file_size_ - offset_ < block_size_ ? file_size_ - offset_ : block_size_;
+#if defined(_WIN32)
+			unsigned long long offset = offset_;
+			view_ = MapViewOfFile(mapping_, FILE_MAP_READ, static_cast<DWORD>(offset >> 32), static_cast<DWORD>(offset & 0xFFFFFFFF), view_size_);
+#else
+			view_ = mmap(0, view_size_, PROT_READ, MAP_PRIVATE, fd_, static_cast<off_t>(offset_));
+			if (view_ == MAP_FAILED) { view_ = 0; }
+#if defined(POSIX_MADV_SEQUENTIAL)
+			if (view_) { posix_madvise(view_, view_size_, POSIX_MADV_SEQUENTIAL); }
+#endif
+#endif
+			if (!view_) { return 0; }
+			offset_ += view_size_;
+			size = view_size_;
+			return static_cast<const char*>(view_);
+		}
+		void close()
+		{
+			unmap();
+#if defined(_WIN32)
+			if (mapping_) { CloseHandle(mapping_); }
+			if (file_ != INVALID_HANDLE_VALUE) { CloseHandle(file_); }
+#else
+			if (fd_ >= 0) { ::close(fd_); }
+#endif
+		}
+#else
+		void open(const char* path)
+		{
+			block_size_ = (block_size_ + 4095) / 4096 * 4096;
+			file_ = std::fopen(path, "rb");
+			if (!file_) { return; }
+			if (std::fseek(file_, 0, SEEK_END) == 0)
+			{
+				long size = std::ftell(file_);
+				file_size_ = size > 0 ? static_cast<size_t>(size) : 0;
+				std::fseek(file_, 0, SEEK_SET);
+			}
+			buffer_.resize(block_size_);
+			open_ = true;
+		}
+		void unmap() {}
+		const char* nextBlock(size_t& size)
+		{
+			if (!open_) { return 0; }
+			size = std::fread(&buffer_[0], 1, buffer_.size(), file_);
+			offset_ += size;
+			return size ? &buffer_[0] : 0;
+		}
+		void close()
+		{
+			if (file_) { std::fclose(file_); }
+		}
+#endif
+
+		size_t file_size_;
+		size_t offset_;
+		size_t block_size_;
+		void* view_;
+		size_t view_size_;
+		HeaderState header_;
+		bool open_;
+#if KAGUYA_USE_MMAP
+#if defined(_WIN32)
+		HANDLE file_;
+		HANDLE mapping_;
+#else
+		int fd_;
+#endif
+#else
+		FILE* file_;
+		std::vector<char> buffer_;
+#endif
+	};
+
+	namespace util
+	{
+		inline const char* chunk_reader_function(lua_State*, void* data, size_t* size)
+		{
+			return static_cast<ChunkReader*>(data)->read(*size);
+		}
+		//! lua_load from ChunkReader. push compiled function(or error message) and return status
+		inline int load_chunk(lua_State* l, ChunkReader& reader, const char* chunkname)
+		{
+			return lua_load_compat(l, &chunk_reader_function, &reader, chunkname, 0);
+		}
+		//! same as luaL_loadfile, but read by MappedFileReader
+		inline int load_mapped_file(lua_State* l, const char* path)
+		{
+			MappedFileReader reader(path);
+			if (!reader.isOpen())
+			{
+				lua_pushfstring(l, "cannot open %s", path);
+				return LUA_ERRFILE;
+			}
+			std::string chunkname = std::string("@") + path;
+			return load_chunk(l, reader, chunkname.c_str());
+		}
+	}
+}
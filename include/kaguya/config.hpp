@@ -48,6 +48,44 @@ extern "C" {
 #endif
 #endif
 
+//! thread_local storage duration. Visual Studio supports it since 2015
+#ifndef KAGUYA_USE_THREAD_LOCAL
+#if KAGUYA_USE_CPP11 && (!defined(_MSC_VER) || _MSC_VER >= 1900)
+#define KAGUYA_USE_THREAD_LOCAL 1
+#else
+#define KAGUYA_USE_THREAD_LOCAL 0
+#endif
+#endif
+
+
+//! use memory mapped file for State::loadmappedfile. 0 is stdio.
+#ifndef KAGUYA_USE_MMAP
+#if defined(_WIN32) || defined(__unix__) || defined(__APPLE__)
+#define KAGUYA_USE_MMAP 1
+#else
+#define KAGUYA_USE_MMAP 0
+#endif
+#endif
+
+
+//! record call count and time of bound functions and LuaRef::call. see State::bindingProfiler(). 0 is compiled out.
+#ifndef KAGUYA_USE_BINDING_PROFILER
+#define KAGUYA_USE_BINDING_PROFILER 0
+#endif
+
+
+//! std::string_view parameter of bound function. view refers string in Lua.
+#ifndef KAGUYA_USE_STRING_VIEW
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#define KAGUYA_USE_STRING_VIEW 1
+#else
+#define KAGUYA_USE_STRING_VIEW 0
+#endif
+#endif
+#if KAGUYA_USE_STRING_VIEW
+#include <string_view>
+#endif
+
 
 #ifdef KAGUYA_NO_VECTOR_AND_MAP_TO_TABLE
 #define KAGUYA_NO_STD_VECTOR_TO_TABLE
@@ -101,6 +139,12 @@ namespace kaguya
 		}
 		return 0;
 	}
+	inline int lua_absindex(lua_State *L, int idx) {
+		return (idx > 0 || idx <= LUA_REGISTRYINDEX) ? idx : lua_gettop(L) + idx + 1;
+	}
+	inline size_t lua_rawlen(lua_State *L, int idx) {
+		return lua_objlen(L, idx);
+	}
 	inline void luaL_requiref(lua_State *L, const char *modname,
 		lua_CFunction openf, int glb) {
 
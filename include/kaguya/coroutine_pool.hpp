@@ -0,0 +1,216 @@
+// Copyright satoren
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <new>
+
+#include "kaguya/config.hpp"
+#include "kaguya/utility.hpp"
+#include "kaguya/sampling_profiler.hpp"
+#include "kaguya/lua_ref_function.hpp"
+
+namespace kaguya
+{
+	//! statistics of CoroutinePool
+	struct CoroutinePoolStats
+	{
+		CoroutinePoolStats() :created_count(0), reused_count(0), pooled_count(0), discarded_count(0) {}
+
+		//! threads created by lua_newthread
+		size_t created_count;
+		//! threads acquired from pool
+		size_t reused_count;
+		//! threads in pool now
+		size_t pooled_count;
+		//! released threads not pooled(not resettable, already pooled or pool is full)
+		size_t discarded_count;
+	};
+
+	/**
+	* Per State pool of Lua threads for short lived coroutines.
+	* Released threads are reset and kept in a registry table up to maxPooled().
+	* With Lua5.4, any thread not running(including ended by error) is reset by lua_closethread(lua_resetthread).
+	* Before Lua5.4, only finished threads(returned normally or never started) are reusable,
+	* and threads ended by error or still suspended are left to GC.
+	* Release a thread once. Releasing another LuaThread copy of a pooled thread is ignored,
+	* but releasing it after the thread is acquired again resets the coroutine of the new owner.
+	* Reused threads get the current hook of the main thread, same as new threads.
+	* @code
+	* kaguya::CoroutinePool& pool = state.coroutinePool();
+	* kaguya::LuaThread thread = pool.acquire();
+	* int result = thread.resume<int>(task, 1);
+	* pool.release(thread);
+	* @endcode
+	*/
+	class CoroutinePool
+	{
+	public:
+		//! thread from pool, or new thread if pool is empty
+		LuaThread acquire()
+		{
+			if (stats_.pooled_count == 0)
+			{
+				stats_.created_count++;
+				return LuaThread(state_);
+			}
+			util::ScopedSavedStack save(state_);
+			pushPoolTable();
+			int index = static_cast<int>(stats_.pooled_count);
+			lua_rawgeti(state_, -1, index);
+			lua_pushnil(state_);
+			lua_rawseti(state_, -3, index);
+			lua_pushvalue(state_, -1);
+			lua_pushnil(state_);
+			lua_rawset(state_, -4);
+			stats_.pooled_count--;
+			stats_.reused_count++;
+			SamplingProfiler::attachUnhooked(lua_tothread(state_, -1));
+			return LuaThread(state_, StackTop());
+		}
+		/**
+		* @brief reset thread and keep it in pool. thread is set to nil.
+		* @return false if thread is not pooled
+		*/
+		bool release(LuaThread& thread)
+		{
+			lua_State* co = thread.isNilref() ? 0 : thread.get<lua_State*>();
+			bool pooled = false;
+			if (co && stats_.pooled_count < max_pooled_ && !isPooled(thread) && resetThread(co))
+			{
+				util::ScopedSavedStack save(state_);
+				pushPoolTable();
+				thread.push(state_);
+				lua_rawseti(state_, -2, static_cast<int>(++stats_.pooled_count));
+				thread.push(state_);
+				lua_pushboolean(state_, 1);
+				lua_rawset(state_, -3);
+				pooled = true;
+			}
+			else
+			{
+				stats_.discarded_count++;
+			}
+			thread = LuaThread();
+			return pooled;
+		}
+
+		//! maximum number of pooled threads
+		size_t maxPooled()const { return max_pooled_; }
+		//! set maximum number of pooled threads. exceeding threads are discarded
+		void setMaxPooled(size_t count)
+		{
+			max_pooled_ = count;
+			util::ScopedSavedStack save(state_);
+			pushPoolTable();
+			while (stats_.pooled_count > max_pooled_)
+			{
+				int index = static_cast<int>(stats_.pooled_count--);
+				lua_rawgeti(state_, -1, index);
+				lua_pushnil(state_);
+				lua_rawset(state_, -3);
+				lua_pushnil(state_);
+				lua_rawseti(state_, -2, index);
+			}
+		}
+		//! discard all pooled threads
+		void clear()
+		{
+			setMaxPooled(0);
+			max_pooled_ = default_max_pooled;
+		}
+		CoroutinePoolStats stats()const { return stats_; }
+
+		//! pool of the State. created at first call
+		static CoroutinePool& get(lua_State* l)
+		{
+			util::ScopedSavedStack save(l);
+			lua_pushlightuserdata(l, key());
+			lua_rawget(l, LUA_REGISTRYINDEX);
+			CoroutinePool* pool = static_cast<CoroutinePool*>(lua_touserdata(l, -1));
+			if (pool) { return *pool; }
+			lua_pushlightuserdata(l, tableKey());
+			lua_newtable(l);
+			lua_rawset(l, LUA_REGISTRYINDEX);
+			lua_pushlightuserdata(l, key());
+			pool = new(lua_newuserdata(l, sizeof(CoroutinePool))) CoroutinePool(util::toMainThread(l));
+			lua_newtable(l);
+			lua_pushcfunction(l, &destructor);
+			lua_setfield(l, -2, "__gc");
+			lua_setmetatable(l, -2);
+			lua_rawset(l, LUA_REGISTRYINDEX);
+			return *pool;
+		}
+	private:
+		enum { default_max_pooled = 256 };
+
+		explicit CoroutinePool(lua_State* state) :state_(state), max_pooled_(default_max_pooled) {}
+		CoroutinePool(const CoroutinePool&);
+		CoroutinePool& operator=(const CoroutinePool&);
+
+		static void* key()
+		{
+			static char key_[2];
+			return &key_[0];
+		}
+		//! registry key of table of pooled threads
+		static void* tableKey()
+		{
+			return static_cast<char*>(key()) + 1;
+		}
+		static int destructor(lua_State* l)
+		{
+			static_cast<CoroutinePool*>(lua_touserdata(l, 1))->~CoroutinePool();
+			return 0;
+		}
+		void pushPoolTable()const
+		{
+			lua_pushlightuserdata(state_, tableKey());
+			lua_rawget(state_, LUA_REGISTRYINDEX);
+		}
+
+		//! pool table has thread as array element and as key
+		bool isPooled(const LuaThread& thread)const
+		{
+			util::ScopedSavedStack save(state_);
+			pushPoolTable();
+			thread.push(state_);
+			lua_rawget(state_, -2);
+			return lua_toboolean(state_, -1) != 0;
+		}
+		//! make thread resumable with new function. false if the thread can not be reset
+		bool resetThread(lua_State* co)const
+		{
+			if (co == state_) { return false; }
+			lua_Debug ar;
+			if (lua_status(co) == 0 && lua_getstack(co, 0, &ar))
+			{
+				return false;//running or normal
+			}
+#if LUA_VERSION_NUM >= 504
+			//returns original error status, but the thread is reset regardless
+#if defined(LUA_VERSION_RELEASE_NUM) && LUA_VERSION_RELEASE_NUM >= 50406
+			lua_closethread(co, state_);
+#else
+			lua_resetthread(co);
+#endif
+			if (lua_status(co) != 0) { return false; }
+			lua_settop(co, 0);//error object is left
+			return true;
+#else
+			if (lua_status(co) != 0)
+			{
+				return false;//suspended or dead by error
+			}
+			lua_settop(co, 0);
+			return true;
+#endif
+		}
+
+		lua_State* state_;
+		size_t max_pooled_;
+		CoroutinePoolStats stats_;
+	};
+}
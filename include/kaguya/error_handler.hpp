@@ -20,41 +20,51 @@ namespace kaguya
 	{
 		return lua_tostring(state, -1);
 	}
+	/**
+	* Error handler storage. Handler function is stored in the registry of each lua_State
+	* (keyed by a static address), so States owned by different threads do not share any state.
+	* Handler is called in place without copy. Do not replace the handler from inside the handler.
+	*/
 	struct ErrorHandler
 	{
 		typedef standard::function<void(int, const char*)> function_type;
 
 
-		void handle(const char* message, lua_State *state)
+		static void handle(const char* message, lua_State *state)
 		{
-			function_type handler = getHandler(state);
-			if (handler)
+			const function_type* handler = findHandler(state);
+			if (handler && *handler)
 			{
-				handler(0, message);
+				(*handler)(0, message);
 			}
 		}
-		void handle(int status_code, lua_State *state)
+		static void handle(int status_code, lua_State *state)
 		{
-			function_type handler = getHandler(state);
-			if (handler)
+			const function_type* handler = findHandler(state);
+			if (handler && *handler)
 			{
-				handler(status_code, get_error_message(state));
+				(*handler)(status_code, get_error_message(state));
 			}
 		}
 
-		function_type getHandler(lua_State* state)
+		//! copy of registered handler. empty if not registered
+		static function_type getHandler(lua_State* state)
 		{
-
-			function_type* funptr = getFunctionPointer(state);
+			const function_type* funptr = findHandler(state);
 			if (funptr)
 			{
 				return *funptr;
 			}
 			return function_type();
 		}
+		//! registered handler or null. valid until the handler is replaced or the lua_State is closed
+		static const function_type* findHandler(lua_State* state)
+		{
+			return getFunctionPointer(state);
+		}
 
 
-		void unregisterHandler(lua_State* state)
+		static void unregisterHandler(lua_State* state)
 		{
 			if (state)
 			{
@@ -65,23 +75,23 @@ namespace kaguya
 				}
 			}
 		}
-		void registerHandler(lua_State* state, function_type f)
+		static void registerHandler(lua_State* state, function_type f)
 		{
 			if (state)
 			{
 				util::ScopedSavedStack save(state);
-				lua_pushlightuserdata(state, this);
 				if (class_userdata::newmetatable<function_type>(state))//register error handler destructor to Lua state
 				{
 					lua_pushcclosure(state, &error_handler_cleanner, 0);
 					lua_setfield(state, -2, "__gc");
 					lua_setfield(state, -1, "__index");
+					lua_pushlightuserdata(state, key());
 					void* ptr = lua_newuserdata(state, sizeof(function_type));//dummy data for gc call
 					if (!ptr) { throw std::runtime_error("critical error. maybe failed memory allocation"); }//critical error
 					function_type* funptr = new(ptr) function_type();
 					if (!funptr) { throw std::runtime_error("critical error. maybe failed memory allocation"); }//critical error
 					class_userdata::setmetatable<function_type>(state);
-					lua_settable(state, LUA_REGISTRYINDEX);
+					lua_rawset(state, LUA_REGISTRYINDEX);
 					*funptr = f;
 				}
 				else
@@ -95,19 +105,26 @@ namespace kaguya
 			}
 		}
 
+		//! for compatibility. all member functions are static
 		static ErrorHandler& instance() {
 			static ErrorHandler instance_;
 			return instance_;
 		}
 	private:
-		function_type* getFunctionPointer(lua_State* state)
+		//! registry key. address of static storage, no dynamic initialization
+		static void* key()
+		{
+			static char key_;
+			return &key_;
+		}
+		static function_type* getFunctionPointer(lua_State* state)
 		{
 			if (state)
 			{
-				util::ScopedSavedStack save(state);
-				lua_pushlightuserdata(state, this);
-				lua_gettable(state, LUA_REGISTRYINDEX);
-				function_type* ptr = (function_type*)lua_touserdata(state, -1);
+				lua_pushlightuserdata(state, key());
+				lua_rawget(state, LUA_REGISTRYINDEX);
+				function_type* ptr = static_cast<function_type*>(lua_touserdata(state, -1));
+				lua_pop(state, 1);
 				return ptr;
 			}
 			return 0;
@@ -130,14 +147,14 @@ namespace kaguya
 	{
 		inline void OtherError(lua_State *state, const std::string& message)
 		{
-			ErrorHandler::instance().handle(message.c_str(), state);
+			ErrorHandler::handle(message.c_str(), state);
 #if !KAGUYA_ERROR_NO_THROW
 			throw LuaKaguyaError(message);
 #endif
 		}
 		inline void typeMismatchError(lua_State *state, const std::string& message)
 		{
-			ErrorHandler::instance().handle(message.c_str(), state);
+			ErrorHandler::handle(message.c_str(), state);
 #if !KAGUYA_ERROR_NO_THROW
 			throw LuaTypeMismatch(message);
 #endif
@@ -146,7 +163,7 @@ namespace kaguya
 		{
 			if (status != 0 && status != LUA_YIELD)
 			{
-				ErrorHandler::instance().handle(status, state);
+				ErrorHandler::handle(status, state);
 #if !KAGUYA_ERROR_NO_THROW
 				const char* message = 0;
 				switch (status)
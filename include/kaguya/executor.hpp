@@ -0,0 +1,393 @@
+// Copyright satoren
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include "kaguya/config.hpp"
+
+#if KAGUYA_USE_THREAD_LOCAL
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <atomic>
+#include <type_traits>
+
+#include "kaguya/state.hpp"
+
+#define KAGUYA_EXECUTOR_CHUNK_CACHE "kaguya_executor_chunk_cache"
+
+//! maximum number of compiled chunks cached per worker State. cache is cleared when full
+#ifndef KAGUYA_EXECUTOR_CHUNK_CACHE_SIZE
+#define KAGUYA_EXECUTOR_CHUNK_CACHE_SIZE 256
+#endif
+
+namespace kaguya
+{
+	//! statistics of Executor
+	struct ExecutorStats
+	{
+		ExecutorStats() :submitted_count(0), executed_count(0), stolen_count(0) {}
+
+		size_t submitted_count;
+		//! tasks started by workers
+		size_t executed_count;
+		//! tasks executed by other worker than the queued worker
+		size_t stolen_count;
+	};
+
+	namespace executor_detail
+	{
+		template<typename R>
+		struct invoke
+		{
+			template<typename F>
+			static void apply(std::promise<R>& promise, F& f, State& state)
+			{
+				promise.set_value(f(state));
+			}
+		};
+		template<>
+		struct invoke<void>
+		{
+			template<typename F>
+			static void apply(std::promise<void>& promise, F& f, State& state)
+			{
+				f(state);
+				promise.set_value();
+			}
+		};
+
+		template<typename T>
+		bool check_results(lua_State* l, int index, types::typetag<T>)
+		{
+			return lua_type_traits<T>::checkType(l, index);
+		}
+		inline bool check_results(lua_State*, int, types::typetag<standard::tuple<> >)
+		{
+			return true;
+		}
+		template<typename T, typename... TYPES>
+		bool check_results(lua_State* l, int index, types::typetag<standard::tuple<T, TYPES...> >)
+		{
+			return lua_type_traits<T>::checkType(l, index)
+				&& check_results(l, index + 1, types::typetag<standard::tuple<TYPES...> >());
+		}
+
+		//! push chunk cache table of worker State. entry count is kept at [0]
+		inline void push_chunk_cache(lua_State* l, bool renew)
+		{
+			if (!renew)
+			{
+				lua_pushliteral(l, KAGUYA_EXECUTOR_CHUNK_CACHE);
+				lua_rawget(l, LUA_REGISTRYINDEX);
+				if (!lua_isnil(l, -1)) { return; }
+				lua_pop(l, 1);
+			}
+			lua_newtable(l);
+			lua_pushinteger(l, 0);
+			lua_rawseti(l, -2, 0);
+			lua_pushliteral(l, KAGUYA_EXECUTOR_CHUNK_CACHE);
+			lua_pushvalue(l, -2);
+			lua_rawset(l, LUA_REGISTRYINDEX);
+		}
+		//! push compiled chunk. chunks are compiled once per worker State and cached in the registry, up to KAGUYA_EXECUTOR_CHUNK_CACHE_SIZE.
+		inline void push_chunk(lua_State* l, const std::string& chunk)
+		{
+			push_chunk_cache(l, false);
+			lua_pushlstring(l, chunk.data(), chunk.size());
+			lua_rawget(l, -2);
+			if (lua_isnil(l, -1))
+			{
+				lua_pop(l, 1);
+				lua_rawgeti(l, -1, 0);
+				lua_Integer count = lua_tointeger(l, -1);
+				lua_pop(l, 1);
+				if (count >= KAGUYA_EXECUTOR_CHUNK_CACHE_SIZE)
+				{
+					lua_pop(l, 1);
+					push_chunk_cache(l, true);
+					count = 0;
+				}
+				int status = luaL_loadstring(l, chunk.c_str());
+				if (!except::checkErrorAndThrow(status, l))
+				{
+					throw LuaException(status, lua_tostring(l, -1) ? std::string(lua_tostring(l, -1)) : "load error");
+				}
+				lua_pushlstring(l, chunk.data(), chunk.size());
+				lua_pushvalue(l, -2);
+				lua_rawset(l, -4);
+				lua_pushinteger(l, count + 1);
+				lua_rawseti(l, -3, 0);
+			}
+			lua_remove(l, -2);
+		}
+
+		template<typename Result, typename... Args>
+		Result run_chunk(lua_State* l, const std::string& chunk, const Args&... args)
+		{
+			util::ScopedSavedStack save(l);
+			int base = lua_gettop(l);
+			push_chunk(l, chunk);
+			int argnum = util::push_args(l, args...);
+			int status = lua_pcall(l, argnum, LUA_MULTRET, 0);
+			if (!except::checkErrorAndThrow(status, l))
+			{
+				throw LuaException(status, lua_tostring(l, -1) ? std::string(lua_tostring(l, -1)) : "runtime error");
+			}
+			if (!check_results(l, base + 1, types::typetag<Result>()))
+			{
+				throw LuaTypeMismatch("executor result type mismatch");
+			}
+			return util::get_result<Result>(l, base + 1);
+		}
+	}
+
+	/**
+	* Thread pool executing Lua tasks. Each worker thread owns a State initialized by the initializer(binding recipe).
+	* Tasks are queued to workers in round robin, and idle workers steal tasks from other workers.
+	* Tasks submitted from a worker thread are queued to the worker itself.
+	* Results are converted by lua_type_traits in the worker and returned by std::future,
+	* so result types must not refer to Lua objects(e.g. LuaRef).
+	* Errors are reported by exceptions from future::get().
+	* Do not wait for a future inside a task. If all workers wait, it never completes.
+	* execute() caches compiled chunk by its source, up to KAGUYA_EXECUTOR_CHUNK_CACHE_SIZE per worker.
+	* Pass variable data as arguments, not by building the chunk source.
+	* Not included by kaguya.hpp. Include "kaguya/executor.hpp". Requires thread_local(KAGUYA_USE_THREAD_LOCAL).
+	* @code
+	* kaguya::Executor executor(32, &bind_rules);
+	* std::future<bool> result = executor.execute<bool>("return evaluate(...)", order_id);
+	* bool accepted = result.get();
+	* @endcode
+	*/
+	class Executor
+	{
+	public:
+		typedef standard::function<void(State&)> Initializer;
+
+		/**
+		* @param threads number of worker threads. 0 means std::thread::hardware_concurrency()
+		* @param initializer called once for each worker State in the worker thread
+		* @throw exception thrown by initializer
+		*/
+		explicit Executor(size_t threads = 0, Initializer initializer = Initializer())
+			:initializer_(initializer), pending_(0), sleeping_(0), next_(0), stopping_(false), submitted_(0), executed_(0), stolen_(0)
+		{
+			if (threads == 0) { threads = std::thread::hardware_concurrency(); }
+			if (threads == 0) { threads = 1; }
+			std::vector<std::future<void> > ready;
+			for (size_t i = 0; i < threads; ++i)
+			{
+				workers_.push_back(std::unique_ptr<Worker>(new Worker()));
+			}
+			for (size_t i = 0; i < threads; ++i)
+			{
+				std::shared_ptr<std::promise<void> > initialized = std::make_shared<std::promise<void> >();
+				ready.push_back(initialized->get_future());
+				workers_[i]->thread = std::thread(&Executor::run, this, i, initialized);
+			}
+			try
+			{
+				for (size_t i = 0; i < ready.size(); ++i)
+				{
+					ready[i].get();
+				}
+			}
+			catch (...)
+			{
+				shutdown();
+				throw;
+			}
+		}
+		//! execute remaining tasks and join worker threads
+		~Executor()
+		{
+			shutdown();
+		}
+
+		size_t size()const { return workers_.size(); }
+
+		/**
+		* @brief submit task function called with worker State
+		* @param f callable as f(State&)
+		*/
+		template<typename F>
+		std::future<decltype(std::declval<F&>()(std::declval<State&>()))> submit(F f)
+		{
+			typedef decltype(std::declval<F&>()(std::declval<State&>())) result_type;
+			std::shared_ptr<std::promise<result_type> > promise = std::make_shared<std::promise<result_type> >();
+			std::future<result_type> result = promise->get_future();
+			push([promise, f](State& state) mutable
+			{
+				try
+				{
+					executor_detail::invoke<result_type>::apply(*promise, f, state);
+				}
+				catch (...)
+				{
+					promise->set_exception(std::current_exception());
+				}
+			});
+			return result;
+		}
+
+		/**
+		* @brief submit Lua chunk. arguments are passed as `...` of the chunk.
+		* Result is first return value, tuple of return values, or void.
+		*/
+		template<typename Result, typename... Args>
+		std::future<Result> execute(const std::string& chunk, Args... args)
+		{
+			static_assert(!std::is_base_of<LuaRef, Result>::value, "Result must not refer to worker State");
+			return submit([=](State& state)
+			{
+				return executor_detail::run_chunk<Result>(state.state(), chunk, args...);
+			});
+		}
+
+		ExecutorStats stats()const
+		{
+			ExecutorStats result;
+			result.submitted_count = submitted_;
+			result.executed_count = executed_;
+			result.stolen_count = stolen_;
+			return result;
+		}
+	private:
+		typedef standard::function<void(State&)> Task;
+		struct Worker
+		{
+			std::mutex mutex;
+			std::deque<Task> tasks;
+			std::thread thread;
+		};
+
+		Executor(const Executor&);
+		Executor& operator=(const Executor&);
+
+		//! executor and worker index of current thread
+		static std::pair<const Executor*, size_t>& current()
+		{
+			static thread_local std::pair<const Executor*, size_t> current_(0, 0);
+			return current_;
+		}
+
+		void push(Task task)
+		{
+			size_t index = current().first == this ? current().second : next_++ % workers_.size();
+			pending_++;//count before the task is visible to pop and steal
+			{
+				std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+				workers_[index]->tasks.push_back(std::move(task));
+			}
+			submitted_++;
+			//a worker increments sleeping_ before checking pending_, so either it sees the task or it is woken here
+			if (sleeping_.load() > 0)
+			{
+				{
+					std::lock_guard<std::mutex> lock(sleep_mutex_);
+				}
+				wakeup_.notify_one();
+			}
+		}
+		//! own queue is LIFO
+		bool pop(size_t index, Task& task)
+		{
+			Worker& worker = *workers_[index];
+			std::lock_guard<std::mutex> lock(worker.mutex);
+			if (worker.tasks.empty()) { return false; }
+			task = std::move(worker.tasks.back());
+			worker.tasks.pop_back();
+			pending_--;
+			return true;
+		}
+		//! steal oldest task of other worker
+		bool steal(size_t index, Task& task)
+		{
+			for (size_t i = 1; i < workers_.size(); ++i)
+			{
+				Worker& victim = *workers_[(index + i) % workers_.size()];
+				std::lock_guard<std::mutex> lock(victim.mutex);
+				if (victim.tasks.empty()) { continue; }
+				task = std::move(victim.tasks.front());
+				victim.tasks.pop_front();
+				pending_--;
+				stolen_++;
+				return true;
+			}
+			return false;
+		}
+
+		void run(size_t index, std::shared_ptr<std::promise<void> > initialized)
+		{
+			current() = std::make_pair(this, index);
+			std::unique_ptr<State> state;
+			try
+			{
+				state.reset(new State());
+				state->setErrorHandler(ErrorHandler::function_type());//errors are reported by future
+				if (initializer_)
+				{
+					initializer_(*state);
+				}
+				initialized->set_value();
+			}
+			catch (...)
+			{
+				initialized->set_exception(std::current_exception());
+				return;
+			}
+			for (;;)
+			{
+				Task task;
+				if (pop(index, task) || steal(index, task))
+				{
+					executed_++;
+					task(*state);
+					continue;
+				}
+				std::unique_lock<std::mutex> lock(sleep_mutex_);
+				sleeping_++;
+				wakeup_.wait(lock, [this] { return stopping_ || pending_.load() > 0; });
+				sleeping_--;
+				if (stopping_ && pending_.load() == 0) { return; }
+			}
+		}
+
+		void shutdown()
+		{
+			{
+				std::lock_guard<std::mutex> lock(sleep_mutex_);
+				stopping_ = true;
+			}
+			wakeup_.notify_all();
+			for (size_t i = 0; i < workers_.size(); ++i)
+			{
+				if (workers_[i]->thread.joinable())
+				{
+					workers_[i]->thread.join();
+				}
+			}
+		}
+
+		Initializer initializer_;
+		std::vector<std::unique_ptr<Worker> > workers_;
+		std::mutex sleep_mutex_;
+		std::condition_variable wakeup_;
+		std::atomic<size_t> pending_;
+		//! workers waiting on wakeup_
+		std::atomic<size_t> sleeping_;
+		std::atomic<size_t> next_;
+		bool stopping_;
+		std::atomic<size_t> submitted_;
+		std::atomic<size_t> executed_;
+		std::atomic<size_t> stolen_;
+	};
+}
+#endif
@@ -0,0 +1,198 @@
+// Copyright satoren
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "kaguya/config.hpp"
+#include "kaguya/utility.hpp"
+#include "kaguya/lua_ref.hpp"
+
+namespace kaguya
+{
+	namespace field_mapping_detail
+	{
+		//! registry key of per lua_State key array cache
+		inline void* cache_key()
+		{
+			static char key;
+			return &key;
+		}
+	}
+
+	/**
+	* Field mapping between Lua table and C++ struct.
+	* Describe fields once, and LuaRef::load/store read(write) all fields in one stack pass.
+	* Key strings are interned once per lua_State and field name list, and kept in the registry of that lua_State.
+	* Mappings having same field names share the key array.
+	* Do not call addField while other threads use the mapping.
+	* @code
+	* kaguya::FieldMapping<Config> mapping = kaguya::FieldMapping<Config>()
+	*     .addField("name", &Config::name)
+	*     .addField("width", &Config::width);
+	* Config config;
+	* kaguya::LuaTable table = state["config"];
+	* table.load(mapping, config);
+	* @endcode
+	*/
+	template<typename T>
+	class FieldMapping
+	{
+		struct BaseField
+		{
+			virtual bool checkType(lua_State* l, int index)const = 0;
+			virtual void get(lua_State* l, int index, T& dest)const = 0;
+			virtual int push(lua_State* l, const T& src)const = 0;
+			virtual ~BaseField() {}
+		};
+		template<typename MemType>
+		struct MemberField :BaseField
+		{
+			MemType T::* member;
+			MemberField(MemType T::* m) :member(m) {}
+			virtual bool checkType(lua_State* l, int index)const
+			{
+				return lua_type_traits<MemType>::checkType(l, index);
+			}
+			virtual void get(lua_State* l, int index, T& dest)const
+			{
+				dest.*member = lua_type_traits<MemType>::get(l, index);
+			}
+			virtual int push(lua_State* l, const T& src)const
+			{
+				return lua_type_traits<MemType>::push(l, src.*member);
+			}
+		};
+		typedef standard::shared_ptr<BaseField> FieldPtr;
+	public:
+		/**
+		* @brief add field to this mapping
+		* @param name key of table
+		* @param member data member pointer
+		*/
+		template<typename MemType>
+		FieldMapping& addField(const char* name, MemType T::* member)
+		{
+			names_.push_back(name);
+			fields_.push_back(FieldPtr(new MemberField<MemType>(member)));
+			cache_key_.append(name).push_back('\0');
+			return *this;
+		}
+
+		size_t size()const { return fields_.size(); }
+
+		//! read fields from table at index. nil field is not assigned.
+		bool load(lua_State* l, int index, T& dest)const
+		{
+			util::ScopedSavedStack save(l);
+			index = lua_absindex(l, index);
+			if (lua_type(l, index) != LUA_TTABLE)
+			{
+				except::typeMismatchError(l, "load target is not table");
+				return false;
+			}
+			int keys = pushKeys(l);
+			bool result = true;
+			for (size_t i = 0; i < fields_.size(); ++i)
+			{
+				lua_rawgeti(l, keys, static_cast<int>(i + 1));
+				lua_gettable(l, index);
+				if (!lua_isnil(l, -1))
+				{
+					if (fields_[i]->checkType(l, -1))
+					{
+						fields_[i]->get(l, -1, dest);
+					}
+					else
+					{
+						except::typeMismatchError(l, "field type mismatch:" + names_[i]);
+						result = false;
+					}
+				}
+				lua_pop(l, 1);
+			}
+			return result;
+		}
+
+		//! write fields to table at index.
+		bool store(lua_State* l, int index, const T& src)const
+		{
+			util::ScopedSavedStack save(l);
+			index = lua_absindex(l, index);
+			if (lua_type(l, index) != LUA_TTABLE)
+			{
+				except::typeMismatchError(l, "store target is not table");
+				return false;
+			}
+			int keys = pushKeys(l);
+			for (size_t i = 0; i < fields_.size(); ++i)
+			{
+				lua_rawgeti(l, keys, static_cast<int>(i + 1));
+				if (fields_[i]->push(l, src) != 1)
+				{
+					lua_settop(l, keys);
+					except::typeMismatchError(l, "can not push field:" + names_[i]);
+					return false;
+				}
+				lua_settable(l, index);
+			}
+			return true;
+		}
+	private:
+		//! push key array table and return stack index. key array is created once per lua_State and field name list.
+		int pushKeys(lua_State* l)const
+		{
+			lua_pushlightuserdata(l, field_mapping_detail::cache_key());
+			lua_rawget(l, LUA_REGISTRYINDEX);
+			if (lua_isnil(l, -1))
+			{
+				lua_pop(l, 1);
+				lua_newtable(l);
+				lua_pushlightuserdata(l, field_mapping_detail::cache_key());
+				lua_pushvalue(l, -2);
+				lua_rawset(l, LUA_REGISTRYINDEX);
+			}
+			int cache = lua_gettop(l);
+			lua_pushlstring(l, cache_key_.data(), cache_key_.size());
+			lua_rawget(l, cache);
+			if (lua_isnil(l, -1))
+			{
+				lua_pop(l, 1);
+				lua_createtable(l, static_cast<int>(names_.size()), 0);
+				for (size_t i = 0; i < names_.size(); ++i)
+				{
+					lua_pushlstring(l, names_[i].c_str(), names_[i].size());
+					lua_rawseti(l, -2, static_cast<int>(i + 1));
+				}
+				lua_pushlstring(l, cache_key_.data(), cache_key_.size());
+				lua_pushvalue(l, -2);
+				lua_rawset(l, cache);
+			}
+			return lua_gettop(l);
+		}
+
+		std::vector<std::string> names_;
+		std::vector<FieldPtr> fields_;
+		//! field names joined by '\0'. key of key array cache
+		std::string cache_key_;
+	};
+
+	template<typename T>
+	bool LuaRef::load(const FieldMapping<T>& mapping, T& dest)const
+	{
+		util::ScopedSavedStack save(state_);
+		push(state_);
+		return mapping.load(state_, -1, dest);
+	}
+	template<typename T>
+	bool LuaRef::store(const FieldMapping<T>& mapping, const T& src)
+	{
+		util::ScopedSavedStack save(state_);
+		push(state_);
+		return mapping.store(state_, -1, src);
+	}
+}
@@ -0,0 +1,97 @@
+// Copyright satoren
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <ctime>
+#include <new>
+
+#include "kaguya/config.hpp"
+#include "kaguya/utility.hpp"
+
+#if KAGUYA_USE_CPP11
+#include <chrono>
+#endif
+
+namespace kaguya
+{
+	//! garbage collection done through State::GCType
+	struct GCStats
+	{
+		GCStats() :step_count(0), collect_count(0), cycle_count(0), total_ns(0), max_ns(0), last_ns(0), last_before_bytes(0), last_after_bytes(0), freed_bytes(0) {}
+
+		//! incremental steps(lua_gc LUA_GCSTEP calls)
+		size_t step_count;
+		//! full collections
+		size_t collect_count;
+		//! finished collection cycles, including full collections
+		size_t cycle_count;
+		//! time spent in collection
+		double total_ns;
+		//! longest single collect, step or stepFor
+		double max_ns;
+		double last_ns;
+		//! memory in use before and after last collect, step or stepFor
+		size_t last_before_bytes;
+		size_t last_after_bytes;
+		//! sum of memory decrease by collect, step and stepFor
+		size_t freed_bytes;
+	};
+
+	//! Per State GCStats storage. created at first use
+	class GCTelemetry
+	{
+	public:
+		void record(double ns, size_t before, size_t after, size_t steps, bool full, bool cycle)
+		{
+			stats_.step_count += steps;
+			if (full) { stats_.collect_count++; }
+			if (cycle || full) { stats_.cycle_count++; }
+			stats_.total_ns += ns;
+			stats_.last_ns = ns;
+			if (ns > stats_.max_ns) { stats_.max_ns = ns; }
+			stats_.last_before_bytes = before;
+			stats_.last_after_bytes = after;
+			if (before > after) { stats_.freed_bytes += before - after; }
+		}
+		const GCStats& stats()const { return stats_; }
+		void reset() { stats_ = GCStats(); }
+
+		static double now()
+		{
+#if KAGUYA_USE_CPP11
+			return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+			return double(std::clock()) * (1e9 / CLOCKS_PER_SEC);
+#endif
+		}
+
+		//! telemetry of the State. created at first call
+		static GCTelemetry& get(lua_State* l)
+		{
+			util::ScopedSavedStack save(l);
+			lua_pushlightuserdata(l, key());
+			lua_rawget(l, LUA_REGISTRYINDEX);
+			GCTelemetry* telemetry = static_cast<GCTelemetry*>(lua_touserdata(l, -1));
+			if (telemetry) { return *telemetry; }
+			lua_pushlightuserdata(l, key());
+			telemetry = new(lua_newuserdata(l, sizeof(GCTelemetry))) GCTelemetry();
+			lua_rawset(l, LUA_REGISTRYINDEX);
+			return *telemetry;
+		}
+	private:
+		GCTelemetry() {}
+		GCTelemetry(const GCTelemetry&);
+		GCTelemetry& operator=(const GCTelemetry&);
+
+		static void* key()
+		{
+			static char key_;
+			return &key_;
+		}
+
+		GCStats stats_;
+	};
+}
@@ -0,0 +1,200 @@
+// Copyright satoren
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <new>
+
+#include "kaguya/config.hpp"
+#include "kaguya/utility.hpp"
+#include "kaguya/object.hpp"
+
+namespace kaguya
+{
+	/**
+	* Handle of object that has own reference count.
+	* Count is changed by intrusive_ptr_add_ref(T*) and intrusive_ptr_release(T*) found by ADL,
+	* same as boost::intrusive_ptr. Inherit RefCounted<T> or define these functions.
+	* Pushed to Lua as userdata holding ObjectSmartPointerWrapper of this handle(vtable, metatable name pointer and IntrusivePtr), and __gc releases it.
+	* Getting T& or T* from the userdata does not change reference count.
+	* IntrusivePtr<Base> can be got from IntrusivePtr userdata of derived class.
+	* Objects held by value or by raw pointer are not adopted.
+	* @code
+	* struct Entity :kaguya::RefCounted<Entity> { int id; };
+	* state["Entity"].setClass(kaguya::ClassMetatable<Entity>().addMember("id", &Entity::id));
+	* state["player"] = kaguya::IntrusivePtr<Entity>(new Entity());
+	* @endcode
+	*/
+	template<typename T>
+	class IntrusivePtr
+	{
+		typedef T* (IntrusivePtr::*bool_type)() const;
+	public:
+		typedef T element_type;
+
+		IntrusivePtr() :ptr_(0) {}
+		IntrusivePtr(T* ptr, bool add_ref = true) :ptr_(ptr)
+		{
+			if (ptr_ && add_ref) { intrusive_ptr_add_ref(ptr_); }
+		}
+		IntrusivePtr(const IntrusivePtr& src) :ptr_(src.ptr_)
+		{
+			if (ptr_) { intrusive_ptr_add_ref(ptr_); }
+		}
+		template<typename U>
+		IntrusivePtr(const IntrusivePtr<U>& src) : ptr_(src.get())
+		{
+			if (ptr_) { intrusive_ptr_add_ref(ptr_); }
+		}
+#if KAGUYA_USE_RVALUE_REFERENCE
+		IntrusivePtr(IntrusivePtr&& src) :ptr_(src.ptr_)
+		{
+			src.ptr_ = 0;
+		}
+		IntrusivePtr& operator=(IntrusivePtr&& src)
+		{
+			IntrusivePtr(std::move(src)).swap(*this);
+			return *this;
+		}
+#endif
+		~IntrusivePtr()
+		{
+			if (ptr_) { intrusive_ptr_release(ptr_); }
+		}
+		IntrusivePtr& operator=(const IntrusivePtr& src)
+		{
+			IntrusivePtr(src).swap(*this);
+			return *this;
+		}
+		void reset(T* ptr = 0)
+		{
+			IntrusivePtr(ptr).swap(*this);
+		}
+		//! return pointer and release ownership without changing reference count
+		T* detach()
+		{
+			T* ptr = ptr_;
+			ptr_ = 0;
+			return ptr;
+		}
+		void swap(IntrusivePtr& other)
+		{
+			std::swap(ptr_, other.ptr_);
+		}
+
+		T* get()const { return ptr_; }
+		T& operator*()const { return *ptr_; }
+		T* operator->()const { return ptr_; }
+		operator bool_type() const
+		{
+			return ptr_ ? &IntrusivePtr::get : 0;
+		}
+	private:
+		T* ptr_;
+	};
+
+	template<typename T, typename U>
+	bool operator==(const IntrusivePtr<T>& a, const IntrusivePtr<U>& b) { return a.get() == b.get(); }
+	template<typename T, typename U>
+	bool operator!=(const IntrusivePtr<T>& a, const IntrusivePtr<U>& b) { return a.get() != b.get(); }
+
+	/**
+	* Base of intrusive reference counted type. Derived is deleted when count becomes zero.
+	* Count is not atomic. Do not share objects between threads.
+	*/
+	template<typename Derived>
+	class RefCounted
+	{
+	public:
+		size_t useCount()const { return ref_count_; }
+
+		friend void intrusive_ptr_add_ref(const RefCounted* p)
+		{
+			++p->ref_count_;
+		}
+		friend void intrusive_ptr_release(const RefCounted* p)
+		{
+			if (--p->ref_count_ == 0)
+			{
+				delete static_cast<const Derived*>(p);
+			}
+		}
+	protected:
+		RefCounted() :ref_count_(0) {}
+		RefCounted(const RefCounted&) :ref_count_(0) {}
+		RefCounted& operator=(const RefCounted&) { return *this; }
+		~RefCounted() {}
+	private:
+		mutable size_t ref_count_;
+	};
+
+	namespace intrusive_ptr_detail
+	{
+		template<typename T>
+		struct IntrusivePtrWrapper :ObjectSmartPointerWrapper<IntrusivePtr<T> >
+		{
+			IntrusivePtrWrapper(const IntrusivePtr<T>& ptr) :ObjectSmartPointerWrapper<IntrusivePtr<T> >(ptr) {}
+			virtual bool intrusive()const { return true; }
+		};
+
+		//! wrapper at index holding IntrusivePtr of T or derived type. otherwise null
+		template<typename T>
+		ObjectWrapperBase* intrusive_wrapper(lua_State* l, int index)
+		{
+			ObjectWrapperBase* wrapper = object_wrapper(l, index, metatableName<T>());
+			return wrapper && wrapper->intrusive() ? wrapper : 0;
+		}
+	}
+
+	///! traits for IntrusivePtr
+	template<typename T> struct lua_type_traits<IntrusivePtr<T> > {
+		typedef const IntrusivePtr<T>& push_type;
+		typedef IntrusivePtr<T> get_type;
+
+		//! IntrusivePtr userdata of T or derived type. handle shares count with the object
+		static bool checkType(lua_State* l, int index)
+		{
+			return strictCheckType(l, index) || lua_isnil(l, index);
+		}
+		static bool strictCheckType(lua_State* l, int index)
+		{
+			return object_wrapper(l, index, metatableName<get_type>()) != 0 ||
+				intrusive_ptr_detail::intrusive_wrapper<T>(l, index) != 0;
+		}
+		static get_type get(lua_State* l, int index)
+		{
+			if (lua_isnoneornil(l, index)) {
+				return get_type();
+			}
+			ObjectWrapperBase* wrapper = object_wrapper(l, index, metatableName<get_type>());
+			if (wrapper)
+			{
+				return *static_cast<const get_type*>(wrapper->native_cget());
+			}
+			T* pointer = intrusive_ptr_detail::intrusive_wrapper<T>(l, index) ? lua_type_traits<T*>::get(l, index) : 0;
+			if (!pointer)
+			{
+				throw LuaTypeMismatch("type mismatch!!");
+			}
+			return get_type(pointer);
+		}
+
+		static int push(lua_State* l, push_type v)
+		{
+			if (!v)
+			{
+				lua_pushnil(l);
+				return 1;
+			}
+			typedef intrusive_ptr_detail::IntrusivePtrWrapper<T> wrapper_type;
+			void *storage = lua_newuserdata(l, sizeof(wrapper_type));
+			new(storage) wrapper_type(v);
+			class_userdata::set_object_metatable<T>(l);
+			return 1;
+		}
+	};
+	template<typename T> struct lua_type_traits<const IntrusivePtr<T>&> :lua_type_traits<IntrusivePtr<T> > {};
+}
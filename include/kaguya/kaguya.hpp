@@ -14,5 +14,9 @@
 
 #include "kaguya/lua_ref_table.hpp"
 #include "kaguya/lua_ref_function.hpp"
+#include "kaguya/field_mapping.hpp"
+#include "kaguya/typed_array.hpp"
+#include "kaguya/intrusive_ptr.hpp"
+#include "kaguya/state_pool.hpp"
 #include "kaguya/ref_tuple.hpp"
 
@@ -11,10 +11,14 @@
 #include <cassert>
 #include <algorithm>
 #include <ostream>
+#include <iterator>
+#include <functional>
+#include <cstring>
 #include "kaguya/config.hpp"
 #include "kaguya/error_handler.hpp"
 #include "kaguya/type.hpp"
 #include "kaguya/utility.hpp"
+#include "kaguya/binding_profiler.hpp"
 
 
 namespace kaguya
@@ -27,6 +31,9 @@ namespace kaguya
 	class LuaThread;
 	class TableKeyReference;
 	class FunctionResults;
+	class LuaStackRef;
+	class Key;
+	template<typename T> class FieldMapping;
 	class mem_fun_binder;
 
 	class LuaRef;
@@ -108,65 +115,386 @@ namespace kaguya
 		}
 	}
 
-	class FunctionResults
+	/**
+	* Non owning reference of Lua stack value.
+	* Valid while the referenced stack slot is alive. Converting to LuaRef makes registry reference.
+	*/
+	class LuaStackRef
 	{
-		FunctionResults(lua_State* state) :state_(state), startIndex_(0), endIndex_(0)
+	public:
+		LuaStackRef() :state_(0), stack_index_(0) {}
+		LuaStackRef(lua_State* state, int index) :state_(state), stack_index_(lua_absindex(state, index))
 		{
 		}
-		FunctionResults(lua_State* state, int startIndex) :state_(state), startIndex_(startIndex), endIndex_(lua_gettop(state) + 1)
+
+		lua_State* state()const { return state_; }
+		int stackIndex()const { return stack_index_; }
+
+		template<typename T>
+		operator T()const
 		{
+			return lua_type_traits<T>::get(state_, stack_index_);
 		}
-		FunctionResults(lua_State* state, int startIndex, int endIndex) :state_(state), startIndex_(startIndex), endIndex_(endIndex)
+		template<typename T>
+		typename lua_type_traits<T>::get_type get()const
 		{
+			return lua_type_traits<T>::get(state_, stack_index_);
 		}
-		FunctionResults(const FunctionResults&src) :state_(src.state_), startIndex_(src.startIndex_), endIndex_(src.endIndex_)
+		template<typename T>
+		bool typeTest()const
 		{
-			src.state_ = 0;
+			return lua_type_traits<T>::strictCheckType(state_, stack_index_);
 		}
-		friend class LuaRef;
-		friend class mem_fun_binder;
-		friend class TableKeyReference;
+		template<typename T>
+		bool weakTypeTest()const
+		{
+			return lua_type_traits<T>::checkType(state_, stack_index_);
+		}
+		int push()const
+		{
+			lua_pushvalue(state_, stack_index_);
+			return 1;
+		}
+		int push(lua_State* state)const
+		{
+			lua_pushvalue(state_, stack_index_);
+			if (state != state_)
+			{
+				lua_xmove(state_, state, 1);
+			}
+			return 1;
+		}
+		bool isNilref()const
+		{
+			return state_ == 0 || lua_isnoneornil(state_, stack_index_);
+		}
+		int type()const
+		{
+			return lua_type(state_, stack_index_);
+		}
+		std::string typeName()const
+		{
+			return lua_typename(state_, type());
+		}
+
+		bool operator==(const LuaStackRef& other)const
+		{
+			if (type() != other.type()) { return false; }
+#if LUA_VERSION_NUM >= 502
+			return lua_compare(state_, stack_index_, other.stack_index_, LUA_OPEQ) != 0;
+#else
+			return lua_equal(state_, stack_index_, other.stack_index_) != 0;
+#endif
+		}
+		bool operator<(const LuaStackRef& other)const
+		{
+			int this_type = type();
+			int other_type = other.type();
+			if (this_type != other_type) { return this_type < other_type; }
+			if (this_type == LUA_TNIL) { return false; }
+#if LUA_VERSION_NUM >= 502
+			return lua_compare(state_, stack_index_, other.stack_index_, LUA_OPLT) != 0;
+#else
+			return lua_lessthan(state_, stack_index_, other.stack_index_) != 0;
+#endif
+		}
+		bool operator<=(const LuaStackRef& other)const
+		{
+			int this_type = type();
+			int other_type = other.type();
+			if (this_type != other_type) { return this_type < other_type; }
+			if (this_type == LUA_TNIL) { return true; }
+#if LUA_VERSION_NUM >= 502
+			return lua_compare(state_, stack_index_, other.stack_index_, LUA_OPLE) != 0;
+#else
+			return lua_equal(state_, stack_index_, other.stack_index_) != 0 || lua_lessthan(state_, stack_index_, other.stack_index_) != 0;
+#endif
+		}
+		bool operator>=(const LuaStackRef& other)const
+		{
+			return other <= *this;
+		}
+		bool operator>(const LuaStackRef& other)const
+		{
+			return other < *this;
+		}
+		bool operator!=(const LuaStackRef& other)const
+		{
+			return !(other == *this);
+		}
+	private:
+		lua_State* state_;
+		int stack_index_;
+	};
+
+	template<>
+	struct lua_type_traits<LuaStackRef>
+	{
+		typedef LuaStackRef get_type;
+		typedef const LuaStackRef& push_type;
+
+		static bool checkType(lua_State* l, int index)
+		{
+			return true;
+		}
+		static bool strictCheckType(lua_State* l, int index)
+		{
+			return false;
+		}
+		static get_type get(lua_State* l, int index)
+		{
+			return LuaStackRef(l, index);
+		}
+		static int push(lua_State* l, push_type v)
+		{
+			return v.push(l);
+		}
+	};
+	template<>	struct lua_type_traits<const LuaStackRef&> :lua_type_traits<LuaStackRef> {};
+
+	/**
+	* Stack scoped range of table fields. Iterate with lua_next without registry reference.
+	* The table is kept on the stack until the range is destroyed, so ranges must be destroyed in reverse order of creation.
+	* Yielded views are valid until the iterator is incremented.
+	* @code
+	* for (kaguya::TablePairsRange<std::string, int>::iterator it = range.begin(); it != range.end(); ++it)
+	* @endcode
+	*/
+	template<typename K = LuaStackRef, typename V = LuaStackRef>
+	class TablePairsRange
+	{
 	public:
-		~FunctionResults()
+		typedef std::pair<typename lua_type_traits<K>::get_type, typename lua_type_traits<V>::get_type> value_type;
+
+		class iterator
+		{
+		public:
+			typedef std::input_iterator_tag iterator_category;
+			typedef typename TablePairsRange::value_type value_type;
+			typedef std::ptrdiff_t difference_type;
+			typedef const value_type* pointer;
+			typedef value_type reference;
+
+			iterator() :state_(0), table_index_(0) {}
+			iterator(lua_State* state, int table_index) :state_(state), table_index_(table_index)
+			{
+				lua_settop(state_, table_index_);
+				lua_pushnil(state_);
+				next();
+			}
+
+			//! stack layout is [table][key][value][key copy]. key view is read from the copy, so converting key does not break lua_next.
+			typename lua_type_traits<K>::get_type key()const
+			{
+				return lua_type_traits<K>::get(state_, table_index_ + 3);
+			}
+			typename lua_type_traits<V>::get_type value()const
+			{
+				return lua_type_traits<V>::get(state_, table_index_ + 2);
+			}
+			value_type operator*()const
+			{
+				return value_type(key(), value());
+			}
+			iterator& operator++()
+			{
+				lua_settop(state_, table_index_ + 1);//pop value and key copy
+				next();
+				return *this;
+			}
+			void operator++(int)
+			{
+				++(*this);
+			}
+			bool operator==(const iterator& other)const
+			{
+				return state_ == other.state_ && table_index_ == other.table_index_;
+			}
+			bool operator!=(const iterator& other)const
+			{
+				return !(*this == other);
+			}
+		private:
+			void next()
+			{
+				if (lua_next(state_, table_index_) == 0)
+				{
+					state_ = 0;
+					table_index_ = 0;
+					return;
+				}
+				lua_pushvalue(state_, -2);
+			}
+			lua_State* state_;
+			int table_index_;
+		};
+
+		TablePairsRange(lua_State* state, StackTop) :state_(state), table_index_(state ? lua_gettop(state) : 0)
+		{
+		}
+		//! transfer stack ownership
+		TablePairsRange(const TablePairsRange& src) :state_(src.state_), table_index_(src.table_index_)
+		{
+			src.state_ = 0;
+		}
+		~TablePairsRange()
 		{
 			if (state_)
 			{
-				lua_settop(state_, startIndex_ - 1);
+				lua_settop(state_, table_index_ - 1);
 			}
 		}
 
-		struct reference
+		//! begin iteration. range is input range, begin can be called only once.
+		iterator begin()const
+		{
+			if (!state_ || lua_type(state_, table_index_) != LUA_TTABLE)
+			{
+				return iterator();
+			}
+			return iterator(state_, table_index_);
+		}
+		iterator end()const
+		{
+			return iterator();
+		}
+	private:
+		TablePairsRange& operator=(const TablePairsRange& src);
+
+		mutable lua_State* state_;
+		int table_index_;
+	};
+
+	/**
+	* Stack scoped range of table array part(1 to raw length). Iterate with lua_rawgeti without registry reference.
+	* Same lifetime rule as TablePairsRange.
+	*/
+	template<typename V = LuaStackRef>
+	class TableIPairsRange
+	{
+	public:
+		typedef typename lua_type_traits<V>::get_type value_type;
+
+		class iterator
 		{
-			reference(lua_State* s, int index) :state(s), stack_index(index)
+		public:
+			typedef std::input_iterator_tag iterator_category;
+			typedef typename TableIPairsRange::value_type value_type;
+			typedef std::ptrdiff_t difference_type;
+			typedef const value_type* pointer;
+			typedef value_type reference;
+
+			iterator() :state_(0), table_index_(0), index_(0) {}
+			iterator(lua_State* state, int table_index, int index) :state_(state), table_index_(table_index), index_(index)
 			{
 			}
 
-			template<typename T>
-			operator T()const
+			//! 1 origin array index
+			int index()const
 			{
-				return lua_type_traits<T>::get(state, stack_index);
+				return index_;
 			}
-			template<typename T>T get()const
+			value_type operator*()const
 			{
-				return lua_type_traits<T>::get(state, stack_index);
+				load();
+				return lua_type_traits<V>::get(state_, table_index_ + 1);
 			}
-			int push()const
+			iterator& operator++()
 			{
-				lua_pushvalue(state, stack_index);
-				return 1;
+				++index_;
+				return *this;
 			}
-			int type() const
+			void operator++(int)
 			{
-				return lua_type(state, stack_index);
+				++(*this);
 			}
-			std::string typeName()const
+			bool operator==(const iterator& other)const
 			{
-				return lua_typename(state, type());
+				return index_ == other.index_;
 			}
-
-			lua_State* state;
-			int stack_index;
+			bool operator!=(const iterator& other)const
+			{
+				return !(*this == other);
+			}
+		private:
+			void load()const
+			{
+				lua_settop(state_, table_index_);
+				lua_rawgeti(state_, table_index_, index_);
+			}
+			lua_State* state_;
+			int table_index_;
+			int index_;
 		};
+
+		TableIPairsRange(lua_State* state, StackTop) :state_(state), table_index_(state ? lua_gettop(state) : 0), size_(0)
+		{
+			if (state_ && lua_type(state_, table_index_) == LUA_TTABLE)
+			{
+				size_ = static_cast<int>(lua_rawlen(state_, table_index_));
+			}
+		}
+		//! transfer stack ownership
+		TableIPairsRange(const TableIPairsRange& src) :state_(src.state_), table_index_(src.table_index_), size_(src.size_)
+		{
+			src.state_ = 0;
+		}
+		~TableIPairsRange()
+		{
+			if (state_)
+			{
+				lua_settop(state_, table_index_ - 1);
+			}
+		}
+
+		size_t size()const
+		{
+			return static_cast<size_t>(size_);
+		}
+		iterator begin()const
+		{
+			return iterator(state_, table_index_, 1);
+		}
+		iterator end()const
+		{
+			return iterator(state_, table_index_, size_ + 1);
+		}
+	private:
+		TableIPairsRange& operator=(const TableIPairsRange& src);
+
+		mutable lua_State* state_;
+		int table_index_;
+		int size_;
+	};
+
+	class FunctionResults
+	{
+		FunctionResults(lua_State* state) :state_(state), startIndex_(0), endIndex_(0)
+		{
+		}
+		FunctionResults(lua_State* state, int startIndex) :state_(state), startIndex_(startIndex), endIndex_(lua_gettop(state) + 1)
+		{
+		}
+		FunctionResults(lua_State* state, int startIndex, int endIndex) :state_(state), startIndex_(startIndex), endIndex_(endIndex)
+		{
+		}
+		FunctionResults(const FunctionResults&src) :state_(src.state_), startIndex_(src.startIndex_), endIndex_(src.endIndex_)
+		{
+			src.state_ = 0;
+		}
+		friend class LuaRef;
+		friend class mem_fun_binder;
+		friend class TableKeyReference;
+	public:
+		~FunctionResults()
+		{
+			if (state_)
+			{
+				lua_settop(state_, startIndex_ - 1);
+			}
+		}
+
+		typedef LuaStackRef reference;
 		struct iterator
 		{
 			iterator(lua_State* state, int index) :ref(state, index)
@@ -182,22 +510,24 @@ namespace kaguya
 			}
 			const iterator& operator++()
 			{
-				ref.stack_index++;
+				ref = reference(ref.state(), ref.stackIndex() + 1);
 				return *this;
 			}
 			iterator operator++(int)
 			{
-				return iterator(ref.state, ref.stack_index++);
+				iterator old = *this;
+				++(*this);
+				return old;
 			}
 
 			iterator operator+=(int n)
 			{
-				ref.stack_index += n;
-				return iterator(ref.state, ref.stack_index);
+				ref = reference(ref.state(), ref.stackIndex() + n);
+				return *this;
 			}
 			bool operator==(const iterator& other)const
 			{
-				return ref.state == other.ref.state && ref.stack_index == other.ref.stack_index;
+				return ref.state() == other.ref.state() && ref.stackIndex() == other.ref.stackIndex();
 			}
 			bool operator!=(const iterator& other)const
 			{
@@ -286,6 +616,115 @@ namespace kaguya
 	};
 
 
+#define KAGUYA_KEY_INTERN_TABLE "kaguya_interned_keys"
+	/**
+	* Handle of pre-interned string key.
+	* Key string is stored once per lua_State in registry slot, and pushed by lua_rawgeti without string hashing.
+	* Same key string share the registry slot. Slots are released with lua_State, so Key is freely copyable.
+	* Pushed to other lua_State(not sharing the main thread), key string is pushed by lua_pushlstring.
+	* @code
+	* kaguya::Key position = state.key("position");
+	* state[position] = 3;
+	* @endcode
+	*/
+	class Key
+	{
+	public:
+		Key() :state_(0), ref_(LUA_REFNIL) {}
+
+		//! intern key string to lua_State
+		Key(lua_State* state, const char* name) :state_(0), ref_(LUA_REFNIL)
+		{
+			intern(state, name, std::strlen(name));
+		}
+		//! intern key string to lua_State
+		Key(lua_State* state, const std::string& name) :state_(0), ref_(LUA_REFNIL)
+		{
+			intern(state, name.c_str(), name.size());
+		}
+
+		lua_State* state()const { return state_; }
+		bool isNilref()const { return state_ == 0 || ref_ == LUA_REFNIL; }
+
+		int push(lua_State* state)const
+		{
+			if (isNilref())
+			{
+				lua_pushnil(state);
+				return 1;
+			}
+			if (state != state_ && util::toMainThread(state) != state_)
+			{
+				lua_pushlstring(state, name_.c_str(), name_.size());
+				return 1;
+			}
+			lua_rawgeti(state, LUA_REGISTRYINDEX, ref_);
+			return 1;
+		}
+		int push()const
+		{
+			return push(state_);
+		}
+
+		bool operator==(const Key& other)const
+		{
+			return state_ == other.state_ && ref_ == other.ref_;
+		}
+		bool operator!=(const Key& other)const
+		{
+			return !(*this == other);
+		}
+	private:
+		void intern(lua_State* state, const char* name, size_t size)
+		{
+			if (!state) { return; }
+			util::ScopedSavedStack save(state);
+			state_ = util::toMainThread(state);
+			name_.assign(name, size);
+			lua_pushliteral(state, KAGUYA_KEY_INTERN_TABLE);
+			lua_rawget(state, LUA_REGISTRYINDEX);
+			if (!lua_istable(state, -1))
+			{
+				lua_pop(state, 1);
+				lua_newtable(state);
+				lua_pushliteral(state, KAGUYA_KEY_INTERN_TABLE);
+				lua_pushvalue(state, -2);
+				lua_rawset(state, LUA_REGISTRYINDEX);
+			}
+			int table = lua_gettop(state);
+			lua_pushlstring(state, name, size);
+			lua_pushvalue(state, -1);
+			lua_rawget(state, table);
+			if (lua_type(state, -1) == LUA_TNUMBER)
+			{
+				ref_ = static_cast<int>(lua_tointeger(state, -1));
+				return;
+			}
+			lua_pop(state, 1);
+			lua_pushvalue(state, -1);
+			ref_ = luaL_ref(state, LUA_REGISTRYINDEX);
+			lua_pushinteger(state, ref_);
+			lua_rawset(state, table);
+		}
+
+		lua_State* state_;
+		int ref_;
+		std::string name_;
+	};
+
+	template<>
+	struct lua_type_traits<Key>
+	{
+		typedef const Key& push_type;
+
+		static int push(lua_State* l, push_type v)
+		{
+			return v.push(l);
+		}
+	};
+	template<>	struct lua_type_traits<const Key&> :lua_type_traits<Key> {};
+
+
 	/**
 	* Reference of Lua any type value.
 	*/
@@ -399,19 +838,7 @@ namespace kaguya
 
 		static lua_State* toMainThread(lua_State* state)
 		{
-#if LUA_VERSION_NUM >= 502
-			if (state)
-			{
-				lua_rawgeti(state, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
-				lua_State* mainthread = lua_tothread(state, -1);
-				lua_pop(state, 1);
-				if (mainthread)
-				{
-					return mainthread;
-				}
-			}
-#endif
-			return state;
+			return util::toMainThread(state);
 		}
 
 		template<typename T>
@@ -426,50 +853,112 @@ namespace kaguya
 			return true;
 		}
 
-		void dump_impl(std::ostream& os, int nest, std::set<const void*>& outtable)const
+		void push_for_range()const
 		{
-			switch (type())
+			if (state_)
+			{
+				push(state_);
+			}
+		}
+
+		//! sort key of table key in dump. ordered by type, then by value(number, string, boolean) or address
+		struct dump_key
+		{
+			dump_key(lua_State* state, int index, int position) :type(lua_type(state, index)), number(0), pointer(0), position(position)
+			{
+				if (type == LUA_TNUMBER) { number = lua_tonumber(state, index); }
+				else if (type == LUA_TBOOLEAN) { number = lua_toboolean(state, index); }
+				else if (type == LUA_TSTRING)
+				{
+					size_t size = 0;
+					const char* str = lua_tolstring(state, index, &size);
+					string.assign(str, size);
+				}
+				else { pointer = lua_topointer(state, index); }
+			}
+			int type;
+			lua_Number number;
+			std::string string;
+			const void* pointer;
+			int position;
+		};
+		static bool dump_key_less(const dump_key& a, const dump_key& b)
+		{
+			if (a.type != b.type) { return a.type < b.type; }
+			if (a.number != b.number) { return a.number < b.number; }
+			if (a.string != b.string) { return a.string < b.string; }
+			return std::less<const void*>()(a.pointer, b.pointer);
+		}
+		static void dump_impl(std::ostream& os, lua_State* state, int index, int nest, std::set<const void*>& outtable)
+		{
+			index = lua_absindex(state, index);
+			int type = lua_type(state, index);
+			switch (type)
 			{
-			case LuaRef::TYPE_NIL:
+			case LUA_TNIL:
 				os << "nil";
 				break;
-			case LuaRef::TYPE_BOOL:
-				os << get<bool>();
+			case LUA_TBOOLEAN:
+				os << (lua_toboolean(state, index) != 0);
 				break;
-			case LuaRef::TYPE_NUMBER:
-				os << get<double>();
+			case LUA_TNUMBER:
+				os << lua_tonumber(state, index);
 				break;
-			case LuaRef::TYPE_STRING:
-				os << "'" << get<std::string>() << "'";
-				break;
-			case LuaRef::TYPE_TABLE:
+			case LUA_TSTRING:
+			{
+				size_t size = 0;
+				const char* str = lua_tolstring(state, index, &size);
+				os << "'" << std::string(str, size) << "'";
+			}
+			break;
+			case LUA_TTABLE:
 			{
-				const void* ptr = native_pointer();
+				const void* ptr = lua_topointer(state, index);
 				if (outtable.count(ptr))
 				{
 					os << "{" << ptr << "}" << std::endl;
 					return;
 				}
+				if (!lua_checkstack(state, 4))
+				{
+					os << "{...}";
+					return;
+				}
 				outtable.insert(ptr);
 				os << "{";
-				std::map<LuaRef, LuaRef> table = map();
-				bool first = true;
-				for (std::map<LuaRef, LuaRef>::iterator it = table.begin(); it != table.end(); it++)
+				//keys are kept in a sequence and printed in dump_key_less order, so output does not depend on lua_next order
+				lua_newtable(state);
+				int keys = lua_gettop(state);
+				std::vector<dump_key> order;
+				lua_pushnil(state);
+				while (lua_next(state, index) != 0)
 				{
-					if (first) { first = false; }
-					else { os << ","; }
-					it->first.dump_impl(os, nest + 1, outtable);
+					lua_pop(state, 1);//pop value
+					order.push_back(dump_key(state, -1, static_cast<int>(order.size() + 1)));
+					lua_pushvalue(state, -1);
+					lua_rawseti(state, keys, order.back().position);
+				}
+				std::stable_sort(order.begin(), order.end(), &dump_key_less);
+				for (size_t i = 0; i < order.size(); ++i)
+				{
+					if (i != 0) { os << ","; }
+					lua_rawgeti(state, keys, order[i].position);
+					lua_pushvalue(state, -1);
+					lua_rawget(state, index);
+					dump_impl(os, state, -2, nest + 1, outtable);
 					os << " = ";
-					it->second.dump_impl(os, nest + 1, outtable);
+					dump_impl(os, state, -1, nest + 1, outtable);
+					lua_pop(state, 2);
 				}
+				lua_pop(state, 1);//pop keys
 				os << "}";
 			}
 			break;
-			case LuaRef::TYPE_LIGHTUSERDATA:
-			case LuaRef::TYPE_FUNCTION:
-			case LuaRef::TYPE_USERDATA:
-			case LuaRef::TYPE_THREAD:
-				os << typeName() << "(" << native_pointer() << ")";
+			case LUA_TLIGHTUSERDATA:
+			case LUA_TFUNCTION:
+			case LUA_TUSERDATA:
+			case LUA_TTHREAD:
+				os << lua_typename(state, type) << "(" << lua_topointer(state, index) << ")";
 				break;
 			default:
 				os << "unknown type";
@@ -823,6 +1312,12 @@ namespace kaguya
 		* @return reference of field value
 		*/
 		TableKeyReference operator[](int index);
+		/**
+		* @brief value = table[key];or table[key] = value;
+		* @param key pre-interned key
+		* @return reference of field value
+		*/
+		TableKeyReference operator[](const Key& key);
 
 		/**
 		* @brief value = table[key];
@@ -860,6 +1355,15 @@ namespace kaguya
 		{
 			return getField(index);
 		}
+		/**
+		* @brief value = table[key];
+		* @param key pre-interned key
+		* @return reference of field value
+		*/
+		LuaRef operator[](const Key& key)const
+		{
+			return getField(key);
+		}
 
 		/**
 		* @brief value = table[key];
@@ -962,6 +1466,35 @@ namespace kaguya
 		{
 			return getField<LuaRef>(index);
 		}
+		/**
+		* @brief value = table[key];
+		* @param key pre-interned key
+		* @return reference of field value
+		*/
+		template<typename T>
+		typename lua_type_traits<T>::get_type getField(const Key& key)const
+		{
+			if (ref_ == LUA_REFNIL)
+			{
+				except::typeMismatchError(state_, "is nil");
+				return LuaRef(state_);
+			}
+			util::ScopedSavedStack save(state_);
+			push(state_);
+			int t = lua_type(state_, -1);
+			if (t != LUA_TTABLE && t != LUA_TUSERDATA)
+			{
+				except::typeMismatchError(state_, typeName() + "is not table");
+				return LuaRef(state_);
+			}
+			key.push(state_);
+			lua_gettable(state_, -2);
+			return lua_type_traits<T>::get(state_, -1);
+		}
+		LuaRef getField(const Key& key)const
+		{
+			return getField<LuaRef>(key);
+		}
 
 		/**
 		* @brief table[key] = value;
@@ -982,6 +1515,26 @@ namespace kaguya
 		}
 #endif
 
+		/**
+		* @name load/store
+		* @brief read(write) all fields described by FieldMapping in one stack pass.
+		* @return If table type mismatched, return false.
+		*/
+		//@{
+		template<typename T>
+		bool load(const FieldMapping<T>& mapping, T& dest)const;
+		template<typename T>
+		bool store(const FieldMapping<T>& mapping, const T& src);
+		//@}
+
+		/**
+		* @brief foreach table fields. key and value are passed as LuaStackRef(without registry reference).
+		* key must not be converted to string in callback(lua_tostring breaks lua_next traversal of number key).
+		*/
+		template <class Fun> void foreach_table(Fun f)const
+		{
+			foreach_table<LuaStackRef, LuaStackRef>(f);
+		}
 		/**
 		* @brief foreach table fields
 		*/
@@ -1009,6 +1562,37 @@ namespace kaguya
 			}
 		}
 
+		/**
+		* @brief range of table fields. Iterate by lua_next without registry reference per element.
+		* Range keeps table on the stack while alive.
+		* @code
+		* for (auto&& kv : table.pairs<std::string, int>()) { kv.first; kv.second; }
+		* @endcode
+		*/
+		TablePairsRange<> pairs()const
+		{
+			return pairs<LuaStackRef, LuaStackRef>();
+		}
+		template<typename K, typename V>
+		TablePairsRange<K, V> pairs()const
+		{
+			push_for_range();
+			return TablePairsRange<K, V>(state_, StackTop());
+		}
+		/**
+		* @brief range of table array part(1 to raw length). Iterate by lua_rawgeti without registry reference per element.
+		*/
+		TableIPairsRange<> ipairs()const
+		{
+			return ipairs<LuaStackRef>();
+		}
+		template<typename V>
+		TableIPairsRange<V> ipairs()const
+		{
+			push_for_range();
+			return TableIPairsRange<V>(state_, StackTop());
+		}
+
 		/**
 		* @brief Equivalent to `#` operator for strings and tables with no metamethods.
 		* Follows Lua's reference manual documentation of `lua_rawlen`, ie. types other
@@ -1176,8 +1760,15 @@ namespace kaguya
 
 		void dump(std::ostream& os)const
 		{
+			if (isNilref())
+			{
+				os << "nil";
+				return;
+			}
+			util::ScopedSavedStack save(state_);
+			push(state_);
 			std::set<const void*> table;
-			dump_impl(os, 0, table);
+			dump_impl(os, state_, -1, 0, table);
 		}
 	};
 
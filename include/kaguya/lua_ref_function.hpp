@@ -86,7 +86,7 @@ namespace kaguya
 
 			if (status)
 			{
-				ErrorHandler::instance().handle(status, state);
+				ErrorHandler::handle(status, state);
 				return LuaRef(state);
 			}
 			return LuaFunction(state, StackTop());
@@ -112,7 +112,7 @@ namespace kaguya
 
 			if (status)
 			{
-				ErrorHandler::instance().handle(status, state);
+				ErrorHandler::handle(status, state);
 				return LuaRef(state);
 			}
 			return LuaFunction(state, StackTop());
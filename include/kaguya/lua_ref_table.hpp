@@ -68,6 +68,10 @@ namespace kaguya
 		{
 			return LuaRef::operator[](index);
 		}
+		LuaRef operator[](const Key& key)const
+		{
+			return LuaRef::operator[](key);
+		}
 		//@}
 
 		using LuaRef::foreach_table;
@@ -141,9 +145,13 @@ namespace kaguya
 		using LuaRef::map;
 		using LuaRef::operator[];
 		using LuaRef::foreach_table;
+		using LuaRef::pairs;
+		using LuaRef::ipairs;
 		using LuaRef::operator->*;
 		using LuaRef::getMetatable;
 		using LuaRef::setMetatable;
+		using LuaRef::load;
+		using LuaRef::store;
 	};
 
 	template<>	struct lua_type_traits<LuaTable> {
@@ -216,6 +224,15 @@ namespace kaguya
 			int tableindex = stack_top + 1;
 			return TableKeyReference(state_, tableindex, keyindex, stack_top);
 		}
+		TableKeyReference operator[](const Key& key)
+		{
+			int stack_top = lua_gettop(state_);
+			push(state_);
+			key.push(state_);
+			int keyindex = stack_top + 2;
+			int tableindex = stack_top + 1;
+			return TableKeyReference(state_, tableindex, keyindex, stack_top);
+		}
 
 		template<typename T>
 		operator T()const {
@@ -285,15 +302,24 @@ namespace kaguya
 
 		bool operator==(const TableKeyReference& other)const
 		{
-			return get<LuaRef>() == other.get<LuaRef>();
+			util::ScopedSavedStack save(state_);
+			push(state_);
+			other.push(state_);
+			return LuaStackRef(state_, -2) == LuaStackRef(state_, -1);
 		}
 		bool operator<(const TableKeyReference& other)const
 		{
-			return get<LuaRef>() < other.get<LuaRef>();
+			util::ScopedSavedStack save(state_);
+			push(state_);
+			other.push(state_);
+			return LuaStackRef(state_, -2) < LuaStackRef(state_, -1);
 		}
 		bool operator<=(const TableKeyReference& other)const
 		{
-			return get<LuaRef>() <= other.get<LuaRef>();
+			util::ScopedSavedStack save(state_);
+			push(state_);
+			other.push(state_);
+			return LuaStackRef(state_, -2) <= LuaStackRef(state_, -1);
 		}
 		bool operator>=(const TableKeyReference& other)const
 		{
@@ -514,6 +540,10 @@ namespace kaguya
 	{
 		return TableKeyReference(*this, index);
 	}
+	inline TableKeyReference LuaRef::operator[](const Key& key)
+	{
+		return TableKeyReference(*this, key);
+	}
 
 	inline bool LuaRef::setMetatable(const LuaTable& table)
 	{
@@ -626,64 +656,146 @@ namespace kaguya
 	};
 
 #ifndef KAGUYA_NO_STD_VECTOR_TO_TABLE
-	template<typename T, typename A>
-	struct lua_type_traits<std::vector<T, A> >
+	namespace detail
 	{
-		typedef std::vector<T, A> get_type;
-		typedef const std::vector<T, A>& push_type;
+		//! element access of sequence codec. generic version use lua_type_traits<T>.
+		template<typename T, bool IsNumber = traits::is_arithmetic<T>::value && !traits::is_same<T, bool>::value>
+		struct sequence_element
+		{
+			static bool check(lua_State* l, int index, bool strict)
+			{
+				return strict ? lua_type_traits<T>::strictCheckType(l, index) : lua_type_traits<T>::checkType(l, index);
+			}
+			static T get(lua_State* l, int index)
+			{
+				return lua_type_traits<T>::get(l, index);
+			}
+			static bool push(lua_State* l, const T& v)
+			{
+				int count = lua_type_traits<T>::push(l, v);
+				if (count == 1) { return true; }
+				lua_pop(l, count);
+				except::typeMismatchError(l, std::string("can not push vector element:") + typeid(T).name());
+				return false;
+			}
+		};
+		//! arithmetic element without lua_type_traits dispatch
+		template<typename T>
+		struct sequence_element<T, true>
+		{
+			static bool check(lua_State* l, int index, bool strict)
+			{
+				if (!strict) { return lua_isnumber(l, index) != 0; }
+#if LUA_VERSION_NUM >= 503
+				if (traits::is_integral<T>::value) { return lua_isinteger(l, index) != 0; }
+#endif
+				return lua_type(l, index) == LUA_TNUMBER;
+			}
+			static T get(lua_State* l, int index)
+			{
+#if LUA_VERSION_NUM >= 503
+				if (traits::is_integral<T>::value) { return static_cast<T>(lua_tointeger(l, index)); }
+#endif
+				return static_cast<T>(lua_tonumber(l, index));
+			}
+			static bool push(lua_State* l, T v)
+			{
+#if LUA_VERSION_NUM >= 503
+				if (traits::is_integral<T>::value) { lua_pushinteger(l, static_cast<lua_Integer>(v)); return true; }
+#endif
+				lua_pushnumber(l, static_cast<lua_Number>(v));
+				return true;
+			}
+		};
 
-		static bool checkType(lua_State* l, int index)
+		/**
+		* Lua sequence(table with keys 1..n) and std::vector conversion on the stack.
+		* Uses lua_rawlen and lua_rawgeti/lua_rawseti directly, without LuaRef.
+		*/
+		template<typename T>
+		struct sequence_codec
 		{
-			LuaRef table = lua_type_traits<LuaRef>::get(l, index);
-			if (table.type() != LuaRef::TYPE_TABLE) { return false; }
-			std::map<LuaRef, LuaRef> values = table.map();
-			for (std::map<LuaRef, LuaRef>::const_iterator it = values.begin(); it != values.end(); ++it)
+			typedef sequence_element<T> element;
+
+			//! single pass over all fields. every key must be integer in [1, rawlen] and every value must be T.
+			static bool checkType(lua_State* l, int index, bool strict)
 			{
-				if (!it->first.typeTest<size_t>() || !it->second.weakTypeTest<T>())
+				if (lua_type(l, index) != LUA_TTABLE) { return false; }
+				util::ScopedSavedStack save(l);
+				index = lua_absindex(l, index);
+				lua_Number size = static_cast<lua_Number>(lua_rawlen(l, index));
+				lua_Number count = 0;
+				lua_pushnil(l);
+				while (lua_next(l, index) != 0)
 				{
-					return false;
+					if (lua_type(l, -2) != LUA_TNUMBER) { return false; }
+					lua_Number key = lua_tonumber(l, -2);
+					if (key < 1 || key > size || key != static_cast<lua_Number>(static_cast<size_t>(key))) { return false; }
+					if (!element::check(l, -1, strict)) { return false; }
+					count += 1;
+					lua_pop(l, 1);
 				}
+				return count == size;
 			}
-			return true;
-		}
-		static bool strictCheckType(lua_State* l, int index)
-		{
-			LuaRef table = lua_type_traits<LuaRef>::get(l, index);
-			if (table.type() != LuaRef::TYPE_TABLE) { return false; }
-			std::map<LuaRef, LuaRef> values = table.map();
-			for (std::map<LuaRef, LuaRef>::const_iterator it = values.begin(); it != values.end(); ++it)
+			//! convert array part(1 to rawlen). element type is checked by checkType.
+			template<typename A>
+			static void get(lua_State* l, int index, std::vector<T, A>& result)
 			{
-				if (!it->first.typeTest<size_t>() || !it->second.typeTest<T>())
+				if (lua_type(l, index) != LUA_TTABLE) { return; }
+				index = lua_absindex(l, index);
+				int size = static_cast<int>(lua_rawlen(l, index));
+				result.reserve(result.size() + size);
+				for (int i = 1; i <= size; ++i)
 				{
-					return false;
+					lua_rawgeti(l, index, i);
+					result.push_back(element::get(l, -1));
+					lua_pop(l, 1);
 				}
 			}
-			return true;
-		}
+			//! if an element can not be pushed, error is reported and nil is pushed instead of the table
+			template<typename A>
+			static int push(lua_State* l, const std::vector<T, A>& v)
+			{
+				lua_createtable(l, int(v.size()), 0);
+				int count = 1;//array is 1 origin in Lua
+				for (typename std::vector<T, A>::const_iterator it = v.begin(); it != v.end(); ++it, ++count)
+				{
+					if (!element::push(l, *it))
+					{
+						lua_pop(l, 1);
+						lua_pushnil(l);
+						return 1;
+					}
+					lua_rawseti(l, -2, count);
+				}
+				return 1;
+			}
+		};
+	}
 
+	template<typename T, typename A>
+	struct lua_type_traits<std::vector<T, A> >
+	{
+		typedef std::vector<T, A> get_type;
+		typedef const std::vector<T, A>& push_type;
+
+		static bool checkType(lua_State* l, int index)
+		{
+			return detail::sequence_codec<T>::checkType(l, index, false);
+		}
+		static bool strictCheckType(lua_State* l, int index)
+		{
+			return detail::sequence_codec<T>::checkType(l, index, true);
+		}
 		static get_type get(lua_State* l, int index)
 		{
 			get_type result;
-			LuaRef table = lua_type_traits<LuaRef>::get(l, index);
-			std::vector<LuaRef> values = table.values();
-			result.reserve(values.size());
-			for (std::vector<LuaRef>::iterator it = values.begin(); it != values.end(); ++it)
-			{
-				result.push_back(it->get<T>());
-			}
+			detail::sequence_codec<T>::get(l, index, result);
 			return result;
 		}
 		static int push(lua_State* l, push_type v)
 		{
-			LuaRef table(l, NewTable(int(v.size()), 0));
-
-			int count = 1;//array is 1 origin in Lua
-			for (typename std::vector<T>::const_iterator it = v.begin(); it != v.end(); ++it)
-			{
-				table.setField(count++, *it);
-			}
-			table.push(l);
-			return 1;
+			return detail::sequence_codec<T>::push(l, v);
 		}
 	};
 #endif
@@ -697,12 +809,12 @@ namespace kaguya
 
 		static bool checkType(lua_State* l, int index)
 		{
-			LuaRef table = lua_type_traits<LuaRef>::get(l, index);
-			if (table.type() != LuaRef::TYPE_TABLE) { return false; }
-			std::map<LuaRef, LuaRef> values = table.map();
-			for (std::map<LuaRef, LuaRef>::const_iterator it = values.begin(); it != values.end(); ++it)
+			if (lua_type(l, index) != LUA_TTABLE) { return false; }
+			lua_pushvalue(l, index);
+			TablePairsRange<> range(l, StackTop());
+			for (TablePairsRange<>::iterator it = range.begin(); it != range.end(); ++it)
 			{
-				if (!it->first.typeTest<K>() || !it->second.weakTypeTest<V>())
+				if (!it.key().typeTest<K>() || !it.value().weakTypeTest<V>())
 				{
 					return false;
 				}
@@ -711,12 +823,12 @@ namespace kaguya
 		}
 		static bool strictCheckType(lua_State* l, int index)
 		{
-			LuaRef table = lua_type_traits<LuaRef>::get(l, index);
-			if (table.type() != LuaRef::TYPE_TABLE) { return false; }
-			std::map<LuaRef, LuaRef> values = table.map();
-			for (std::map<LuaRef, LuaRef>::const_iterator it = values.begin(); it != values.end(); ++it)
+			if (lua_type(l, index) != LUA_TTABLE) { return false; }
+			lua_pushvalue(l, index);
+			TablePairsRange<> range(l, StackTop());
+			for (TablePairsRange<>::iterator it = range.begin(); it != range.end(); ++it)
 			{
-				if (!it->first.typeTest<K>() || !it->second.typeTest<V>())
+				if (!it.key().typeTest<K>() || !it.value().typeTest<V>())
 				{
 					return false;
 				}
@@ -727,11 +839,12 @@ namespace kaguya
 		static get_type get(lua_State* l, int index)
 		{
 			get_type result;
-			LuaRef table = lua_type_traits<LuaRef>::get(l, index);
-			std::map<LuaRef, LuaRef> values = table.map();
-			for (std::map<LuaRef, LuaRef>::const_iterator it = values.begin(); it != values.end(); ++it)
+			if (lua_type(l, index) != LUA_TTABLE) { return result; }
+			lua_pushvalue(l, index);
+			TablePairsRange<K, V> range(l, StackTop());
+			for (typename TablePairsRange<K, V>::iterator it = range.begin(); it != range.end(); ++it)
 			{
-				result[it->first.get<K>()] = it->second.get<V>();
+				result[it.key()] = it.value();
 			}
 			return result;
 		}
@@ -20,6 +20,8 @@
 namespace kaguya
 {
 
+#define KAGUYA_PROPERTY_TABLE_FIELD "__kaguya_property_table"
+
 	template<typename class_type, typename base_class_type = void>
 	struct ClassMetatable
 	{
@@ -43,9 +45,11 @@ namespace kaguya
 
 		typedef std::map<std::string, ValueType> ValueMapType;
 		typedef std::map<std::string, std::string> CodeChunkMapType;
+		typedef standard::function<int(lua_State*)> PropertyPusherType;
+		typedef std::map<std::string, PropertyPusherType> PropertyMapType;
 
 
-		ClassMetatable() :has_property_(false)
+		ClassMetatable()
 		{
 			FunctorType dtor(&class_userdata::destructor<ObjectWrapperBase>);
 			function_map_["__gc"].push_back(dtor);
@@ -74,34 +78,32 @@ namespace kaguya
 				LuaRef metatable(state, StackTop());
 
 
-				if (has_property_)
+				LuaRef indextable = createIndexTable(state);
+				metatable.push();
+				if (pushPropertyTable(state))
 				{
-					LuaRef newindexfn = LuaFunction::loadstring(state, "return function(table, index, value) "
-						"if type(table) == 'table' then rawset(table,index,value)"
-						" else "
-						" table['_prop_'..index](table,value);"
-						" end"
-						" end")();
-					metatable.setField("__newindex", newindexfn);
-
-					LuaRef indextable = createIndexTable(state);
-
-					LuaRef indexfun = kaguya::LuaFunction::loadstring(state, "local arg = {...};local indextable = arg[1];"
-						"return function(table, index)"
-						" local propfun = indextable['_prop_'..index];"
-						" if propfun then return propfun(table) end "
-						" return indextable[index]"
-						" end")(indextable);
-
-					metatable.setField("__index", indexfun);
+					lua_pushliteral(state, KAGUYA_PROPERTY_TABLE_FIELD);
+					lua_pushvalue(state, -2);
+					lua_rawset(state, -4);
+
+					lua_pushvalue(state, -1);
+					indextable.push();
+					lua_pushcclosure(state, &nativefunction::property_index, 2);
+					lua_setfield(state, -3, "__index");
+					lua_pushcclosure(state, &nativefunction::property_newindex, 1);
+					lua_setfield(state, -2, "__newindex");
 				}
 				else
 				{
-					metatable.setField("__index", createIndexTable(state));
+					lua_pop(state, 1);
+					indextable.push();
+					lua_setfield(state, -2, "__index");
 				}
+				lua_pop(state, 1);
 
 				metatable.push();
 				registerMetamethods(state);
+				class_userdata::set_type_list<class_type, base_class_type>(state);
 				if (!traits::is_void<base_class_type>::value)
 				{
 					class_userdata::setmetatable<base_class_type>(state);
@@ -213,8 +215,8 @@ namespace kaguya
 		template<typename Ret>
 		ClassMetatable& addProperty(const char* name, Ret class_type::* mem)
 		{
-			has_property_ = true;
-			return addFunction((std::string("_prop_") + name).c_str(), mem);
+			property_map_[name] = nativefunction::MemberPropertyPusher<class_type, Ret>(mem);
+			return *this;
 		}
 
 		template<typename Fun>
@@ -267,7 +269,7 @@ namespace kaguya
 		{
 			if (lua_type_traits<FunctorOverloadType>::push(state, func_array))
 			{
-				lua_setfield(state, -2, name);
+				setMemberName(state, name);
 			}
 		}
 		void registerField(lua_State* state, const char* name, const ValueType& value)const
@@ -288,7 +290,7 @@ namespace kaguya
 			{
 				assert(false);
 			}
-			lua_setfield(state, -2, name);
+			setMemberName(state, name);
 		}
 		void registerCodeChunk(lua_State* state, const char* name, std::string value)const
 		{
@@ -297,7 +299,53 @@ namespace kaguya
 			if (!except::checkErrorAndThrow(status, state)) { return; }
 			status = lua_pcall(state, 0, 1, 0);
 			if (!except::checkErrorAndThrow(status, state)) { return; }
-			lua_setfield(state, -2, name);
+			setMemberName(state, name);
+		}
+		//! table(at -2)[name] = top value. member names use interned key, so Key lookup from C++ shares the string.
+		static void setMemberName(lua_State* state, const char* name)
+		{
+			if (is_metafield(name))
+			{
+				lua_setfield(state, -2, name);
+				return;
+			}
+			Key(state, name).push(state);
+			lua_insert(state, -2);
+			lua_rawset(state, -3);
+		}
+		//! push property table with base class properties. If class has not property, returns false.
+		bool pushPropertyTable(lua_State* state)const
+		{
+			lua_newtable(state);
+			int table = lua_gettop(state);
+			bool has_property = !property_map_.empty();
+			if (!traits::is_void<base_class_type>::value)
+			{
+				if (class_userdata::get_metatable<base_class_type>(state))
+				{
+					lua_pushliteral(state, KAGUYA_PROPERTY_TABLE_FIELD);
+					lua_rawget(state, -2);
+				}
+				if (lua_istable(state, -1))
+				{
+					has_property = true;
+					lua_pushnil(state);
+					while (lua_next(state, -2))
+					{
+						lua_pushvalue(state, -2);
+						lua_insert(state, -2);
+						lua_rawset(state, table);
+					}
+				}
+				lua_settop(state, table);
+			}
+			for (typename PropertyMapType::const_iterator it = property_map_.begin(); it != property_map_.end(); ++it)
+			{
+				Key(state, it->first).push(state);
+				it->second(state);
+				lua_rawset(state, table);
+			}
+			return has_property;
 		}
 		LuaRef createIndexTable(lua_State* state)const
 		{
@@ -400,6 +448,6 @@ namespace kaguya
 		FuncMapType function_map_;
 		ValueMapType value_map_;
 		CodeChunkMapType code_chunk_map_;
-		bool has_property_;
+		PropertyMapType property_map_;
 	};
 };
@@ -12,6 +12,7 @@
 #include "kaguya/utility.hpp"
 #include "kaguya/type.hpp"
 #include "kaguya/lua_ref.hpp"
+#include "kaguya/binding_profiler.hpp"
 
 #if KAGUYA_USE_CPP11
 #include "native_function_cxx11.hpp"
@@ -180,9 +181,92 @@ namespace kaguya
 			virtual bool checktype(lua_State *state, bool strictcheck) = 0;
 			virtual int invoke(lua_State *state) = 0;
 			virtual std::string argumentTypeNames() = 0;
+			//! push direct lua_CFunction instead of functor_dispatcher. If not supported, returns 0.
+			virtual int pushTrampoline(lua_State *state) { return 0; }
 			virtual ~BaseInvoker() {}
 		};
 
+		// If return pointer,return value retain first argment object
+		// example: a = value.pointer_member; value = nil;
+		// a has value reference
+		// fixme not good implement this
+		inline void retain_argument_references(lua_State *state, int count)
+		{
+			int top = lua_gettop(state);
+			if (top != count)
+			{
+				for (int i = top - count + 1; i <= top; ++i)
+				{
+					ObjectWrapperBase* wrapper = object_wrapper(state, i);
+					if (wrapper)
+					{
+						for (int arg = 1; arg < top - count; ++arg)
+						{
+							if (lua_type(state, arg) == LUA_TUSERDATA)
+							{
+								//return value retain arguments
+								wrapper->addRef(state, arg);
+							}
+
+						}
+					}
+				}
+			}
+		}
+
+		//! function pointer and member pointer are called by function_trampoline
+		template<typename F>
+		struct is_trampoline_target : traits::integral_constant<bool, traits::is_member_pointer<F>::value
+			|| (traits::is_pointer<F>::value && traits::is_function<typename traits::remove_pointer<F>::type>::value)> {};
+
+		/**
+		* Dedicated lua_CFunction for single function.
+		* F is copied to upvalue 1 userdata(without metatable), because function pointer can not convert to light userdata.
+		*/
+		template<typename F>
+		std::string trampoline_signature(const void* storage)
+		{
+			return argTypesName(*static_cast<const F*>(storage));
+		}
+		template<typename F>
+		int function_trampoline(lua_State *l)
+		{
+			const F& f = *static_cast<const F*>(lua_touserdata(l, lua_upvalueindex(1)));
+			KAGUYA_PROFILE_NATIVE_CALL(l);
+			KAGUYA_PROFILE_NATIVE_SELECTED(&f, &trampoline_signature<F>);
+			try {
+				int count = call(l, f);
+				retain_argument_references(l, count);
+				return count;
+			}
+			catch (std::exception & e) {
+				util::traceBack(l, e.what());
+			}
+			catch (...) {
+				util::traceBack(l, "Unknown exception");
+			}
+			KAGUYA_PROFILE_NATIVE_FINISH();
+			return lua_error(l);
+		}
+		template<typename F>
+		int push_trampoline(lua_State *l, F f)
+		{
+			void *storage = lua_newuserdata(l, sizeof(F));
+			new(storage) F(f);
+			lua_pushcclosure(l, &function_trampoline<F>, 1);
+			return 1;
+		}
+		template<typename F, bool Enable = is_trampoline_target<F>::value>
+		struct trampoline_pusher
+		{
+			static int push(lua_State *l, const F& f) { return 0; }
+		};
+		template<typename F>
+		struct trampoline_pusher<F, true>
+		{
+			static int push(lua_State *l, const F& f) { return push_trampoline(l, f); }
+		};
+
 		struct FunctorType :standard::shared_ptr<BaseInvoker>
 		{
 			typedef standard::shared_ptr<BaseInvoker> base_ptr_;
@@ -214,34 +298,12 @@ namespace kaguya
 				virtual int invoke(lua_State *state)
 				{
 					int count = call(state, func_);
-					
-					// If return pointer,return value retain first argment object
-					// example: a = value.pointer_member; value = nil;
-					// a has value reference
-					// fixme not good implement this
-					int top = lua_gettop(state);
-					if (top != count)
-					{
-						for (int i = top - count + 1; i <= top; ++i)
-						{
-							ObjectWrapperBase* wrapper = object_wrapper(state, i);
-							if (wrapper)
-							{
-								for (int arg = 1; arg < top - count; ++arg)
-								{
-									if (lua_type(state, arg) == LUA_TUSERDATA)
-									{
-										//return value retain arguments
-										wrapper->addRef(state, arg);
-									}
-
-								}
-							}
-						}
-					}
-
+					retain_argument_references(state, count);
 					return count;
-
+				}
+				virtual int pushTrampoline(lua_State *state)
+				{
+					return trampoline_pusher<F>::push(state, func_);
 				}
 				virtual std::string argumentTypeNames() {
 					return argTypesName(func_);
@@ -255,33 +317,203 @@ namespace kaguya
 			}
 		};
 
+		/**
+		* Property accessor stored in class property table as userdata.
+		* first member of typed accessor, called by property_index and property_newindex.
+		*/
+		struct PropertyAccessor
+		{
+			typedef int(*access_type)(lua_State* l, const PropertyAccessor* accessor, bool set);
+			access_type access;
+		};
+
+		template<typename T, typename MemType>
+		struct MemberPropertyAccessor
+		{
+			PropertyAccessor header;
+			MemType T::* member;
+
+			static int access_member(lua_State* l, const PropertyAccessor* accessor, bool set)
+			{
+				MemType T::* m = reinterpret_cast<const MemberPropertyAccessor*>(accessor)->member;
+				T* this_ = lua_type_traits<T*>::get(l, 1);
+				if (set)
+				{
+					if (!this_)
+					{
+						throw LuaTypeMismatch("type mismatch!!");
+					}
+					this_->*m = lua_type_traits<MemType>::get(l, 3);
+					return 0;
+				}
+				if (this_)
+				{
+					int count = lua_type_traits<MemType>::push(l, this_->*m);
+					//return value retain object
+					ObjectWrapperBase* wrapper = object_wrapper(l, -1);
+					if (wrapper)
+					{
+						wrapper->addRef(l, 1);
+					}
+					return count;
+				}
+				const T* const_this = lua_type_traits<const T*>::get(l, 1);
+				if (!const_this)
+				{
+					throw LuaTypeMismatch("type mismatch!!");
+				}
+				return lua_type_traits<MemType>::push(l, const_this->*m);
+			}
+			static int push(lua_State* l, MemType T::* m)
+			{
+				MemberPropertyAccessor* accessor = static_cast<MemberPropertyAccessor*>(lua_newuserdata(l, sizeof(MemberPropertyAccessor)));
+				accessor->header.access = &access_member;
+				accessor->member = m;
+				return 1;
+			}
+		};
+
+		//! push MemberPropertyAccessor. used by ClassMetatable
+		template<typename T, typename MemType>
+		struct MemberPropertyPusher
+		{
+			MemberPropertyPusher(MemType T::* m) :member(m) {}
+			int operator()(lua_State* l)const
+			{
+				return MemberPropertyAccessor<T, MemType>::push(l, member);
+			}
+			MemType T::* member;
+		};
+
+		inline int call_property_accessor(lua_State *l, const PropertyAccessor* accessor, bool set)
+		{
+			try {
+				return accessor->access(l, accessor, set);
+			}
+			catch (std::exception & e) {
+				util::traceBack(l, e.what());
+			}
+			catch (...) {
+				util::traceBack(l, "Unknown exception");
+			}
+			return lua_error(l);
+		}
+
+		/**
+		* __index of class with property.
+		* upvalue 1 is property table(name to PropertyAccessor), upvalue 2 is member index table.
+		*/
+		inline int property_index(lua_State *l)
+		{
+			if (lua_type(l, 1) == LUA_TUSERDATA)
+			{
+				lua_pushvalue(l, 2);
+				lua_rawget(l, lua_upvalueindex(1));
+				const PropertyAccessor* accessor = static_cast<const PropertyAccessor*>(lua_touserdata(l, -1));
+				if (accessor)
+				{
+					return call_property_accessor(l, accessor, false);
+				}
+				lua_pop(l, 1);
+			}
+			lua_pushvalue(l, 2);
+			lua_gettable(l, lua_upvalueindex(2));
+			return 1;
+		}
+
+		/**
+		* __newindex of class with property.
+		* upvalue 1 is property table(name to PropertyAccessor).
+		*/
+		inline int property_newindex(lua_State *l)
+		{
+			if (lua_type(l, 1) == LUA_TTABLE)
+			{
+				lua_settop(l, 3);
+				lua_rawset(l, 1);
+				return 0;
+			}
+			lua_pushvalue(l, 2);
+			lua_rawget(l, lua_upvalueindex(1));
+			const PropertyAccessor* accessor = static_cast<const PropertyAccessor*>(lua_touserdata(l, -1));
+			if (accessor)
+			{
+				return call_property_accessor(l, accessor, true);
+			}
+			lua_pushvalue(l, 2);
+			const char* key = lua_tostring(l, -1);
+			util::traceBack(l, (std::string("property not found:") + (key ? key : luaL_typename(l, 2))).c_str());
+			return lua_error(l);
+		}
+
+		/**
+		* Overload set header. stored in upvalue 1 of functor_dispatcher closure.
+		* Arity of each overload is computed at push time, and followed by overload_argcount array.
+		*/
+		struct overload_header
+		{
+			int overload_num;
+
+			int* overload_argcount()
+			{
+				return reinterpret_cast<int*>(this + 1);
+			}
+
+			static overload_header* push(lua_State* l, int overload_num)
+			{
+				void* storage = lua_newuserdata(l, sizeof(overload_header) + sizeof(int) * overload_num);
+				overload_header* header = new(storage) overload_header();
+				header->overload_num = overload_num;
+				return header;
+			}
+		};
+
+		inline overload_header* get_overload_header(lua_State *l)
+		{
+			return static_cast<overload_header*>(lua_touserdata(l, lua_upvalueindex(1)));
+		}
+		inline FunctorType* get_overload_function(lua_State *l, int index)
+		{
+			return static_cast<FunctorType*>(lua_touserdata(l, lua_upvalueindex(index + 2)));
+		}
+
+		inline bool check_overload_type(lua_State *l, FunctorType* fun, bool strictcheck)
+		{
+			KAGUYA_PROFILE_ARGUMENT_CHECK();
+			return (*fun)->checktype(l, strictcheck);
+		}
+		inline std::string functor_signature(const void* fun)
+		{
+			return (*static_cast<const FunctorType*>(fun))->argumentTypeNames();
+		}
+
 		inline FunctorType* pick_match_function(lua_State *l)
 		{
-			int argcount = lua_gettop(l);
-			int overloadnum = int(lua_tonumber(l, lua_upvalueindex(1)));
+			overload_header* header = get_overload_header(l);
+			int overloadnum = header->overload_num;
 
 			if (overloadnum == 1)
 			{
-				FunctorType* fun = static_cast<FunctorType*>(lua_touserdata(l, lua_upvalueindex(2)));
-
-				return fun;
+				return get_overload_function(l, 0);
 			}
+			int argcount = lua_gettop(l);
+
+			const int* overload_argcount = header->overload_argcount();
 			FunctorType* weak_match = 0;
 			FunctorType* argcount_unmatch = 0;
 			for (int i = 0; i < overloadnum; ++i)
 			{
-				FunctorType* fun = static_cast<FunctorType*>(lua_touserdata(l, lua_upvalueindex(i + 2)));
+				FunctorType* fun = get_overload_function(l, i);
 				if (!fun || !(*fun))
 				{
 					continue;
 				}
-				int fnarg = (*fun)->argsCount();
-				bool match_argcount = fnarg == argcount;
-				if (match_argcount && (*fun)->checktype(l, true))
+				bool match_argcount = overload_argcount[i] == argcount;
+				if (match_argcount && check_overload_type(l, fun, true))
 				{
 					return fun;
 				}
-				else if (weak_match == 0 && (match_argcount || !argcount_unmatch) && (*fun)->checktype(l, false))
+				else if (weak_match == 0 && (match_argcount || !argcount_unmatch) && check_overload_type(l, fun, false))
 				{
 					if (match_argcount)
 					{
@@ -299,10 +531,10 @@ namespace kaguya
 		{
 			std::string message = "argument not matching:" + util::argmentTypes(l) + "\t candidated\n";
 
-			int overloadnum = int(lua_tonumber(l, lua_upvalueindex(1)));
+			int overloadnum = get_overload_header(l)->overload_num;
 			for (int i = 0; i < overloadnum; ++i)
 			{
-				FunctorType* fun = static_cast<FunctorType*>(lua_touserdata(l, lua_upvalueindex(i + 2)));
+				FunctorType* fun = get_overload_function(l, i);
 				if (!fun || !(*fun))
 				{
 					continue;
@@ -313,9 +545,11 @@ namespace kaguya
 		}
 		inline int functor_dispatcher(lua_State *l)
 		{
+			KAGUYA_PROFILE_NATIVE_CALL(l);
 			FunctorType* fun = pick_match_function(l);
 			if (fun && (*fun))
 			{
+				KAGUYA_PROFILE_NATIVE_SELECTED(fun, &functor_signature);
 				try {
 					return (*fun)->invoke(l);
 				}
@@ -330,6 +564,7 @@ namespace kaguya
 			{
 				util::traceBack(l, build_arg_error_message(l).c_str());
 			}
+			KAGUYA_PROFILE_NATIVE_FINISH();
 			return lua_error(l);
 		}
 
@@ -453,7 +688,11 @@ namespace kaguya
 		}
 		static int push(lua_State* l, const FunctorType& f)
 		{
-			lua_pushnumber(l, 1);//no overload
+			if (f && f->pushTrampoline(l))
+			{
+				return 1;
+			}
+			nativefunction::overload_header::push(l, 1)->overload_argcount()[0] = f ? f->argsCount() : 0;//no overload
 			void *storage = lua_newuserdata(l, sizeof(FunctorType));
 			new(storage) FunctorType(f);
 			class_userdata::setmetatable<FunctorType>(l);
@@ -463,7 +702,11 @@ namespace kaguya
 #if KAGUYA_USE_RVALUE_REFERENCE
 		static int push(lua_State* l, FunctorType&& f)
 		{
-			lua_pushnumber(l, 1);//no overload
+			if (f && f->pushTrampoline(l))
+			{
+				return 1;
+			}
+			nativefunction::overload_header::push(l, 1)->overload_argcount()[0] = f ? f->argsCount() : 0;//no overload
 			void *storage = lua_newuserdata(l, sizeof(FunctorType));
 			new(storage) FunctorType(std::forward<FunctorType>(f));
 			class_userdata::setmetatable<FunctorType>(l);
@@ -477,7 +720,20 @@ namespace kaguya
 	
 	//specialize for c function
 	template<typename T> struct lua_type_traits < T
-		, typename traits::enable_if<traits::is_function<typename traits::remove_pointer<T>::type>::value>::type > :lua_type_traits<FunctorType> {};
+		, typename traits::enable_if<traits::is_function<typename traits::remove_pointer<T>::type>::value>::type > :lua_type_traits<FunctorType>
+	{
+		typedef typename traits::remove_pointer<T>::type* push_type;
+
+		static int push(lua_State* l, push_type f)
+		{
+			if (!f)
+			{
+				lua_pushnil(l);
+				return 1;
+			}
+			return nativefunction::push_trampoline(l, f);
+		}
+	};
 
 
 
@@ -486,9 +742,14 @@ namespace kaguya
 
 		static int push(lua_State* l, push_type fns)
 		{
-			lua_pushnumber(l, static_cast<lua_Number>(fns.size()));
+			if (fns.size() == 1 && fns.front() && fns.front()->pushTrampoline(l))
+			{
+				return 1;
+			}
+			int* overload_argcount = nativefunction::overload_header::push(l, static_cast<int>(fns.size()))->overload_argcount();
 			for (FunctorOverloadType::const_iterator f = fns.begin(); f != fns.end(); ++f)
 			{
+				*overload_argcount++ = *f ? (*f)->argsCount() : 0;
 				void *storage = lua_newuserdata(l, sizeof(FunctorType));
 				new(storage) FunctorType(*f);
 				class_userdata::setmetatable<FunctorType>(l);
@@ -60,11 +60,11 @@ namespace kaguya
 				return 0;
 			}
 #define KAGUYA_GET_OFFSET 
-#define KAGUYA_GET_CONCAT_REP(N) ,lua_type_traits<KAGUYA_PP_CAT(A,N)>::get(state, N KAGUYA_GET_OFFSET)
-#define KAGUYA_GET_REP(N) lua_type_traits<KAGUYA_PP_CAT(A,N)>::get(state, N KAGUYA_GET_OFFSET)
+#define KAGUYA_GET_CONCAT_REP(N) ,argument_holder<KAGUYA_PP_CAT(A,N)>::get(state, N KAGUYA_GET_OFFSET)
+#define KAGUYA_GET_REP(N) argument_holder<KAGUYA_PP_CAT(A,N)>::get(state, N KAGUYA_GET_OFFSET)
 
-#define KAGUYA_STRICT_TYPECHECK_REP(N) && lua_type_traits<KAGUYA_PP_CAT(A,N)>::strictCheckType(state, N KAGUYA_GET_OFFSET)
-#define KAGUYA_TYPECHECK_REP(N) && lua_type_traits<KAGUYA_PP_CAT(A,N)>::checkType(state, N KAGUYA_GET_OFFSET)
+#define KAGUYA_STRICT_TYPECHECK_REP(N) && argument_holder<KAGUYA_PP_CAT(A,N)>::strictCheckType(state, N KAGUYA_GET_OFFSET)
+#define KAGUYA_TYPECHECK_REP(N) && argument_holder<KAGUYA_PP_CAT(A,N)>::checkType(state, N KAGUYA_GET_OFFSET)
 #define KAGUYA_TYPENAME_REP(N) + typeid(KAGUYA_PP_CAT(A,N)).name() + ","
 
 #define KAGUYA_GET_REPEAT_CONCAT(N) KAGUYA_PP_REPEAT(N,KAGUYA_GET_CONCAT_REP)
@@ -295,7 +295,7 @@ namespace kaguya
 				typedef ObjectWrapper<ClassType> wrapper_type;\
 				void *storage = lua_newuserdata(state, sizeof(wrapper_type));\
 				new(storage) wrapper_type(KAGUYA_GET_REPEAT(N));\
-				class_userdata::setmetatable<ClassType>(state);\
+				class_userdata::set_object_metatable<ClassType>(state);\
 				return 1;\
 			}\
 			template<typename ClassType KAGUYA_PP_TEMPLATE_DEF_REPEAT_CONCAT(N)>\
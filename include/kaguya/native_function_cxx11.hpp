@@ -9,6 +9,7 @@
 #include "kaguya/config.hpp"
 #include "kaguya/utility.hpp"
 #include "kaguya/object.hpp"
+#include "kaguya/binding_profiler.hpp"
 
 
 namespace kaguya
@@ -20,36 +21,42 @@ namespace kaguya
 			template<class ThisType, class Res, class... FArgs, class... Args>
 			Res invoke(Res(ThisType::*f)(FArgs...), ThisType* this_, Args&&... args)
 			{
+				KAGUYA_PROFILE_NATIVE_BODY();
 				return (this_->*f)(std::forward<Args>(args)...);
 			}
 
 			template<class ThisType, class... FArgs, class... Args>
 			void invoke(void (ThisType::*f)(FArgs...), ThisType* this_, Args&&... args)
 			{
+				KAGUYA_PROFILE_NATIVE_BODY();
 				(this_->*f)(std::forward<Args>(args)...);
 			}
 
 			template<class ThisType, class Res, class... FArgs, class... Args>
 			Res invoke(Res(ThisType::*f)(FArgs...)const, const ThisType* this_, Args&&... args)
 			{
+				KAGUYA_PROFILE_NATIVE_BODY();
 				return (this_->*f)(std::forward<Args>(args)...);
 			}
 
 			template<class ThisType, class... FArgs, class... Args>
 			void invoke(void (ThisType::*f)(FArgs...)const, const ThisType* this_, Args&&... args)
 			{
+				KAGUYA_PROFILE_NATIVE_BODY();
 				(this_->*f)(std::forward<Args>(args)...);
 			}
 			template<class F, class... Args>
 			typename traits::enable_if<!traits::is_same<typename standard::result_of<F(Args...)>::type, void>::value, typename standard::result_of<F(Args...)>::type>::type
 				invoke(const F& f, Args&&... args)
 			{
+				KAGUYA_PROFILE_NATIVE_BODY();
 				return f(std::forward<Args>(args)...);
 			}
 			template<class F, class... Args>
 			typename traits::enable_if<traits::is_same<typename standard::result_of<F(Args...)>::type, void>::value, void>::type
 				invoke(const F& f, Args&&... args)
 			{
+				KAGUYA_PROFILE_NATIVE_BODY();
 				f(std::forward<Args>(args)...);
 			}
 
@@ -114,12 +121,12 @@ namespace kaguya
 			template<class F, class Ret, class... Args, size_t... Indexes>
 			int _call_apply(lua_State* state, const F& f, index_tuple<Indexes...>, invoke_signature_type<Ret, Args...>)
 			{
-				return lua_type_traits<Ret>::push(state, invoke(f, lua_type_traits<Args>::get(state, Indexes)...));
+				return lua_type_traits<Ret>::push(state, invoke(f, argument_holder<Args>::get(state, Indexes)...));
 			}
 			template<class F, class... Args, size_t... Indexes>
 			int _call_apply(lua_State* state, const F& f, index_tuple<Indexes...>, invoke_signature_type<void, Args...>)
 			{
-				invoke(f, lua_type_traits<Args>::get(state, Indexes)...);
+				invoke(f, argument_holder<Args>::get(state, Indexes)...);
 				return 0;
 			}
 
@@ -145,12 +152,12 @@ namespace kaguya
 			template<class R, class... Args, size_t... Indexes>
 			bool _ctype_apply(lua_State* state, index_tuple<Indexes...>, invoke_signature_type<R, Args...>)
 			{
-				return all_true(lua_type_traits<Args>::checkType(state, Indexes)...);
+				return all_true(argument_holder<Args>::checkType(state, Indexes)...);
 			}
 			template<class R, class... Args, size_t... Indexes>
 			bool _sctype_apply(lua_State* state, index_tuple<Indexes...>, invoke_signature_type<R, Args...>)
 			{
-				return all_true(lua_type_traits<Args>::strictCheckType(state, Indexes)...);
+				return all_true(argument_holder<Args>::strictCheckType(state, Indexes)...);
 			}
 			template<class R, class... Args>
 			std::string _type_name_apply(invoke_signature_type<R, Args...>)
@@ -237,9 +244,9 @@ namespace kaguya
 			{
 				typedef ObjectWrapper<ClassType> wrapper_type;
 				void *storage = lua_newuserdata(state, sizeof(wrapper_type));
-				new(storage) wrapper_type(lua_type_traits<Args>::get(state, Indexes)...);
+				new(storage) wrapper_type(argument_holder<Args>::get(state, Indexes)...);
 
-				class_userdata::setmetatable<ClassType>(state);
+				class_userdata::set_object_metatable<ClassType>(state);
 				return 1;
 			}
 			//@}
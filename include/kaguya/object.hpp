@@ -71,6 +71,18 @@ namespace kaguya
 			return luaL_setmetatable(l, metatableName<T>().c_str());
 		}
 
+		inline void push_default_object_metatable(lua_State* l);
+		//! set metatable to ObjectWrapperBase userdata at stack top. unregistered type gets default object metatable
+		template<typename T>void set_object_metatable(lua_State* l)
+		{
+			if (!get_metatable<T>(l))
+			{
+				lua_pop(l, 1);
+				push_default_object_metatable(l);
+			}
+			lua_setmetatable(l, -2);
+		}
+
 		template<typename T>T* test_userdata(lua_State* l, int index)
 		{
 			return static_cast<T*>(luaL_testudata(l, index, metatableName<T>().c_str()));
@@ -99,7 +111,12 @@ namespace kaguya
 
 	struct ObjectWrapperBase
 	{
-		virtual bool is_native_type(const std::string& type) = 0;
+		//! type identity is the address of metatableName<T>() string.
+		//! string compare is fallback for the same type from other module.
+		bool is_native_type(const std::string& type)const
+		{
+			return native_type_ == &type || *native_type_ == type;
+		}
 
 		virtual const void* native_cget() = 0;
 		virtual void* native_get() = 0;
@@ -107,10 +124,13 @@ namespace kaguya
 		virtual void* get() = 0;
 
 		virtual void addRef(lua_State* state,int index) {};
+		//! true if object count is shared by the holder. IntrusivePtr can adopt the object
+		virtual bool intrusive()const { return false; }
 
-		ObjectWrapperBase() {}
+		ObjectWrapperBase(const std::string& native_type) :native_type_(&native_type) {}
 		virtual ~ObjectWrapperBase() {}
 	private:
+		const std::string* native_type_;
 
 		//noncopyable
 		ObjectWrapperBase(const ObjectWrapperBase&);
@@ -122,36 +142,31 @@ namespace kaguya
 	{
 		T object;
 
-		ObjectWrapper() :object() {}
+		ObjectWrapper() :ObjectWrapperBase(metatableName<T>()), object() {}
 
 		template<class Arg1>
-		ObjectWrapper(const Arg1& v1) : object(v1) {}
+		ObjectWrapper(const Arg1& v1) : ObjectWrapperBase(metatableName<T>()), object(v1) {}
 		template<class Arg1, class Arg2>
-		ObjectWrapper(const Arg1& v1, const Arg2& v2) : object(v1, v2) {}
+		ObjectWrapper(const Arg1& v1, const Arg2& v2) : ObjectWrapperBase(metatableName<T>()), object(v1, v2) {}
 		template<class Arg1, class Arg2, class Arg3>
-		ObjectWrapper(const Arg1& v1, const Arg2& v2, const Arg3& v3) : object(v1, v2, v3) {}
+		ObjectWrapper(const Arg1& v1, const Arg2& v2, const Arg3& v3) : ObjectWrapperBase(metatableName<T>()), object(v1, v2, v3) {}
 		template<class Arg1, class Arg2, class Arg3, class Arg4>
-		ObjectWrapper(const Arg1& v1, const Arg2& v2, const Arg3& v3, const Arg4& v4) : object(v1, v2, v3, v4) {}
+		ObjectWrapper(const Arg1& v1, const Arg2& v2, const Arg3& v3, const Arg4& v4) : ObjectWrapperBase(metatableName<T>()), object(v1, v2, v3, v4) {}
 		template<class Arg1, class Arg2, class Arg3, class Arg4, class Arg5>
-		ObjectWrapper(const Arg1& v1, const Arg2& v2, const Arg3& v3, const Arg4& v4, const Arg5& v5) : object(v1, v2, v3, v4, v5) {}
+		ObjectWrapper(const Arg1& v1, const Arg2& v2, const Arg3& v3, const Arg4& v4, const Arg5& v5) : ObjectWrapperBase(metatableName<T>()), object(v1, v2, v3, v4, v5) {}
 		template<class Arg1, class Arg2, class Arg3, class Arg4, class Arg5, class Arg6>
-		ObjectWrapper(const Arg1& v1, const Arg2& v2, const Arg3& v3, const Arg4& v4, const Arg5& v5, const Arg6& v6) : object(v1, v2, v3, v4, v5, v6) {}
+		ObjectWrapper(const Arg1& v1, const Arg2& v2, const Arg3& v3, const Arg4& v4, const Arg5& v5, const Arg6& v6) : ObjectWrapperBase(metatableName<T>()), object(v1, v2, v3, v4, v5, v6) {}
 		template<class Arg1, class Arg2, class Arg3, class Arg4, class Arg5, class Arg6, class Arg7>
-		ObjectWrapper(const Arg1& v1, const Arg2& v2, const Arg3& v3, const Arg4& v4, const Arg5& v5, const Arg6& v6, const Arg7& v7) : object(v1, v2, v3, v4, v5, v6, v7) {}
+		ObjectWrapper(const Arg1& v1, const Arg2& v2, const Arg3& v3, const Arg4& v4, const Arg5& v5, const Arg6& v6, const Arg7& v7) : ObjectWrapperBase(metatableName<T>()), object(v1, v2, v3, v4, v5, v6, v7) {}
 		template<class Arg1, class Arg2, class Arg3, class Arg4, class Arg5, class Arg6, class Arg7, class Arg8>
-		ObjectWrapper(const Arg1& v1, const Arg2& v2, const Arg3& v3, const Arg4& v4, const Arg5& v5, const Arg6& v6, const Arg7& v7, const Arg8& v8) : object(v1, v2, v3, v4, v5, v6, v7, v8) {}
+		ObjectWrapper(const Arg1& v1, const Arg2& v2, const Arg3& v3, const Arg4& v4, const Arg5& v5, const Arg6& v6, const Arg7& v7, const Arg8& v8) : ObjectWrapperBase(metatableName<T>()), object(v1, v2, v3, v4, v5, v6, v7, v8) {}
 		template<class Arg1, class Arg2, class Arg3, class Arg4, class Arg5, class Arg6, class Arg7, class Arg8, class Arg9>
-		ObjectWrapper(const Arg1& v1, const Arg2& v2, const Arg3& v3, const Arg4& v4, const Arg5& v5, const Arg6& v6, const Arg7& v7, const Arg8& v8, const Arg9& v9) : object(v1, v2, v3, v4, v5, v6, v7, v8, v9) {}
+		ObjectWrapper(const Arg1& v1, const Arg2& v2, const Arg3& v3, const Arg4& v4, const Arg5& v5, const Arg6& v6, const Arg7& v7, const Arg8& v8, const Arg9& v9) : ObjectWrapperBase(metatableName<T>()), object(v1, v2, v3, v4, v5, v6, v7, v8, v9) {}
 #if KAGUYA_USE_CPP11
 		template<class Arg1,class... Args>
-		ObjectWrapper(Arg1&& arg1,Args&&... args) : object(std::forward<Arg1>(arg1),std::forward<Args>(args)...) {}
+		ObjectWrapper(Arg1&& arg1,Args&&... args) : ObjectWrapperBase(metatableName<T>()), object(std::forward<Arg1>(arg1),std::forward<Args>(args)...) {}
 #endif
 
-		virtual bool is_native_type(const std::string& type)
-		{
-			return metatableName<T>() == type;
-		}
-
 		virtual void* get()
 		{
 			return &object;
@@ -169,16 +184,11 @@ namespace kaguya
 	{
 		T object;
 
-		ObjectSmartPointerWrapper(const T& sptr) :object(sptr) {}
+		ObjectSmartPointerWrapper(const T& sptr) :ObjectWrapperBase(metatableName<T>()), object(sptr) {}
 #if KAGUYA_USE_RVALUE_REFERENCE
-		ObjectSmartPointerWrapper(T&& sptr) : object(std::move(sptr)) {}
+		ObjectSmartPointerWrapper(T&& sptr) : ObjectWrapperBase(metatableName<T>()), object(std::move(sptr)) {}
 #endif
 
-
-		virtual bool is_native_type(const std::string& type)
-		{
-			return metatableName<T>() == type;
-		}
 		virtual void* get()
 		{
 			return object.get();
@@ -196,12 +206,8 @@ namespace kaguya
 	{
 		T* object;
 
-		ObjectPointerWrapper(T* ptr) :object(ptr) {}
+		ObjectPointerWrapper(T* ptr) :ObjectWrapperBase(metatableName<T>()), object(ptr) {}
 
-		virtual bool is_native_type(const std::string& type)
-		{
-			return metatableName<T>() == type;
-		}
 		virtual void* get()
 		{
 			if (traits::is_const<T>::value)
@@ -241,19 +247,108 @@ namespace kaguya
 		return false;	
 	}
 
-	inline ObjectWrapperBase* object_wrapper(lua_State* l, int index,const std::string& require_type= std::string())
+	namespace class_userdata
 	{
-		if (lua_type(l, index) == LUA_TUSERDATA)
+		/**
+		* Type list is stored in class metatable as null terminated array of metatableName<T>() address.
+		* It is built once by ClassMetatable::registerClass, ordered by class type, base type, base of base type...
+		* Objects of unregistered type get default object metatable with empty list.
+		* Userdata without type list in metatable is not ObjectWrapperBase.
+		*/
+		typedef const std::string* type_list_entry;
+
+		//! light userdata key of type list field. cheaper than string key at every object access
+		inline void* type_list_key()
+		{
+			static char key;
+			return &key;
+		}
+
+		//! push type list of metatable at stack top. return null if not exist.
+		inline const type_list_entry* get_type_list(lua_State* l)
+		{
+#if LUA_VERSION_NUM >= 502
+			lua_rawgetp(l, -1, type_list_key());
+#else
+			lua_pushlightuserdata(l, type_list_key());
+			lua_rawget(l, -2);
+#endif
+			return static_cast<const type_list_entry*>(lua_touserdata(l, -1));
+		}
+
+		//! create type list to metatable on stack top
+		template<typename T, typename BaseType>
+		void set_type_list(lua_State* l)
 		{
 			util::ScopedSavedStack save(l);
-			void* ptr = lua_touserdata(l, index);
-			if (static_cast<ObjectWrapperBase*>(ptr)->is_native_type(require_type))
+			int metatable = lua_gettop(l);
+			size_t count = 1;
+			const type_list_entry* base_types = 0;
+			if (!traits::is_void<BaseType>::value && get_metatable<BaseType>(l))
 			{
-				return static_cast<ObjectWrapperBase*>(ptr);
+				base_types = get_type_list(l);
+				for (const type_list_entry* it = base_types; it && *it; ++it)
+				{
+					count++;
+				}
+			}
+			type_list_entry* list = static_cast<type_list_entry*>(lua_newuserdata(l, sizeof(type_list_entry) * (count + 1)));
+			list[0] = &metatableName<T>();
+			for (size_t i = 1; i < count; ++i)
+			{
+				list[i] = base_types[i - 1];
+			}
+			list[count] = 0;
+			lua_pushlightuserdata(l, type_list_key());
+			lua_insert(l, -2);
+			lua_rawset(l, metatable);
+		}
+
+#define KAGUYA_DEFAULT_OBJECT_METATABLE "kaguya_object_wrapper"
+		inline int default_object_gc(lua_State* l)
+		{
+			destructor(static_cast<ObjectWrapperBase*>(lua_touserdata(l, 1)));
+			return 0;
+		}
+		//! metatable for object of unregistered type. it has empty type list
+		inline void push_default_object_metatable(lua_State* l)
+		{
+			if (luaL_newmetatable(l, KAGUYA_DEFAULT_OBJECT_METATABLE))
+			{
+				type_list_entry* list = static_cast<type_list_entry*>(lua_newuserdata(l, sizeof(type_list_entry)));
+				list[0] = 0;
+				lua_pushlightuserdata(l, type_list_key());
+				lua_insert(l, -2);
+				lua_rawset(l, -3);
+				lua_pushcfunction(l, &default_object_gc);
+				lua_setfield(l, -2, "__gc");
 			}
-			else if (require_type.empty() || recursive_base_type_check(l,index, require_type))
+		}
+	}
+
+	inline ObjectWrapperBase* object_wrapper(lua_State* l, int index,const std::string& require_type= std::string())
+	{
+		if (lua_type(l, index) != LUA_TUSERDATA || !lua_getmetatable(l, index))
+		{
+			return 0;
+		}
+		//type list is kept alive by metatable of the userdata at index
+		const class_userdata::type_list_entry* types = class_userdata::get_type_list(l);
+		lua_pop(l, 2);
+		if (!types)
+		{
+			return 0;//not object wrapper
+		}
+		ObjectWrapperBase* ptr = static_cast<ObjectWrapperBase*>(lua_touserdata(l, index));
+		if (require_type.empty() || ptr->is_native_type(require_type))
+		{
+			return ptr;
+		}
+		for (; *types; ++types)
+		{
+			if (*types == &require_type || **types == require_type)
 			{
-				return static_cast<ObjectWrapperBase*>(ptr);
+				return ptr;
 			}
 		}
 		return 0;
@@ -0,0 +1,328 @@
+// Copyright satoren
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <sstream>
+#include <new>
+
+#include "kaguya/config.hpp"
+#include "kaguya/utility.hpp"
+
+#if KAGUYA_USE_CPP11
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#endif
+
+namespace kaguya
+{
+	/**
+	* Per State sampling profiler of Lua code.
+	* A count hook(lua_sethook with LUA_MASKCOUNT) runs every instruction_count instructions,
+	* and captures Lua call stack if timer thread requested a sample(with C++03, every hook call is a sample).
+	* Samples are aggregated to folded stacks("outer;inner count" lines) for flame graph tools.
+	* Frames are named by global table(bound C++ functions by registered names), then by call site name or source position.
+	* While stopped, the hook is removed and has no overhead.
+	* The hook is set to the main thread. Coroutines created while running inherit it,
+	* and threads from CoroutinePool(including Scheduler tasks) get it when acquired or resumed if they have no hook of their own.
+	* Other coroutines created before start() are not sampled unless passed to attach().
+	* Sampled functions are kept alive(pinned in the registry) until reset(), so an address is not reused by other function.
+	* @code
+	* state.samplingProfiler().start(1000);
+	* state.dofile("game.lua");
+	* state.samplingProfiler().stop();
+	* std::ofstream("game.folded") << state.samplingProfiler().report();
+	* @endcode
+	*/
+	class SamplingProfiler
+	{
+	public:
+		typedef std::map<std::string, size_t> FoldedStacks;
+
+		/**
+		* @param frequency samples per second
+		* @param instruction_count interval of count hook. sample is taken at first hook after timer tick
+		* @param max_depth frames captured from the running function
+		*/
+		void start(double frequency = 1000, int instruction_count = 1000, int max_depth = 64)
+		{
+			if (running_) { stop(); }
+			running_ = true;
+			max_depth_ = max_depth > 0 ? max_depth : 1;
+			instruction_count_ = instruction_count > 0 ? instruction_count : 1;
+#if KAGUYA_USE_CPP11
+			timer_stop_ = false;
+			std::chrono::nanoseconds interval(static_cast<long long>(frequency > 0 ? 1e9 / frequency : 1e6));
+			timer_ = std::thread([this, interval]()
+			{
+				std::unique_lock<std::mutex> lock(timer_mutex_);
+				while (!timer_wakeup_.wait_for(lock, interval, [this] { return timer_stop_; }))
+				{
+					sample_requested_ = true;
+				}
+			});
+#endif
+			lua_sethook(state_, &hook, LUA_MASKCOUNT, instruction_count_);
+		}
+		//! sample coroutine created before start(). hook is removed at first hook call after stop
+		void attach(lua_State* thread)
+		{
+			if (running_ && thread)
+			{
+				lua_sethook(thread, &hook, LUA_MASKCOUNT, instruction_count_);
+			}
+		}
+		//! attach thread if running and thread has no hook set by others. used by CoroutinePool and Scheduler
+		static void attachUnhooked(lua_State* thread)
+		{
+			lua_Hook current = lua_gethook(thread);
+			if (current && current != &hook) { return; }
+			SamplingProfiler* profiler = find(thread);
+			if (profiler && profiler->running_ && (current != &hook || lua_gethookcount(thread) != profiler->instruction_count_))
+			{
+				profiler->attach(thread);
+			}
+		}
+		void stop()
+		{
+			if (!running_) { return; }
+			running_ = false;
+			lua_sethook(state_, 0, 0, 0);
+#if KAGUYA_USE_CPP11
+			{
+				std::lock_guard<std::mutex> lock(timer_mutex_);
+				timer_stop_ = true;
+			}
+			timer_wakeup_.notify_all();
+			timer_.join();
+#endif
+		}
+		bool running()const { return running_; }
+		//! remove recorded samples and release pinned functions
+		void reset()
+		{
+			stacks_.clear();
+			labels_.clear();
+			sample_count_ = 0;
+			util::ScopedSavedStack save(state_);
+			lua_pushlightuserdata(state_, pinKey());
+			lua_pushnil(state_);
+			lua_rawset(state_, LUA_REGISTRYINDEX);
+		}
+		size_t sampleCount()const { return sample_count_; }
+
+		//! sample count of each stack. frames are joined by ';' from outermost
+		FoldedStacks foldedStacks()const
+		{
+			std::map<const void*, std::string> names = util::registered_function_names(state_);
+			FoldedStacks result;
+			for (StackMap::const_iterator it = stacks_.begin(); it != stacks_.end(); ++it)
+			{
+				std::string folded;
+				for (std::vector<const void*>::const_reverse_iterator frame = it->first.rbegin(); frame != it->first.rend(); ++frame)
+				{
+					if (!folded.empty()) { folded += ';'; }
+					std::map<const void*, std::string>::const_iterator name = names.find(*frame);
+					std::map<const void*, std::string>::const_iterator label = labels_.find(*frame);
+					folded += escape(name != names.end() ? name->second : label != labels_.end() ? label->second : "?");
+				}
+				result[folded] += it->second;
+			}
+			return result;
+		}
+		//! folded stacks format, most sampled first
+		std::string report()const
+		{
+			FoldedStacks stacks = foldedStacks();
+			std::vector<std::pair<size_t, std::string> > sorted;
+			for (FoldedStacks::const_iterator it = stacks.begin(); it != stacks.end(); ++it)
+			{
+				sorted.push_back(std::make_pair(it->second, it->first));
+			}
+			std::stable_sort(sorted.begin(), sorted.end(), &greater_count);
+			std::ostringstream os;
+			for (size_t i = 0; i < sorted.size(); ++i)
+			{
+				os << sorted[i].second << " " << sorted[i].first << "\n";
+			}
+			return os.str();
+		}
+
+		//! profiler of the State. null if not created
+		static SamplingProfiler* find(lua_State* l)
+		{
+			lua_pushlightuserdata(l, key());
+			lua_rawget(l, LUA_REGISTRYINDEX);
+			SamplingProfiler* profiler = static_cast<SamplingProfiler*>(lua_touserdata(l, -1));
+			lua_pop(l, 1);
+			return profiler;
+		}
+		//! profiler of the State. created at first call
+		static SamplingProfiler& get(lua_State* l)
+		{
+			SamplingProfiler* profiler = find(l);
+			if (profiler) { return *profiler; }
+			util::ScopedSavedStack save(l);
+			lua_pushlightuserdata(l, key());
+			profiler = new(lua_newuserdata(l, sizeof(SamplingProfiler))) SamplingProfiler(util::toMainThread(l));
+			lua_newtable(l);
+			lua_pushcfunction(l, &destructor);
+			lua_setfield(l, -2, "__gc");
+			lua_setmetatable(l, -2);
+			lua_rawset(l, LUA_REGISTRYINDEX);
+			return *profiler;
+		}
+	private:
+		typedef std::map<std::vector<const void*>, size_t> StackMap;
+
+		explicit SamplingProfiler(lua_State* state) :state_(state), running_(false), max_depth_(64), instruction_count_(1000), sample_count_(0)
+#if KAGUYA_USE_CPP11
+			, timer_stop_(false), sample_requested_(false)
+#endif
+		{
+		}
+		SamplingProfiler(const SamplingProfiler&);
+		SamplingProfiler& operator=(const SamplingProfiler&);
+
+		static void* key()
+		{
+			static char key_[2];
+			return &key_[0];
+		}
+		//! registry key of table of sampled functions
+		static void* pinKey()
+		{
+			return static_cast<char*>(key()) + 1;
+		}
+		//! hooks left on coroutines find no profiler after this
+		static int destructor(lua_State* l)
+		{
+			SamplingProfiler* profiler = static_cast<SamplingProfiler*>(lua_touserdata(l, 1));
+			bool running = profiler->running_;
+			profiler->running_ = false;
+			lua_sethook(profiler->state_, 0, 0, 0);
+			lua_pushlightuserdata(l, key());
+			lua_pushnil(l);
+			lua_rawset(l, LUA_REGISTRYINDEX);
+#if KAGUYA_USE_CPP11
+			if (running)
+			{
+				{
+					std::lock_guard<std::mutex> lock(profiler->timer_mutex_);
+					profiler->timer_stop_ = true;
+				}
+				profiler->timer_wakeup_.notify_all();
+				profiler->timer_.join();
+			}
+#endif
+			profiler->~SamplingProfiler();
+			return 0;
+		}
+		static bool greater_count(const std::pair<size_t, std::string>& a, const std::pair<size_t, std::string>& b)
+		{
+			return a.first > b.first;
+		}
+		//! ';' separates frames and ' ' separates count in folded format
+		static std::string escape(std::string name)
+		{
+			std::replace(name.begin(), name.end(), ';', ':');
+			std::replace(name.begin(), name.end(), ' ', '_');
+			return name;
+		}
+
+		static void hook(lua_State* l, lua_Debug*)
+		{
+			SamplingProfiler* profiler = find(l);
+			if (!profiler || !profiler->running_)
+			{
+				lua_sethook(l, 0, 0, 0);//coroutine created while running
+				return;
+			}
+#if KAGUYA_USE_CPP11
+			if (!profiler->sample_requested_.exchange(false)) { return; }
+#endif
+			profiler->sample(l);
+		}
+		void sample(lua_State* l)
+		{
+			if (!lua_checkstack(l, 4)) { return; }
+			std::vector<const void*> stack;
+			lua_Debug ar;
+			for (int level = 0; level < max_depth_ && lua_getstack(l, level, &ar); ++level)
+			{
+				lua_getinfo(l, "Sf", &ar);
+				const void* function = lua_topointer(l, -1);
+				stack.push_back(function);
+				if (labels_.find(function) == labels_.end())
+				{
+					pin(l);
+					lua_getinfo(l, "n", &ar);
+					labels_[function] = label(ar);
+				}
+				lua_pop(l, 1);
+			}
+			stacks_[stack]++;
+			sample_count_++;
+		}
+		//! keep function at stack top alive until reset
+		static void pin(lua_State* l)
+		{
+			lua_pushlightuserdata(l, pinKey());
+			lua_rawget(l, LUA_REGISTRYINDEX);
+			if (lua_isnil(l, -1))
+			{
+				lua_pop(l, 1);
+				lua_newtable(l);
+				lua_pushlightuserdata(l, pinKey());
+				lua_pushvalue(l, -2);
+				lua_rawset(l, LUA_REGISTRYINDEX);
+			}
+			lua_pushvalue(l, -2);
+			lua_pushboolean(l, 1);
+			lua_rawset(l, -3);
+			lua_pop(l, 1);
+		}
+		//! frame name used if not found in global table
+		static std::string label(const lua_Debug& ar)
+		{
+			std::ostringstream os;
+			if (ar.what && std::string(ar.what) == "main")
+			{
+				os << "main@" << ar.short_src;
+			}
+			else if (ar.what && std::string(ar.what) == "C")
+			{
+				os << "[C]" << (ar.name ? ar.name : "?");
+			}
+			else
+			{
+				os << (ar.name ? ar.name : "function") << "@" << ar.short_src << ":" << ar.linedefined;
+			}
+			return os.str();
+		}
+
+		lua_State* state_;
+		bool running_;
+		int max_depth_;
+		int instruction_count_;
+		size_t sample_count_;
+		StackMap stacks_;
+		std::map<const void*, std::string> labels_;
+#if KAGUYA_USE_CPP11
+		std::thread timer_;
+		std::mutex timer_mutex_;
+		std::condition_variable timer_wakeup_;
+		bool timer_stop_;
+		std::atomic<bool> sample_requested_;
+#endif
+	};
+}
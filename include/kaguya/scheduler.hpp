@@ -0,0 +1,393 @@
+// Copyright satoren
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include "kaguya/config.hpp"
+
+#if KAGUYA_USE_CPP11
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <new>
+
+#include "kaguya/state.hpp"
+
+#define KAGUYA_SCHEDULER_COMPLETION_METATABLE "kaguya_scheduler_completion"
+
+namespace kaguya
+{
+	//! statistics of Scheduler
+	struct SchedulerStats
+	{
+		SchedulerStats() :spawned_count(0), resume_count(0), finished_count(0), error_count(0) {}
+
+		size_t spawned_count;
+		size_t resume_count;
+		//! tasks returned normally
+		size_t finished_count;
+		//! tasks ended by error. message is reported to ErrorHandler
+		size_t error_count;
+	};
+
+	namespace scheduler_detail
+	{
+		//! push values to resume the awaiting coroutine and return count
+		typedef standard::function<int(lua_State*)> ResultPusher;
+
+		//! shared by copies of Completion and its userdata. result is kept here until awaited
+		struct CompletionState
+		{
+			explicit CompletionState(size_t id) :id(id), done(false) {}
+			size_t id;
+			bool done;
+			ResultPusher result;
+		};
+
+		//! completions done by any thread, dispatched by scheduler thread
+		struct CompletionQueue
+		{
+			std::mutex mutex;
+			std::condition_variable completed_cv;
+			std::deque<size_t> completed;
+		};
+
+		//! userdata pushed to Lua for Completion
+		struct CompletionKey
+		{
+			const void* owner;
+			std::shared_ptr<CompletionState> state;
+		};
+
+		inline int completion_key_gc(lua_State* l)
+		{
+			CompletionKey* key = static_cast<CompletionKey*>(lua_touserdata(l, 1));
+			key->~CompletionKey();
+			return 0;
+		}
+	}
+
+	/**
+	* One shot completion of an asynchronous operation awaited by a Scheduler task.
+	* Return it from a bound function and await it in Lua. complete() and fail() are thread safe.
+	* Values are copied and pushed by lua_type_traits in the scheduler thread.
+	*/
+	class Completion
+	{
+	public:
+		Completion() {}
+
+		/**
+		* @brief resume the awaiting task with values
+		* @return false if already completed
+		*/
+		template<typename... Args>
+		bool complete(Args... args)
+		{
+			return finish([=](lua_State* l) mutable { return util::push_args(l, true, args...); });
+		}
+		//! raise error with message in the awaiting task
+		bool fail(std::string message)
+		{
+			return finish([message](lua_State* l) mutable { return util::push_args(l, false, message); });
+		}
+
+		bool valid()const { return queue_ != nullptr; }
+		size_t id()const { return state_ ? state_->id : 0; }
+		//! identity of Scheduler
+		const void* owner()const { return queue_.get(); }
+	private:
+		friend class Scheduler;
+		friend struct lua_type_traits<Completion>;
+		Completion(const std::shared_ptr<scheduler_detail::CompletionQueue>& queue, size_t id)
+			:queue_(queue), state_(std::make_shared<scheduler_detail::CompletionState>(id)) {}
+
+		bool finish(scheduler_detail::ResultPusher pusher)
+		{
+			if (!queue_) { return false; }
+			{
+				std::lock_guard<std::mutex> lock(queue_->mutex);
+				if (state_->done) { return false; }
+				state_->done = true;
+				state_->result = std::move(pusher);
+				queue_->completed.push_back(state_->id);
+			}
+			queue_->completed_cv.notify_all();
+			return true;
+		}
+
+		std::shared_ptr<scheduler_detail::CompletionQueue> queue_;
+		std::shared_ptr<scheduler_detail::CompletionState> state_;
+	};
+
+	template<>	struct lua_type_traits<Completion>
+	{
+		typedef Completion push_type;
+
+		static int push(lua_State* l, const Completion& completion)
+		{
+			scheduler_detail::CompletionKey* key = new(lua_newuserdata(l, sizeof(scheduler_detail::CompletionKey))) scheduler_detail::CompletionKey();
+			key->owner = completion.owner();
+			key->state = completion.state_;
+			if (luaL_newmetatable(l, KAGUYA_SCHEDULER_COMPLETION_METATABLE))
+			{
+				lua_pushcfunction(l, &scheduler_detail::completion_key_gc);
+				lua_setfield(l, -2, "__gc");
+			}
+			lua_setmetatable(l, -2);
+			return 1;
+		}
+	};
+	template<>	struct lua_type_traits<const Completion&> :lua_type_traits<Completion> {};
+
+	/**
+	* Cooperative scheduler of Lua coroutines in one State. Not thread safe except Completion.
+	* Tasks run in threads from State::coroutinePool() until they yield. A task yielding a Completion sleeps until it is completed,
+	* other yields put the task back to the end of the ready queue.
+	* install() sets Lua functions: await(completion), sleep(seconds), yield() and spawn(function).
+	* Asynchronous operations complete their Completion from the producer side(e.g. at the end of the worker job),
+	* so the scheduler is woken only by completed operations.
+	* Not included by kaguya.hpp. Include "kaguya/scheduler.hpp".
+	* @code
+	* kaguya::Scheduler scheduler(state);
+	* scheduler.install(state.globalTable());
+	* state["fetch"] = kaguya::function([&](int id) {
+	*   kaguya::Completion c = scheduler.completion();
+	*   thread_pool.post([c, id]() mutable { c.complete(load(id)); });
+	*   return c;
+	* });
+	* scheduler.spawn(state["session"], 1);//session calls local data = await(fetch(1))
+	* scheduler.run();
+	* @endcode
+	*/
+	class Scheduler
+	{
+	public:
+		typedef size_t TaskId;
+
+		explicit Scheduler(State& state) :state_(state.state()), queue_(std::make_shared<scheduler_detail::CompletionQueue>()), next_task_(1), next_completion_(1) {}
+		explicit Scheduler(lua_State* state) :state_(util::toMainThread(state)), queue_(std::make_shared<scheduler_detail::CompletionQueue>()), next_task_(1), next_completion_(1) {}
+
+		/**
+		* @brief create task calling f(args...) in new coroutine. task starts at next run
+		*/
+		template<typename... Args>
+		TaskId spawn(const LuaFunction& f, Args... args)
+		{
+			Task task(CoroutinePool::get(state_).acquire());
+			lua_State* co = task.thread.get<lua_State*>();
+			f.push(co);
+			task.nargs = util::push_args(co, args...);
+			TaskId id = next_task_++;
+			tasks_.insert(std::make_pair(id, std::move(task)));
+			ready_.push_back(id);
+			stats_.spawned_count++;
+			return id;
+		}
+
+		//! new completion for an operation completed by C++ code
+		Completion completion()
+		{
+			return Completion(queue_, next_completion_++);
+		}
+		//! completion completed after seconds
+		Completion sleep(double seconds)
+		{
+			Completion result = completion();
+			timers_.insert(std::make_pair(Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds)), result));
+			return result;
+		}
+		//! set await, sleep, yield and spawn functions to table
+		void install(LuaTable table)
+		{
+			LuaFunction functions = LuaFunction::loadstring(state_,
+				"local yield, error = coroutine.yield, error "
+				"local function resumed(ok, ...) if not ok then error((...), 0) end return ... end "
+				"return { await = function(completion) return resumed(yield(completion)) end, yield = function() yield() end }");
+			LuaTable functions_table = functions.call<LuaTable>();
+			table["await"] = functions_table["await"];
+			table["yield"] = functions_table["yield"];
+			table["sleep"] = kaguya::function([this](double seconds) { return sleep(seconds); });
+			table["spawn"] = kaguya::function([this](const LuaFunction& f) { return spawn(f); });
+		}
+
+		/**
+		* @brief dispatch completions and timers, then resume each ready task once. does not block.
+		* @return true if tasks remain
+		*/
+		bool runOnce()
+		{
+			fireTimers();
+			dispatchCompleted();
+			for (size_t count = ready_.size(); count > 0 && !ready_.empty(); --count)
+			{
+				TaskId id = ready_.front();
+				ready_.pop_front();
+				resume(id);
+			}
+			return !tasks_.empty();
+		}
+		/**
+		* @brief run until all tasks end. waits for timers and completions when no task is ready.
+		* If a task awaits a completion nobody completes, it never returns.
+		*/
+		void run()
+		{
+			while (runOnce())
+			{
+				if (!ready_.empty()) { continue; }
+				std::unique_lock<std::mutex> lock(queue_->mutex);
+				if (!queue_->completed.empty()) { continue; }
+				if (timers_.empty())
+				{
+					queue_->completed_cv.wait(lock, [this] { return !queue_->completed.empty(); });
+					continue;
+				}
+				queue_->completed_cv.wait_until(lock, timers_.begin()->first, [this] { return !queue_->completed.empty(); });
+			}
+		}
+
+		//! number of tasks not ended
+		size_t size()const { return tasks_.size(); }
+		//! number of tasks waiting for completion
+		size_t waitingCount()const { return waiting_.size(); }
+		SchedulerStats stats()const { return stats_; }
+	private:
+		typedef std::chrono::steady_clock Clock;
+		struct Task
+		{
+			explicit Task(const LuaThread& thread) :thread(thread), nargs(0) {}
+			LuaThread thread;
+			int nargs;
+		};
+
+		Scheduler(const Scheduler&);
+		Scheduler& operator=(const Scheduler&);
+
+		//! state of completion if index is Completion of this scheduler. otherwise null
+		scheduler_detail::CompletionState* completionState(lua_State* l, int index)const
+		{
+			if (lua_type(l, index) != LUA_TUSERDATA || !lua_getmetatable(l, index))
+			{
+				return 0;
+			}
+			luaL_getmetatable(l, KAGUYA_SCHEDULER_COMPLETION_METATABLE);
+			bool match = lua_rawequal(l, -1, -2) != 0;
+			lua_pop(l, 2);
+			if (!match) { return 0; }
+			const scheduler_detail::CompletionKey* key = static_cast<const scheduler_detail::CompletionKey*>(lua_touserdata(l, index));
+			return key->owner == queue_.get() ? key->state.get() : 0;
+		}
+		//! take result of completed state. empty if not completed or already taken
+		scheduler_detail::ResultPusher takeResult(scheduler_detail::CompletionState& state)
+		{
+			std::lock_guard<std::mutex> lock(queue_->mutex);
+			scheduler_detail::ResultPusher result;
+			result.swap(state.result);
+			return result;
+		}
+
+		void resume(TaskId id)
+		{
+			std::map<TaskId, Task>::iterator it = tasks_.find(id);
+			if (it == tasks_.end()) { return; }
+			lua_State* co = it->second.thread.get<lua_State*>();
+			int nargs = it->second.nargs;
+			it->second.nargs = 0;
+			stats_.resume_count++;
+			SamplingProfiler::attachUnhooked(co);//e.g. SamplingProfiler started after spawn
+			int status = util::lua_resume_compat(co, nargs);
+			if (status == LUA_YIELD)
+			{
+				scheduler_detail::CompletionState* completion = lua_gettop(co) > 0 ? completionState(co, 1) : 0;
+				if (!completion)
+				{
+					lua_settop(co, 0);
+					lua_pushboolean(co, 1);
+					it->second.nargs = 1;
+					ready_.push_back(id);
+					return;
+				}
+				scheduler_detail::ResultPusher early = takeResult(*completion);
+				if (early)
+				{
+					lua_settop(co, 0);
+					it->second.nargs = early(co);
+					ready_.push_back(id);
+				}
+				else
+				{
+					//userdata at 1 keeps the state alive while waiting
+					waiting_[completion->id] = std::make_pair(id, completion);
+					lua_settop(co, 1);
+				}
+				return;
+			}
+			LuaThread thread = it->second.thread;//keep message on the coroutine stack
+			tasks_.erase(it);
+			if (status != 0)
+			{
+				stats_.error_count++;
+				ErrorHandler::handle(status, co);
+			}
+			else
+			{
+				stats_.finished_count++;
+			}
+			CoroutinePool::get(state_).release(thread);
+		}
+
+		void dispatchCompleted()
+		{
+			std::deque<size_t> completed;
+			{
+				std::lock_guard<std::mutex> lock(queue_->mutex);
+				completed.swap(queue_->completed);
+			}
+			for (size_t i = 0; i < completed.size(); ++i)
+			{
+				//completed before awaited: result stays in the completion, freed with it if never awaited
+				std::map<size_t, std::pair<TaskId, scheduler_detail::CompletionState*> >::iterator waiting = waiting_.find(completed[i]);
+				if (waiting == waiting_.end()) { continue; }
+				std::map<TaskId, Task>::iterator task = tasks_.find(waiting->second.first);
+				scheduler_detail::ResultPusher result = takeResult(*waiting->second.second);
+				if (task != tasks_.end() && result)
+				{
+					lua_State* co = task->second.thread.get<lua_State*>();
+					lua_settop(co, 0);
+					task->second.nargs = result(co);
+					ready_.push_back(waiting->second.first);
+				}
+				waiting_.erase(waiting);
+			}
+		}
+		void fireTimers()
+		{
+			Clock::time_point now = Clock::now();
+			while (!timers_.empty() && timers_.begin()->first <= now)
+			{
+				timers_.begin()->second.complete();
+				timers_.erase(timers_.begin());
+			}
+		}
+
+		lua_State* state_;
+		std::shared_ptr<scheduler_detail::CompletionQueue> queue_;
+		TaskId next_task_;
+		size_t next_completion_;
+		std::map<TaskId, Task> tasks_;
+		std::deque<TaskId> ready_;
+		//! completion id to awaiting task
+		std::map<size_t, std::pair<TaskId, scheduler_detail::CompletionState*> > waiting_;
+		std::multimap<Clock::time_point, Completion> timers_;
+		SchedulerStats stats_;
+	};
+}
+#endif
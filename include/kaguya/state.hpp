@@ -12,6 +12,12 @@
 #include "kaguya/utility.hpp"
 #include "kaguya/metatable.hpp"
 #include "kaguya/error_handler.hpp"
+#include "kaguya/allocator.hpp"
+#include "kaguya/chunk_cache.hpp"
+#include "kaguya/chunk_reader.hpp"
+#include "kaguya/sampling_profiler.hpp"
+#include "kaguya/coroutine_pool.hpp"
+#include "kaguya/gc_telemetry.hpp"
 
 #include "kaguya/lua_ref_table.hpp"
 #include "kaguya/lua_ref_function.hpp"
@@ -23,8 +29,10 @@ namespace kaguya
 	inline LoadLibs NoLoadLib() { return LoadLibs(); };
 	class State
 	{
+		standard::shared_ptr<Allocator> allocator_;
 		lua_State *state_;
 		bool created_;
+		standard::shared_ptr<ChunkCache> chunk_cache_;
 
 		//non copyable
 		State(const State&);
@@ -34,9 +42,74 @@ namespace kaguya
 		{
 			std::cerr << message << std::endl;
 		}
+		//! same as luaL_newstate's panic function
+		static int panic(lua_State* state)
+		{
+			const char* message = lua_tostring(state, -1);
+			std::cerr << "PANIC: unprotected error in call to Lua API (" << (message ? message : "error object is not a string") << ")" << std::endl;
+			return 0;
+		}
+		static lua_State* newstate(Allocator* allocator)
+		{
+			lua_State* state = lua_newstate(&Allocator::lua_alloc, allocator);
+			if (state)
+			{
+				lua_atpanic(state, &panic);
+				allocator->attach(state);
+			}
+			return state;
+		}
+		static standard::shared_ptr<Allocator> allocatorOrDefault(const standard::shared_ptr<Allocator>& allocator)
+		{
+			return allocator ? allocator : standard::shared_ptr<Allocator>(new DefaultAllocator());
+		}
+		int loadFileChunk(const char* file)
+		{
+			return chunk_cache_ ? chunk_cache_->loadfile(state_, file) : luaL_loadfile(state_, file);
+		}
+		int loadStringChunk(const char* str)
+		{
+			return chunk_cache_ ? chunk_cache_->loadstring(state_, str) : luaL_loadstring(state_, str);
+		}
+		//! run loaded function at stack top with env
+		bool runLoaded(int status, const LuaTable& env)
+		{
+			if (status)
+			{
+				ErrorHandler::handle(status, state_);
+				return false;
+			}
+			if (!env.isNilref())
+			{//register _ENV
+				env.push();
+#if LUA_VERSION_NUM >= 502
+				lua_setupvalue(state_, -2, 1);
+#else
+				lua_setfenv(state_, -2);
+#endif
+			}
+			status = lua_pcall(state_, 0, LUA_MULTRET, 0);
+			if (status)
+			{
+				ErrorHandler::handle(status, state_);
+				return false;
+			}
+			return true;
+		}
+		//! return loaded function at stack top, or nil reference
+		LuaFunction loadedFunction(int status)
+		{
+			if (status)
+			{
+				ErrorHandler::handle(status, state_);
+				return LuaRef(state_);
+			}
+			return LuaFunction(state_, StackTop());
+		}
 		void init()
 		{
-			if (!ErrorHandler::instance().getHandler(state_))
+			const ErrorHandler::function_type* handler = ErrorHandler::findHandler(state_);
+			if (!handler || !*handler)
 			{
 				setErrorHandler(&stderror_out);
 			}
@@ -62,18 +135,41 @@ namespace kaguya
 		{
 			init();
 		}
+
+		/**
+		* @brief create Lua state with allocator and lua standard library
+		* @param allocator memory allocation policy. e.g. kaguya::PoolAllocator. null uses kaguya::DefaultAllocator
+		*/
+		explicit State(const standard::shared_ptr<Allocator>& allocator) :allocator_(allocatorOrDefault(allocator)), state_(newstate(allocator_.get())), created_(true)
+		{
+			init();
+			openlibs();
+		}
+		//! create Lua state with allocator and(or without) library
+		State(const standard::shared_ptr<Allocator>& allocator, const LoadLibs& libs) :allocator_(allocatorOrDefault(allocator)), state_(newstate(allocator_.get())), created_(true)
+		{
+			init();
+			openlibs(libs);
+		}
 		~State()
 		{
 			if (created_)
 			{
+				if (allocator_) { allocator_->detach(state_); }
 				lua_close(state_);
 			}
 		}
 
+		//! allocator of this state. null if created by luaL_newstate.
+		const standard::shared_ptr<Allocator>& allocator()const
+		{
+			return allocator_;
+		}
+
 		void setErrorHandler(standard::function<void(int statuscode, const char*message)> errorfunction)
 		{
 			util::ScopedSavedStack save(state_);
-			ErrorHandler::instance().registerHandler(state_, errorfunction);
+			ErrorHandler::registerHandler(state_, errorfunction);
 		}
 
 		//! load all lua standard library
@@ -110,11 +206,12 @@ namespace kaguya
 		//@{
 		LuaFunction loadfile(const std::string& file)
 		{
-			return LuaFunction::loadfile(state_, file);
+			return loadfile(file.c_str());
 		}
 		LuaFunction loadfile(const char* file)
 		{
-			return LuaFunction::loadfile(state_, file);
+			util::ScopedSavedStack save(state_);
+			return loadedFunction(loadFileChunk(file));
 		}
 		//@}
 
@@ -129,14 +226,45 @@ namespace kaguya
 		//@{
 		LuaFunction loadstring(const std::string& str)
 		{
-			return LuaFunction::loadstring(state_, str);
+			return loadstring(str.c_str());
 		}
 		LuaFunction loadstring(const char* str)
 		{
-			return LuaFunction::loadstring(state_, str);
+			util::ScopedSavedStack save(state_);
+			return loadedFunction(loadStringChunk(str));
 		}
 		//@}
 
+		/**
+		* @brief use compiled chunk cache for loadfile, loadstring, dofile and dostring.
+		* @param cache shared chunk cache. null disables cache
+		*/
+		void setChunkCache(const standard::shared_ptr<ChunkCache>& cache)
+		{
+			chunk_cache_ = cache;
+		}
+		const standard::shared_ptr<ChunkCache>& chunkCache()const
+		{
+			return chunk_cache_;
+		}
+
+		/**
+		* @brief sampling profiler of Lua code. created at first call and not running
+		*/
+		SamplingProfiler& samplingProfiler()
+		{
+			return SamplingProfiler::get(state_);
+		}
+#if KAGUYA_USE_BINDING_PROFILER
+		/**
+		* @brief profiler of bound functions and LuaRef::call. created at first call and not running
+		*/
+		BindingProfiler& bindingProfiler()
+		{
+			return BindingProfiler::get(state_);
+		}
+#endif
+
 		/**
 		* @name dofile
 		* @brief Loads and runs the given file.
@@ -152,32 +280,7 @@ namespace kaguya
 		bool dofile(const char* file, const LuaTable& env = LuaTable())
 		{
 			util::ScopedSavedStack save(state_);
-
-			int status = luaL_loadfile(state_, file);
-
-			if (status)
-			{
-				ErrorHandler::instance().handle(status, state_);
-				return false;
-			}
-
-			if (!env.isNilref())
-			{//register _ENV
-				env.push();
-#if LUA_VERSION_NUM >= 502
-				lua_setupvalue(state_, -2, 1);
-#else
-				lua_setfenv(state_, -2);
-#endif
-			}
-
-			status = lua_pcall(state_, 0, LUA_MULTRET, 0);
-			if (status)
-			{
-				ErrorHandler::instance().handle(status, state_);
-				return false;
-			}
-			return true;
+			return runLoaded(loadFileChunk(file), env);
 		}
 		//@}
 
@@ -191,29 +294,7 @@ namespace kaguya
 		bool dostring(const char* str, const LuaTable& env = LuaTable())
 		{
 			util::ScopedSavedStack save(state_);
-
-			int status = luaL_loadstring(state_, str);
-			if (status)
-			{
-				ErrorHandler::instance().handle(status, state_);
-				return false;
-			}
-			if (!env.isNilref())
-			{//register _ENV
-				env.push();
-#if LUA_VERSION_NUM >= 502
-				lua_setupvalue(state_, -2, 1);
-#else
-				lua_setfenv(state_, -2);
-#endif
-			}
-			status = lua_pcall(state_, 0, LUA_MULTRET, 0);
-			if (status)
-			{
-				ErrorHandler::instance().handle(status, state_);
-				return false;
-			}
-			return true;
+			return runLoaded(loadStringChunk(str), env);
 		}
 		bool dostring(const std::string& str, const LuaTable& env = LuaTable())
 		{
@@ -229,6 +310,68 @@ namespace kaguya
 		}
 		//@}
 
+		/**
+		* @name loadmappedfile
+		* @brief same as loadfile, but the file is read by memory mapped window and not buffered whole.
+		*  Chunk cache is not used.
+		* @param file file path of lua script
+		* @return reference of lua function
+		*/
+		//@{
+		LuaFunction loadmappedfile(const std::string& file)
+		{
+			return loadmappedfile(file.c_str());
+		}
+		LuaFunction loadmappedfile(const char* file)
+		{
+			util::ScopedSavedStack save(state_);
+			return loadedFunction(util::load_mapped_file(state_, file));
+		}
+		//@}
+
+		/**
+		* @name domappedfile
+		* @brief same as dofile, but the file is read by memory mapped window and not buffered whole.
+		* @param file file path of lua script
+		* @param env execute env table
+		* @return If there are no errors, returns true.Otherwise return false
+		*/
+		//@{
+		bool domappedfile(const std::string& file, const LuaTable& env = LuaTable())
+		{
+			return domappedfile(file.c_str(), env);
+		}
+		bool domappedfile(const char* file, const LuaTable& env = LuaTable())
+		{
+			util::ScopedSavedStack save(state_);
+			return runLoaded(util::load_mapped_file(state_, file), env);
+		}
+		//@}
+
+		/**
+		* @brief load chunk from streaming reader.
+		* @param reader chunk source. e.g. decompressor
+		* @param chunkname chunk name for error messages
+		* @return reference of lua function
+		*/
+		LuaFunction loadstream(ChunkReader& reader, const char* chunkname = "=stream")
+		{
+			util::ScopedSavedStack save(state_);
+			return loadedFunction(util::load_chunk(state_, reader, chunkname));
+		}
+		/**
+		* @brief load and run chunk from streaming reader.
+		* @param reader chunk source. e.g. decompressor
+		* @param chunkname chunk name for error messages
+		* @param env execute env table
+		* @return If there are no errors, returns true.Otherwise return false
+		*/
+		bool dostream(ChunkReader& reader, const char* chunkname = "=stream", const LuaTable& env = LuaTable())
+		{
+			util::ScopedSavedStack save(state_);
+			return runLoaded(util::load_chunk(state_, reader, chunkname), env);
+		}
+
 		//! return element reference from global table
 		TableKeyReference operator[](const std::string& str)
 		{
@@ -251,6 +394,30 @@ namespace kaguya
 			return TableKeyReference(state_, table_index, key_index, stack_top, NoTypeCheck());
 		}
 
+		//! return element reference from global table
+		TableKeyReference operator[](const Key& key)
+		{
+			int stack_top = lua_gettop(state_);
+			lua_type_traits<GlobalTable>::push(state_, GlobalTable());
+			key.push(state_);
+			int table_index = stack_top + 1;
+			int key_index = stack_top + 2;
+			return TableKeyReference(state_, table_index, key_index, stack_top, NoTypeCheck());
+		}
+
+		/**
+		* @brief return pre-interned key handle. Same string returns same registry slot.
+		* @param name key string
+		*/
+		Key key(const std::string& name)
+		{
+			return Key(state_, name);
+		}
+		Key key(const char* name)
+		{
+			return Key(state_, name);
+		}
+
 		//! return global table
 		LuaTable globalTable()
 		{
@@ -289,6 +456,14 @@ namespace kaguya
 			return LuaThread(state_);
 		}
 
+		/**
+		* @brief pool of Lua threads. created at first call
+		*/
+		CoroutinePool& coroutinePool()
+		{
+			return CoroutinePool::get(state_);
+		}
+
 		//push to Lua stack
 		template<typename T>
 		void pushToStack(T value)
@@ -310,14 +485,17 @@ namespace kaguya
 			*/
 			void collect()
 			{
+				size_t before = countBytes();
+				double start = GCTelemetry::now();
 				lua_gc(state_, LUA_GCCOLLECT, 0);
+				GCTelemetry::get(state_).record(GCTelemetry::now() - start, before, countBytes(), 0, true, true);
 			}
 			/** Performs an incremental step of garbage collection.
 			* @return If returns true,the step finished a collection cycle.
 			*/
 			bool step()
 			{
-				return lua_gc(state_, LUA_GCSTEP, 0) == 1;
+				return step(0);
 			}
 			/**
 			* Performs an incremental step of garbage collection.
@@ -325,7 +503,34 @@ namespace kaguya
 			*/
 			bool step(int size)
 			{
-				return lua_gc(state_, LUA_GCSTEP, size) == 1;
+				size_t before = countBytes();
+				double start = GCTelemetry::now();
+				bool cycle = lua_gc(state_, LUA_GCSTEP, size) == 1;
+				GCTelemetry::get(state_).record(GCTelemetry::now() - start, before, countBytes(), 1, false, cycle);
+				return cycle;
+			}
+			/**
+			* Performs incremental steps until microseconds elapsed or a collection cycle finished.
+			* Use in idle time of frame to spread collection cost.
+			* @param size passed to each step. see step(int)
+			* @return If returns true,a collection cycle finished.
+			*/
+			bool stepFor(double microseconds, int size = 0)
+			{
+				size_t before = countBytes();
+				double start = GCTelemetry::now();
+				double deadline = start + microseconds * 1000;
+				size_t steps = 0;
+				bool cycle = false;
+				double now = start;
+				do
+				{
+					cycle = lua_gc(state_, LUA_GCSTEP, size) == 1;
+					steps++;
+					now = GCTelemetry::now();
+				} while (!cycle && now < deadline);
+				GCTelemetry::get(state_).record(now - start, before, countBytes(), steps, false, cycle);
+				return cycle;
 			}
 			/**
 			* enable gc
@@ -340,15 +545,46 @@ namespace kaguya
 			* returns the total memory in use by Lua in Kbytes.
 			*/
 			int count()const { return lua_gc(state_, LUA_GCCOUNT, 0); }
+			/**
+			* returns the total memory in use by Lua in bytes.
+			*/
+			size_t countBytes()const
+			{
+				return size_t(lua_gc(state_, LUA_GCCOUNT, 0)) * 1024 + size_t(lua_gc(state_, LUA_GCCOUNTB, 0));
+			}
 
+			//! same as setpause
+			int steppause(int value) { return setpause(value); }
 			/**
 			* sets arg as the new value for the pause of the collector. Returns the previous value for pause.
 			*/
-			int steppause(int value) { return lua_gc(state_, LUA_GCSETPAUSE, value); }
+			int setpause(int value) { return lua_gc(state_, LUA_GCSETPAUSE, value); }
 			/**
 			*  sets arg as the new value for the step multiplier of the collector. Returns the previous value for step.
 			*/
 			int setstepmul(int value) { return lua_gc(state_, LUA_GCSETSTEPMUL, value); }
+#if LUA_VERSION_NUM >= 504
+			/**
+			* change collector to incremental mode. zero keeps current value.
+			* @return true if previous mode was generational
+			*/
+			bool incremental(int pause = 0, int stepmul = 0, int stepsize = 0)
+			{
+				return lua_gc(state_, LUA_GCINC, pause, stepmul, stepsize) == LUA_GCGEN;
+			}
+			/**
+			* change collector to generational mode. zero keeps current value.
+			* @return true if previous mode was generational
+			*/
+			bool generational(int minormul = 0, int majormul = 0)
+			{
+				return lua_gc(state_, LUA_GCGEN, minormul, majormul) == LUA_GCGEN;
+			}
+#endif
+
+			//! collection done by collect(), step() and stepFor() of this State
+			GCStats stats()const { return GCTelemetry::get(state_).stats(); }
+			void resetStats() { GCTelemetry::get(state_).reset(); }
 
 			/**
 			* enable gc
@@ -356,6 +592,7 @@ namespace kaguya
 			void enable()
 			{
 				lua_gc(state_, LUA_GCRESTART, 0);
+				notifyAllocator(true);
 			}
 
 			/**
@@ -364,6 +601,7 @@ namespace kaguya
 			void disable()
 			{
 				lua_gc(state_, LUA_GCSTOP, 0);
+				notifyAllocator(false);
 			}
 #if LUA_VERSION_NUM >= 502
 			/**
@@ -380,6 +618,14 @@ namespace kaguya
 #endif
 
 		private:
+			void notifyAllocator(bool running)
+			{
+				void* ud = 0;
+				if (lua_getallocf(state_, &ud) == &Allocator::lua_alloc)
+				{
+					static_cast<Allocator*>(ud)->collectorChanged(util::toMainThread(state_), running);
+				}
+			}
 			lua_State* state_;
 		};
 
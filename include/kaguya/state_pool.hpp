@@ -0,0 +1,436 @@
+// Copyright satoren
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <vector>
+#include <cassert>
+#include <ctime>
+
+#include "kaguya/config.hpp"
+#include "kaguya/state.hpp"
+
+#if KAGUYA_USE_CPP11
+#include <mutex>
+#include <chrono>
+#endif
+
+#define KAGUYA_STATE_POOL_SNAPSHOT "kaguya_state_pool_snapshot"
+
+namespace kaguya
+{
+	//! statistics of StatePool
+	struct StatePoolStats
+	{
+		StatePoolStats() :acquire_count(0), hit_count(0), created_count(0), reset_count(0), reset_failure_count(0), overflow_count(0), total_reset_seconds(0), max_reset_seconds(0) {}
+
+		size_t acquire_count;
+		//! acquired warm state
+		size_t hit_count;
+		size_t created_count;
+		size_t reset_count;
+		//! snapshot restore raised error(e.g. error in __gc metamethod). the State was closed instead of pooled
+		size_t reset_failure_count;
+		//! released while the pool already kept its size of idle States. the State was closed
+		size_t overflow_count;
+		double total_reset_seconds;
+		double max_reset_seconds;
+
+		double hitRate()const
+		{
+			return acquire_count ? double(hit_count) / double(acquire_count) : 0;
+		}
+		double averageResetSeconds()const
+		{
+			return reset_count ? total_reset_seconds / double(reset_count) : 0;
+		}
+	};
+
+	/**
+	* Pool of pre-initialized States for per-request script execution.
+	* States are created and passed to the initializer(bind classes and functions) in advance,
+	* leased by acquire(), and reset when the lease is released.
+	* With C++11, acquire and release are thread safe. A leased State must be used from one thread at a time.
+	* @code
+	* kaguya::StatePool pool(8, &bind_application);
+	* {
+	*   kaguya::StatePool::Lease state = pool.acquire();
+	*   (*state)("run_request()");
+	* }//returned to pool and reset
+	* @endcode
+	*/
+	class StatePool
+	{
+	public:
+		typedef standard::function<void(State&)> Initializer;
+
+		enum ResetMode
+		{
+			/**
+			* restore snapshot taken after initializer. Global table, tables directly stored in the global table(libraries, classes)
+			* and their metatables are restored to snapshot fields and metatables, then a full garbage collection runs.
+			* Deeper modification(e.g. package.loaded entries) is not restored.
+			* Restore runs in protected mode. If it fails, the State is closed and not returned to pool.
+			*/
+			RESET_SNAPSHOT,
+			//! close returned State. New State is created and initialized lazily by acquire() or refill().
+			RESET_RECREATE
+		};
+
+		/**
+		* RAII lease of pooled State. Returned to pool on destruction.
+		* Copy transfers the lease.
+		*/
+		class Lease
+		{
+		public:
+			Lease() :pool_(0), state_(0) {}
+			Lease(const Lease& src) :pool_(src.pool_), state_(src.state_)
+			{
+				src.state_ = 0;
+			}
+			Lease& operator=(const Lease& src)
+			{
+				if (this != &src)
+				{
+					release();
+					pool_ = src.pool_;
+					state_ = src.state_;
+					src.state_ = 0;
+				}
+				return *this;
+			}
+			~Lease()
+			{
+				release();
+			}
+
+			State& operator*()const { return *state_; }
+			State* operator->()const { return state_; }
+			State* get()const { return state_; }
+			bool valid()const { return state_ != 0; }
+
+			//! return State to pool
+			void release()
+			{
+				if (state_)
+				{
+					pool_->release(state_);
+					state_ = 0;
+				}
+			}
+		private:
+			friend class StatePool;
+			Lease(StatePool* pool, State* state) :pool_(pool), state_(state) {}
+
+			StatePool* pool_;
+			mutable State* state_;
+		};
+
+		/**
+		* @param size number of pre-warmed States
+		* @param initializer called once for each new State
+		* @param mode reset mode on release
+		*/
+		StatePool(size_t size, Initializer initializer, ResetMode mode = RESET_SNAPSHOT)
+			:initializer_(initializer), mode_(mode), capacity_(size), leased_(0), creating_(0)
+		{
+			for (size_t i = 0; i < size; ++i)
+			{
+				idle_.push_back(create());
+			}
+		}
+		~StatePool()
+		{
+			assert(leased_ == 0 && "StatePool destroyed with outstanding Lease");
+			for (std::vector<State*>::iterator it = idle_.begin(); it != idle_.end(); ++it)
+			{
+				delete *it;
+			}
+		}
+
+		/**
+		* @brief lease a State. if no warm State is available, new State is created.
+		* States created beyond the pool size are closed when released.
+		*/
+		Lease acquire()
+		{
+			{
+				Lock lock(mutex_);
+				stats_.acquire_count++;
+				leased_++;
+				if (!idle_.empty())
+				{
+					stats_.hit_count++;
+					State* state = idle_.back();
+					idle_.pop_back();
+					return Lease(this, state);
+				}
+			}
+			State* state = create();
+			return Lease(this, state);
+		}
+
+		/**
+		* @brief create States until the pool has its initial size of warm States.
+		* With RESET_RECREATE, call this from idle time(or other thread) to move State creation out of the request path.
+		*/
+		void refill()
+		{
+			for (;;)
+			{
+				{
+					Lock lock(mutex_);
+					if (idle_.size() + leased_ + creating_ >= capacity_) { return; }
+					creating_++;//reserve the slot for concurrent refill
+				}
+				State* state = 0;
+				try
+				{
+					state = create();
+				}
+				catch (...)
+				{
+					Lock lock(mutex_);
+					creating_--;
+					throw;
+				}
+				Lock lock(mutex_);
+				creating_--;
+				idle_.push_back(state);
+			}
+		}
+
+		size_t idleCount()const
+		{
+			Lock lock(mutex_);
+			return idle_.size();
+		}
+		StatePoolStats stats()const
+		{
+			Lock lock(mutex_);
+			return stats_;
+		}
+	private:
+#if KAGUYA_USE_CPP11
+		typedef std::mutex Mutex;
+		typedef std::lock_guard<std::mutex> Lock;
+		typedef std::chrono::steady_clock Clock;
+		static double elapsedSeconds(Clock::time_point start)
+		{
+			return std::chrono::duration<double>(Clock::now() - start).count();
+		}
+#else
+		struct Mutex {};
+		struct Lock { Lock(Mutex&) {} };
+		struct Clock
+		{
+			typedef std::clock_t time_point;
+			static time_point now() { return std::clock(); }
+		};
+		static double elapsedSeconds(Clock::time_point start)
+		{
+			return double(std::clock() - start) / CLOCKS_PER_SEC;
+		}
+#endif
+
+		StatePool(const StatePool&);
+		StatePool& operator=(const StatePool&);
+
+		State* create()
+		{
+			State* state = new State();
+			if (initializer_)
+			{
+				initializer_(*state);
+			}
+			if (mode_ == RESET_SNAPSHOT)
+			{
+				takeSnapshot(state->state());
+			}
+			Lock lock(mutex_);
+			stats_.created_count++;
+			return state;
+		}
+
+		bool full()const
+		{
+			return idle_.size() + creating_ >= capacity_;
+		}
+		void release(State* state)
+		{
+			bool overflow;
+			{
+				Lock lock(mutex_);
+				overflow = full();
+			}
+			if (overflow)
+			{
+				delete state;
+				Lock lock(mutex_);
+				leased_--;
+				stats_.overflow_count++;
+				return;
+			}
+			Clock::time_point start = Clock::now();
+			bool reuse = mode_ == RESET_SNAPSHOT;
+			bool failed = reuse && !restoreSnapshot(state->state());
+			if (!reuse || failed)
+			{
+				delete state;
+				state = 0;
+			}
+			double elapsed = elapsedSeconds(start);
+
+			{
+				Lock lock(mutex_);
+				leased_--;
+				stats_.reset_count++;
+				if (failed) { stats_.reset_failure_count++; }
+				stats_.total_reset_seconds += elapsed;
+				if (elapsed > stats_.max_reset_seconds) { stats_.max_reset_seconds = elapsed; }
+				if (!state) { return; }
+				overflow = full();//other release filled the pool while restoring
+				if (overflow) { stats_.overflow_count++; }
+				else { idle_.push_back(state); }
+			}
+			if (overflow) { delete state; }
+		}
+
+		//! snapshot table: {[table] = {fields = shallow copy, metatable = metatable or false}}
+		static void snapshotTable(lua_State* l, int snapshot, int table)
+		{
+			lua_pushvalue(l, table);
+			lua_createtable(l, 0, 2);
+			lua_newtable(l);
+			lua_pushnil(l);
+			while (lua_next(l, table) != 0)
+			{
+				lua_pushvalue(l, -2);
+				lua_insert(l, -2);
+				lua_rawset(l, -4);
+			}
+			lua_setfield(l, -2, "fields");
+			if (!lua_getmetatable(l, table))
+			{
+				lua_pushboolean(l, 0);
+			}
+			lua_setfield(l, -2, "metatable");
+			lua_rawset(l, snapshot);
+		}
+		//! snapshot table at index and its metatable, if not taken yet
+		static void snapshotOnce(lua_State* l, int snapshot, int table)
+		{
+			lua_pushvalue(l, table);
+			lua_rawget(l, snapshot);
+			bool taken = !lua_isnil(l, -1);
+			lua_pop(l, 1);
+			if (taken) { return; }
+			snapshotTable(l, snapshot, table);
+			if (lua_getmetatable(l, table))
+			{
+				snapshotOnce(l, snapshot, lua_gettop(l));
+				lua_pop(l, 1);
+			}
+		}
+		static void takeSnapshot(lua_State* l)
+		{
+			util::ScopedSavedStack save(l);
+			lua_newtable(l);
+			int snapshot = lua_gettop(l);
+			lua_type_traits<GlobalTable>::push(l, GlobalTable());
+			int global = lua_gettop(l);
+			snapshotOnce(l, snapshot, global);
+			lua_pushnil(l);
+			while (lua_next(l, global) != 0)
+			{
+				if (lua_istable(l, -1))
+				{
+					snapshotOnce(l, snapshot, lua_gettop(l));
+				}
+				lua_pop(l, 1);
+			}
+			lua_pushliteral(l, KAGUYA_STATE_POOL_SNAPSHOT);
+			lua_pushvalue(l, snapshot);
+			lua_rawset(l, LUA_REGISTRYINDEX);
+		}
+		//! return false if restore raised error
+		static bool restoreSnapshot(lua_State* l)
+		{
+			lua_settop(l, 0);
+#if LUA_VERSION_NUM >= 502
+			lua_pushcfunction(l, &restore_snapshot);
+			bool restored = lua_pcall(l, 0, 0, 0) == 0;
+#else
+			bool restored = lua_cpcall(l, &restore_snapshot, 0) == 0;
+#endif
+			lua_settop(l, 0);
+			return restored;
+		}
+		static int restore_snapshot(lua_State* l)
+		{
+			lua_settop(l, 0);
+			lua_pushliteral(l, KAGUYA_STATE_POOL_SNAPSHOT);
+			lua_rawget(l, LUA_REGISTRYINDEX);
+			int snapshot = lua_gettop(l);
+			lua_pushnil(l);
+			while (lua_next(l, snapshot) != 0)
+			{
+				int table = lua_gettop(l) - 1;
+				int entry = lua_gettop(l);
+				lua_getfield(l, entry, "fields");
+				int fields = lua_gettop(l);
+				//erase added fields. assigning nil to existing field is allowed during traversal
+				lua_pushnil(l);
+				while (lua_next(l, table) != 0)
+				{
+					lua_pop(l, 1);
+					lua_pushvalue(l, -1);
+					lua_rawget(l, fields);
+					bool exists = !lua_isnil(l, -1);
+					lua_pop(l, 1);
+					if (!exists)
+					{
+						lua_pushvalue(l, -1);
+						lua_pushnil(l);
+						lua_rawset(l, table);
+					}
+				}
+				lua_pushnil(l);
+				while (lua_next(l, fields) != 0)
+				{
+					lua_pushvalue(l, -2);
+					lua_insert(l, -2);
+					lua_rawset(l, table);
+				}
+				lua_getfield(l, entry, "metatable");
+				if (lua_istable(l, -1))
+				{
+					lua_setmetatable(l, table);
+				}
+				else
+				{
+					lua_pop(l, 1);
+					lua_pushnil(l);
+					lua_setmetatable(l, table);
+				}
+				lua_settop(l, table);
+			}
+			lua_settop(l, 0);
+			lua_gc(l, LUA_GCCOLLECT, 0);
+			return 0;
+		}
+
+		Initializer initializer_;
+		ResetMode mode_;
+		size_t capacity_;
+		size_t leased_;
+		//! States being created by refill
+		size_t creating_;
+		std::vector<State*> idle_;
+		StatePoolStats stats_;
+		mutable Mutex mutex_;
+	};
+}
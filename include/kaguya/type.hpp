@@ -42,7 +42,7 @@ namespace kaguya
 		typedef ObjectWrapper<typename traits::remove_const_and_reference<T>::type> wrapper_type;
 		void *storage = lua_newuserdata(l, sizeof(wrapper_type));
 		new(storage) wrapper_type(v);
-		class_userdata::setmetatable<T>(l);
+		class_userdata::set_object_metatable<T>(l);
 		return 1;
 	}
 	template<typename T, typename Enable>
@@ -51,7 +51,7 @@ namespace kaguya
 		typedef ObjectPointerWrapper<T> wrapper_type;
 		void *storage = lua_newuserdata(l, sizeof(wrapper_type));
 		new(storage) wrapper_type(&v);
-		class_userdata::setmetatable<T>(l);
+		class_userdata::set_object_metatable<T>(l);
 		return 1;
 	}
 
@@ -63,7 +63,7 @@ namespace kaguya
 		typedef ObjectWrapper<typename traits::remove_const_and_reference<T>::type> wrapper_type;
 		void *storage = lua_newuserdata(l, sizeof(wrapper_type));
 		new(storage) wrapper_type(std::forward<NCRT>(v));
-		class_userdata::setmetatable<T>(l);
+		class_userdata::set_object_metatable<T>(l);
 		return 1;
 	}
 #endif
@@ -114,7 +114,7 @@ namespace kaguya
 				typedef ObjectPointerWrapper<T> wrapper_type;
 				void *storage = lua_newuserdata(l, sizeof(wrapper_type));
 				new(storage) wrapper_type(&v);
-				class_userdata::setmetatable<T>(l);
+				class_userdata::set_object_metatable<T>(l);
 			}
 			return 1;
 		}
@@ -184,7 +184,7 @@ namespace kaguya
 				typedef ObjectPointerWrapper<T> wrapper_type;
 				void *storage = lua_newuserdata(l, sizeof(wrapper_type));
 				new(storage) wrapper_type(v);
-				class_userdata::setmetatable<T>(l);
+				class_userdata::set_object_metatable<T>(l);
 			}
 			return 1;
 		}
@@ -279,7 +279,7 @@ namespace kaguya
 			typedef ObjectSmartPointerWrapper<standard::shared_ptr<T> > wrapper_type;
 			void *storage = lua_newuserdata(l, sizeof(wrapper_type));
 			new(storage) wrapper_type(v);
-			class_userdata::setmetatable<T>(l);
+			class_userdata::set_object_metatable<T>(l);
 			return 1;
 		}
 	};
@@ -317,7 +317,7 @@ namespace kaguya
 			typedef ObjectSmartPointerWrapper<std::unique_ptr<T,Deleter> > wrapper_type;
 			void *storage = lua_newuserdata(l, sizeof(wrapper_type));
 			new(storage) wrapper_type(std::forward<push_type>(v));
-			class_userdata::setmetatable<T>(l);
+			class_userdata::set_object_metatable<T>(l);
 			return 1;
 		}
 	};
@@ -556,6 +556,74 @@ namespace kaguya
 		}
 	};
 
+#if KAGUYA_USE_STRING_VIEW
+	/**
+	* push only traits for std::string_view. string is copied to Lua.
+	* string_view can not be got from Lua value, except as parameter of bound function(see nativefunction::argument_holder).
+	*/
+	template<>	struct lua_type_traits<std::string_view> {
+		typedef std::string_view push_type;
+
+		static int push(lua_State* l, push_type s)
+		{
+			lua_pushlstring(l, s.data(), s.size());
+			return 1;
+		}
+	};
+#endif
+
+	namespace nativefunction
+	{
+		/**
+		* Fetch argument of bound function. Arguments stay on Lua stack until the function returns,
+		* so specialization can bind a reference parameter to the value in userdata instead of a copy.
+		*/
+		template<typename T>
+		struct argument_holder :lua_type_traits<T> {};
+		//! borrow shared_ptr in userdata. no reference count change
+		template<typename T>
+		struct argument_holder<const standard::shared_ptr<T>&> :lua_type_traits<const standard::shared_ptr<T>&>
+		{
+			static const standard::shared_ptr<T>& get(lua_State* l, int index)
+			{
+				if (lua_isnoneornil(l, index))
+				{
+					static const standard::shared_ptr<T> null;
+					return null;
+				}
+				const standard::shared_ptr<T>* pointer = get_const_pointer(l, index, types::typetag<standard::shared_ptr<T> >());
+				if (!pointer)
+				{
+					throw LuaTypeMismatch("type mismatch!!");
+				}
+				return *pointer;
+			}
+		};
+#if KAGUYA_USE_STRING_VIEW
+		//! view of Lua string argument. string is kept by Lua stack until the function returns
+		template<>
+		struct argument_holder<std::string_view>
+		{
+			typedef std::string_view get_type;
+
+			static bool strictCheckType(lua_State* l, int index)
+			{
+				return lua_type(l, index) == LUA_TSTRING;
+			}
+			static bool checkType(lua_State* l, int index)
+			{
+				return lua_isstring(l, index) != 0;
+			}
+			static get_type get(lua_State* l, int index)
+			{
+				size_t size = 0;
+				const char* buffer = lua_tolstring(l, index, &size);
+				return buffer ? std::string_view(buffer, size) : std::string_view();
+			}
+		};
+#endif
+	}
+
 #include "kaguya/gen/push_tuple.inl"
 
 	struct NewTable {
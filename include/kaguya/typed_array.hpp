@@ -0,0 +1,324 @@
+// Copyright satoren
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <sstream>
+
+#include "kaguya/config.hpp"
+#include "kaguya/utility.hpp"
+#include "kaguya/object.hpp"
+
+namespace kaguya
+{
+	/**
+	* View of contiguous C++ array. Pushed to Lua as userdata without copying elements.
+	* In Lua, elements are accessed by 1 origin index, `#` returns size, and methods size(), slice(first, last) and totable() are available.
+	* Borrowed view does not manage the buffer, and the buffer must outlive Lua references.
+	* Owned view shares buffer by reference count, and slices of owned view keep the buffer alive.
+	* If T is const, element assignment from Lua is error.
+	* @code
+	* std::vector<float> frame(1024);
+	* state["frame"] = kaguya::TypedArray<float>(&frame[0], frame.size());
+	* state("frame[1] = frame[2] * 2");
+	* @endcode
+	*/
+	template<typename T>
+	class TypedArray
+	{
+	public:
+		typedef T value_type;
+		typedef typename traits::remove_const<T>::type element_type;
+
+		TypedArray() :data_(0), size_(0) {}
+		//! borrowed view
+		TypedArray(T* data, size_t size) :data_(data), size_(size) {}
+		//! conversion to const element view
+		template<typename U>
+		TypedArray(const TypedArray<U>& src) :data_(src.data_), size_(src.size_), owner_(src.owner_) {}
+
+		//! owned view. copy elements
+		template<typename A>
+		static TypedArray copy(const std::vector<element_type, A>& src)
+		{
+			return copy(src.empty() ? 0 : &src[0], src.size());
+		}
+		//! owned view. copy elements
+		static TypedArray copy(const element_type* src, size_t size)
+		{
+			standard::shared_ptr<std::vector<element_type> > buffer(new std::vector<element_type>(src, src + size));
+			return TypedArray(buffer);
+		}
+		//! owned view. value initialized elements
+		static TypedArray create(size_t size)
+		{
+			standard::shared_ptr<std::vector<element_type> > buffer(new std::vector<element_type>(size));
+			return TypedArray(buffer);
+		}
+
+		T* data()const { return data_; }
+		size_t size()const { return size_; }
+		bool empty()const { return size_ == 0; }
+		bool owned()const { return owner_.get() != 0; }
+		T& operator[](size_t index)const { return data_[index]; }
+		T* begin()const { return data_; }
+		T* end()const { return data_ + size_; }
+
+		/**
+		* @brief sub view of [first, last). share buffer with this view.
+		*/
+		TypedArray slice(size_t first, size_t last)const
+		{
+			if (last > size_) { last = size_; }
+			if (first > last) { first = last; }
+			TypedArray result(data_ + first, last - first);
+			result.owner_ = owner_;
+			return result;
+		}
+	private:
+		template<typename U> friend class TypedArray;
+
+		explicit TypedArray(const standard::shared_ptr<std::vector<element_type> >& buffer)
+			:data_(buffer->empty() ? 0 : &(*buffer)[0]), size_(buffer->size()), owner_(buffer)
+		{
+		}
+
+		T* data_;
+		size_t size_;
+		standard::shared_ptr<void> owner_;
+	};
+
+	namespace typed_array
+	{
+		template<typename T>
+		TypedArray<T>* test_userdata(lua_State* l, int index)
+		{
+			return class_userdata::test_userdata<TypedArray<T> >(l, index);
+		}
+		template<typename T>
+		TypedArray<T>& check_userdata(lua_State* l, int index)
+		{
+			TypedArray<T>* array = test_userdata<T>(l, index);
+			if (!array)
+			{
+				util::traceBack(l, (std::string("typed array expected, got ") + luaL_typename(l, index)).c_str());
+				lua_error(l);
+			}
+			return *array;
+		}
+		//! 1 origin integer index, or 0 if not integer
+		inline lua_Number to_index(lua_State* l, int index)
+		{
+			if (lua_type(l, index) != LUA_TNUMBER) { return 0; }
+			lua_Number key = lua_tonumber(l, index);
+			return std::floor(key) == key ? key : 0;
+		}
+		inline int index_error(lua_State* l, lua_Number index, size_t size)
+		{
+			{//destroy stream before lua_error
+				std::ostringstream message;
+				message << "typed array index out of range:" << index << " size:" << size;
+				util::traceBack(l, message.str().c_str());
+			}
+			return lua_error(l);
+		}
+
+		/**
+		* get view at index. const element view also accepts non const view.
+		* @return false if not typed array of T
+		*/
+		template<typename T>
+		bool get_view(lua_State* l, int index, TypedArray<T>* out)
+		{
+			typedef typename TypedArray<T>::element_type element_type;
+			if (TypedArray<T>* array = test_userdata<T>(l, index))
+			{
+				if (out) { *out = *array; }
+				return true;
+			}
+			if (traits::is_const<T>::value)
+			{
+				if (TypedArray<element_type>* array = test_userdata<element_type>(l, index))
+				{
+					if (out) { *out = TypedArray<T>(*array); }
+					return true;
+				}
+			}
+			return false;
+		}
+
+		template<typename T>
+		int push_view(lua_State* l, const TypedArray<T>& array);
+
+		template<typename T>
+		struct metamethods
+		{
+			typedef typename TypedArray<T>::element_type element_type;
+
+			//! upvalue 1 is method table
+			static int index(lua_State* l)
+			{
+				TypedArray<T>& array = check_userdata<T>(l, 1);
+				lua_Number key = to_index(l, 2);
+				if (key != 0)
+				{
+					if (key < 1 || key > static_cast<lua_Number>(array.size()))
+					{
+						lua_pushnil(l);
+						return 1;
+					}
+					return lua_type_traits<element_type>::push(l, array[static_cast<size_t>(key) - 1]);
+				}
+				lua_pushvalue(l, 2);
+				lua_rawget(l, lua_upvalueindex(1));
+				return 1;
+			}
+			static int newindex(lua_State* l)
+			{
+				TypedArray<T>& array = check_userdata<T>(l, 1);
+				if (traits::is_const<T>::value)
+				{
+					util::traceBack(l, "typed array is read only");
+					return lua_error(l);
+				}
+				lua_Number key = to_index(l, 2);
+				if (key < 1 || key > static_cast<lua_Number>(array.size()))
+				{
+					return index_error(l, key, array.size());
+				}
+				if (!lua_type_traits<element_type>::checkType(l, 3))
+				{
+					util::traceBack(l, (std::string("typed array element type mismatch:") + luaL_typename(l, 3)).c_str());
+					return lua_error(l);
+				}
+				const_cast<element_type&>(array[static_cast<size_t>(key) - 1]) = lua_type_traits<element_type>::get(l, 3);
+				return 0;
+			}
+			static int len(lua_State* l)
+			{
+#if LUA_VERSION_NUM >= 503
+				lua_pushinteger(l, static_cast<lua_Integer>(check_userdata<T>(l, 1).size()));
+#else
+				lua_pushnumber(l, static_cast<lua_Number>(check_userdata<T>(l, 1).size()));
+#endif
+				return 1;
+			}
+			static int gc(lua_State* l)
+			{
+				TypedArray<T>* array = test_userdata<T>(l, 1);
+				if (array)
+				{
+					array->~TypedArray<T>();
+				}
+				return 0;
+			}
+			static int size(lua_State* l)
+			{
+				return len(l);
+			}
+			//! slice(first [, last]). 1 origin and inclusive like string.sub
+			static int slice(lua_State* l)
+			{
+				TypedArray<T>& array = check_userdata<T>(l, 1);
+				lua_Number first = to_index(l, 2);
+				lua_Number last = lua_isnoneornil(l, 3) ? static_cast<lua_Number>(array.size()) : to_index(l, 3);
+				if (first < 1 || first > static_cast<lua_Number>(array.size()) + 1)
+				{
+					return index_error(l, first, array.size());
+				}
+				if (last < first - 1 || last > static_cast<lua_Number>(array.size()))
+				{
+					return index_error(l, last, array.size());
+				}
+				return push_view(l, array.slice(static_cast<size_t>(first) - 1, static_cast<size_t>(last)));
+			}
+			static int totable(lua_State* l)
+			{
+				TypedArray<T>& array = check_userdata<T>(l, 1);
+				lua_createtable(l, static_cast<int>(array.size()), 0);
+				for (size_t i = 0; i < array.size(); ++i)
+				{
+					lua_type_traits<element_type>::push(l, array[i]);
+					lua_rawseti(l, -2, static_cast<int>(i + 1));
+				}
+				return 1;
+			}
+			static int tostring(lua_State* l)
+			{
+				TypedArray<T>& array = check_userdata<T>(l, 1);
+				std::ostringstream os;
+				os << "TypedArray(" << array.size() << ")";
+				lua_pushstring(l, os.str().c_str());
+				return 1;
+			}
+		};
+
+		//! metatable is created once per lua_State
+		template<typename T>
+		void setmetatable(lua_State* l)
+		{
+			if (class_userdata::newmetatable<TypedArray<T> >(l))
+			{
+				lua_createtable(l, 0, 3);
+				lua_pushcclosure(l, &metamethods<T>::size, 0);
+				lua_setfield(l, -2, "size");
+				lua_pushcclosure(l, &metamethods<T>::slice, 0);
+				lua_setfield(l, -2, "slice");
+				lua_pushcclosure(l, &metamethods<T>::totable, 0);
+				lua_setfield(l, -2, "totable");
+				lua_pushcclosure(l, &metamethods<T>::index, 1);
+				lua_setfield(l, -2, "__index");
+				lua_pushcclosure(l, &metamethods<T>::newindex, 0);
+				lua_setfield(l, -2, "__newindex");
+				lua_pushcclosure(l, &metamethods<T>::len, 0);
+				lua_setfield(l, -2, "__len");
+				lua_pushcclosure(l, &metamethods<T>::gc, 0);
+				lua_setfield(l, -2, "__gc");
+				lua_pushcclosure(l, &metamethods<T>::tostring, 0);
+				lua_setfield(l, -2, "__tostring");
+			}
+			lua_setmetatable(l, -2);
+		}
+
+		template<typename T>
+		int push_view(lua_State* l, const TypedArray<T>& array)
+		{
+			void* storage = lua_newuserdata(l, sizeof(TypedArray<T>));
+			new(storage) TypedArray<T>(array);
+			setmetatable<T>(l);
+			return 1;
+		}
+	}
+
+	template<typename T>
+	struct lua_type_traits<TypedArray<T> >
+	{
+		typedef TypedArray<T> get_type;
+		typedef const TypedArray<T>& push_type;
+
+		static bool checkType(lua_State* l, int index)
+		{
+			return typed_array::get_view<T>(l, index, 0);
+		}
+		static bool strictCheckType(lua_State* l, int index)
+		{
+			return checkType(l, index);
+		}
+		static get_type get(lua_State* l, int index)
+		{
+			get_type result;
+			typed_array::get_view<T>(l, index, &result);
+			return result;
+		}
+		static int push(lua_State* l, push_type v)
+		{
+			return typed_array::push_view(l, v);
+		}
+	};
+	template<typename T> struct lua_type_traits<const TypedArray<T>&> :lua_type_traits<TypedArray<T> > {};
+}
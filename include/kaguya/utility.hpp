@@ -4,6 +4,10 @@
 // http://www.boost.org/LICENSE_1_0.txt)
 #pragma once
 
+#include <string>
+#include <map>
+#include <set>
+
 #include "kaguya/config.hpp"
 #include "kaguya/type.hpp"
 
@@ -118,6 +122,24 @@ namespace kaguya
 			ScopedSavedStack & operator=(ScopedSavedStack const &);
 		};
 
+		//! return main thread of state. (Lua5.1 returns argument state)
+		inline lua_State* toMainThread(lua_State* state)
+		{
+#if LUA_VERSION_NUM >= 502
+			if (state)
+			{
+				lua_rawgeti(state, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+				lua_State* mainthread = lua_tothread(state, -1);
+				lua_pop(state, 1);
+				if (mainthread)
+				{
+					return mainthread;
+				}
+			}
+#endif
+			return state;
+		}
+
 		inline std::string argmentTypes(lua_State *state)
 		{
 			int top = lua_gettop(state);
@@ -194,6 +216,99 @@ namespace kaguya
 			return lua_resume(L, nargs);
 #endif
 		}
+
+		//! lua_load. mode("b", "t" or "bt") is ignored in Lua5.1
+		inline int lua_load_compat(lua_State *L, lua_Reader reader, void* data, const char* chunkname, const char* mode)
+		{
+#if LUA_VERSION_NUM >= 502
+			return lua_load(L, reader, data, chunkname, mode);
+#else
+			return lua_load(L, reader, data, chunkname);
+#endif
+		}
+		//! lua_dump. strip is ignored before Lua5.3
+		inline int lua_dump_compat(lua_State *L, lua_Writer writer, void* data, bool strip)
+		{
+#if LUA_VERSION_NUM >= 503
+			return lua_dump(L, writer, data, strip ? 1 : 0);
+#else
+			return lua_dump(L, writer, data);
+#endif
+		}
+
+		//! keep shorter name if the function is reachable by several names
+		inline void add_function_name(std::map<const void*, std::string>& names, const void* address, const std::string& name)
+		{
+			std::map<const void*, std::string>::iterator it = names.find(address);
+			if (it == names.end())
+			{
+				names.insert(std::make_pair(address, name));
+			}
+			else if (name.size() < it->second.size())
+			{
+				it->second = name;
+			}
+		}
+		inline void collect_table_function_names(lua_State* l, int table, const std::string& prefix, int depth,
+			std::set<const void*>& visited, std::map<const void*, std::string>& names)
+		{
+			if (depth <= 0 || !visited.insert(lua_topointer(l, table)).second || !lua_checkstack(l, 4))
+			{
+				return;
+			}
+			lua_pushnil(l);
+			while (lua_next(l, table))
+			{
+				int value = lua_gettop(l);
+				if (lua_type(l, -2) == LUA_TSTRING)
+				{
+					std::string key = lua_tostring(l, -2);
+					std::string name = prefix.empty() ? key : prefix + "." + key;
+					if (lua_type(l, value) == LUA_TFUNCTION)
+					{
+						add_function_name(names, lua_topointer(l, value), name);
+						for (int i = 1; lua_iscfunction(l, value) && lua_getupvalue(l, value, i); ++i)
+						{
+							if (lua_type(l, -1) == LUA_TUSERDATA)
+							{
+								add_function_name(names, lua_touserdata(l, -1), name);
+							}
+							else if (lua_istable(l, -1))
+							{
+								collect_table_function_names(l, lua_gettop(l), prefix, depth - 1, visited, names);
+							}
+							lua_pop(l, 1);
+						}
+					}
+					else if (lua_istable(l, value))
+					{
+						bool metafield = key.compare(0, 2, "__") == 0;
+						collect_table_function_names(l, value, metafield ? prefix : name, depth - 1, visited, names);
+					}
+				}
+				lua_settop(l, value - 1);
+			}
+		}
+		/**
+		* @brief collect names of functions reachable from global table.
+		* Keys are function addresses(lua_topointer) and userdata upvalues of C closures,
+		* so bound C++ functions are resolved from the storage of the bound object(e.g. each overload).
+		* Class methods behind __index are named by the class table.
+		* @param depth maximum nesting of tables
+		*/
+		inline std::map<const void*, std::string> registered_function_names(lua_State* l, int depth = 3)
+		{
+			std::map<const void*, std::string> names;
+			std::set<const void*> visited;
+			util::ScopedSavedStack save(l);
+#if LUA_VERSION_NUM >= 502
+			lua_pushglobaltable(l);
+#else
+			lua_pushvalue(l, LUA_GLOBALSINDEX);
+#endif
+			collect_table_function_names(l, lua_gettop(l), std::string(), depth, visited, names);
+			return names;
+		}
 #if KAGUYA_USE_CPP11
 		inline int push_args(lua_State *l)
 		{
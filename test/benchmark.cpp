@@ -1,46 +1,194 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
 #include "kaguya/kaguya.hpp"
 
 #include "benchmark_function.hpp"
 
 
+typedef std::vector<std::pair<std::string, benchmark::function_t> > benchmark_function_map_t;
 
-typedef void(*benchmark_function_t)(kaguya::State&);
-typedef std::vector<std::pair<std::string, benchmark_function_t> > benchmark_function_map_t;
-void empty(kaguya::State&)
+struct benchmark_options
+{
+	benchmark_options() :format("text"), samples(50), warmup(5), min_sample_ms(2) {}
+
+	//! text, json or csv
+	std::string format;
+	//! run benchmarks whose name contains filter
+	std::string filter;
+	int samples;
+	int warmup;
+	//! iterations per sample are calibrated to take at least this time
+	double min_sample_ms;
+};
+
+//! nanoseconds per operation
+struct benchmark_result
 {
+	std::string name;
+	size_t iterations;
+	size_t samples;
+	double median;
+	double p95;
+	double p99;
+	double mean;
+	double stddev;
+	double min;
+	double max;
+};
+
+void throw_error_handler(int status, const char* message)
+{
+	throw std::runtime_error(message ? message : "unknown error");
+}
 
+//! run one sample with fresh State. State construction is not timed.
+double run_sample(benchmark::function_t function, size_t iterations)
+{
+	kaguya::State state;
+	state.setErrorHandler(&throw_error_handler);
+	benchmark::Context context(iterations);
+	function(state, context);
+	return context.elapsedNanoseconds();
 }
 
-void execute_benchmark(const benchmark_function_map_t& testmap)
+//! nearest rank percentile of sorted values
+double percentile(const std::vector<double>& sorted, double p)
 {
-	for (benchmark_function_map_t::const_iterator it = testmap.begin(); it != testmap.end(); ++it)
-	{
-		const std::string& test_name = it->first;
+	size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
 
+benchmark_result run_benchmark(const std::string& name, benchmark::function_t function, const benchmark_options& options)
+{
+	const double min_sample_ns = options.min_sample_ms * 1e6;
+	size_t iterations = 1;
+	for (;;)
+	{
+		double elapsed = run_sample(function, iterations);
+		if (elapsed >= min_sample_ns || iterations >= (1u << 30)) { break; }
+		double scale = elapsed > 0 ? min_sample_ns * 1.2 / elapsed : 10;
+		iterations = static_cast<size_t>(iterations * std::max(2.0, std::min(10.0, scale)));
+	}
+	for (int i = 0; i < options.warmup; ++i)
+	{
+		run_sample(function, iterations);
+	}
 
-		double total_time = 0;
-		static const int N = 4;
-		for (int i = 0; i < N; ++i)
-		{
-			kaguya::State state;
-			double start = state["os"]["clock"]();
+	std::vector<double> per_op;
+	for (int i = 0; i < options.samples; ++i)
+	{
+		per_op.push_back(run_sample(function, iterations) / iterations);
+	}
+	std::sort(per_op.begin(), per_op.end());
+
+	benchmark_result result;
+	result.name = name;
+	result.iterations = iterations;
+	result.samples = per_op.size();
+	result.median = per_op.size() % 2 ? per_op[per_op.size() / 2] : (per_op[per_op.size() / 2 - 1] + per_op[per_op.size() / 2]) / 2;
+	result.p95 = percentile(per_op, 0.95);
+	result.p99 = percentile(per_op, 0.99);
+	result.min = per_op.front();
+	result.max = per_op.back();
+	double sum = 0;
+	for (size_t i = 0; i < per_op.size(); ++i) { sum += per_op[i]; }
+	result.mean = sum / per_op.size();
+	double variance = 0;
+	for (size_t i = 0; i < per_op.size(); ++i) { variance += (per_op[i] - result.mean) * (per_op[i] - result.mean); }
+	result.stddev = per_op.size() > 1 ? std::sqrt(variance / (per_op.size() - 1)) : 0;
+	return result;
+}
 
-			it->second(state);
+void print_header(const benchmark_options& options)
+{
+	if (options.format == "json")
+	{
+		std::cout << "{\"benchmarks\":[" << std::endl;
+	}
+	else if (options.format == "csv")
+	{
+		std::cout << "name,iterations,samples,median_ns,p95_ns,p99_ns,mean_ns,stddev_ns,min_ns,max_ns" << std::endl;
+	}
+}
+void print_result(const benchmark_result& r, const benchmark_options& options, bool first)
+{
+	if (options.format == "json")
+	{
+		std::cout << (first ? "" : ",\n") << "{\"name\":\"" << r.name << "\",\"iterations\":" << r.iterations << ",\"samples\":" << r.samples
+			<< ",\"median_ns\":" << r.median << ",\"p95_ns\":" << r.p95 << ",\"p99_ns\":" << r.p99
+			<< ",\"mean_ns\":" << r.mean << ",\"stddev_ns\":" << r.stddev << ",\"min_ns\":" << r.min << ",\"max_ns\":" << r.max << "}";
+	}
+	else if (options.format == "csv")
+	{
+		std::cout << r.name << "," << r.iterations << "," << r.samples << "," << r.median << "," << r.p95 << "," << r.p99
+			<< "," << r.mean << "," << r.stddev << "," << r.min << "," << r.max << std::endl;
+	}
+	else
+	{
+		std::cout << r.name << " median:" << r.median << "ns p95:" << r.p95 << "ns p99:" << r.p99 << "ns stddev:" << r.stddev
+			<< "ns (" << r.samples << " samples x " << r.iterations << " iterations)" << std::endl;
+	}
+}
+void print_footer(const benchmark_options& options)
+{
+	if (options.format == "json")
+	{
+		std::cout << "\n]}" << std::endl;
+	}
+}
 
-			double end = state["os"]["clock"]();
-			total_time += end - start;
+void execute_benchmark(const benchmark_function_map_t& functions, const benchmark_options& options)
+{
+	print_header(options);
+	bool first = true;
+	for (benchmark_function_map_t::const_iterator it = functions.begin(); it != functions.end(); ++it)
+	{
+		if (it->first.find(options.filter) == std::string::npos) { continue; }
+		try
+		{
+			print_result(run_benchmark(it->first, it->second, options), options, first);
+			first = false;
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << it->first << " failed:" << e.what() << std::endl;
 		}
-
-		std::cout << test_name << " average time:" << total_time/N << std::endl;
 	}
+	print_footer(options);
 }
 
+bool parse_option(const char* arg, const char* name, std::string& value)
+{
+	size_t length = std::strlen(name);
+	if (std::strncmp(arg, name, length) != 0 || arg[length] != '=') { return false; }
+	value = arg + length + 1;
+	return true;
+}
 
-int main()
+int main(int argc, const char* argv[])
 {
+	benchmark_options options;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string value;
+		if (parse_option(argv[i], "--format", value)) { options.format = value; }
+		else if (parse_option(argv[i], "--filter", value)) { options.filter = value; }
+		else if (parse_option(argv[i], "--samples", value)) { options.samples = std::max(1, std::atoi(value.c_str())); }
+		else if (parse_option(argv[i], "--warmup", value)) { options.warmup = std::max(0, std::atoi(value.c_str())); }
+		else if (parse_option(argv[i], "--min-sample-ms", value)) { options.min_sample_ms = std::atof(value.c_str()); }
+		else
+		{
+			std::cerr << "usage: benchmark [--format=text|json|csv] [--filter=name] [--samples=N] [--warmup=N] [--min-sample-ms=MS]" << std::endl;
+			return 1;
+		}
+	}
+
 	benchmark_function_map_t functionmap;
 #define ADD_BENCHMARK(function) functionmap.push_back(std::make_pair(#function,&function));
-	ADD_BENCHMARK(empty);
 	ADD_BENCHMARK(kaguya_api_benchmark______::simple_get_set);
 	ADD_BENCHMARK(kaguya_api_benchmark______::property_access);
 	ADD_BENCHMARK(kaguya_api_benchmark______::object_pointer_register_get_set);
@@ -54,9 +202,33 @@ int main()
 	ADD_BENCHMARK(kaguya_api_benchmark______::lua_table_bracket_operator_access);
 	ADD_BENCHMARK(kaguya_api_benchmark______::lua_table_bracket_operator_assign);
 	ADD_BENCHMARK(kaguya_api_benchmark______::lua_table_bracket_operator_get);
-	
-
-
-	execute_benchmark(functionmap);
-
+	ADD_BENCHMARK(kaguya_api_benchmark______::overload_dispatch<1>);
+	ADD_BENCHMARK(kaguya_api_benchmark______::overload_dispatch<4>);
+	ADD_BENCHMARK(kaguya_api_benchmark______::overload_dispatch<8>);
+	ADD_BENCHMARK(kaguya_api_benchmark______::inheritance_depth<0>);
+	ADD_BENCHMARK(kaguya_api_benchmark______::inheritance_depth<1>);
+	ADD_BENCHMARK(kaguya_api_benchmark______::inheritance_depth<3>);
+	ADD_BENCHMARK(kaguya_api_benchmark______::shared_ptr_argument);
+	ADD_BENCHMARK(kaguya_api_benchmark______::shared_ptr_const_ref_argument);
+	ADD_BENCHMARK(kaguya_api_benchmark______::intrusive_ptr_argument);
+	ADD_BENCHMARK(kaguya_api_benchmark______::vector_to_table<10>);
+	ADD_BENCHMARK(kaguya_api_benchmark______::vector_to_table<1000>);
+	ADD_BENCHMARK(kaguya_api_benchmark______::vector_to_table<100000>);
+	ADD_BENCHMARK(kaguya_api_benchmark______::table_to_vector<10>);
+	ADD_BENCHMARK(kaguya_api_benchmark______::table_to_vector<1000>);
+	ADD_BENCHMARK(kaguya_api_benchmark______::table_to_vector<100000>);
+	ADD_BENCHMARK(kaguya_api_benchmark______::map_to_table<10>);
+	ADD_BENCHMARK(kaguya_api_benchmark______::map_to_table<1000>);
+	ADD_BENCHMARK(kaguya_api_benchmark______::map_to_table<100000>);
+	ADD_BENCHMARK(kaguya_api_benchmark______::table_to_map<10>);
+	ADD_BENCHMARK(kaguya_api_benchmark______::table_to_map<1000>);
+	ADD_BENCHMARK(kaguya_api_benchmark______::table_to_map<100000>);
+	ADD_BENCHMARK(kaguya_api_benchmark______::coroutine_resume);
+	ADD_BENCHMARK(kaguya_api_benchmark______::string_argument_native_function);
+	ADD_BENCHMARK(kaguya_api_benchmark______::string_argument_lua_function);
+	ADD_BENCHMARK(kaguya_api_benchmark______::state_creation);
+	ADD_BENCHMARK(kaguya_api_benchmark______::state_creation_no_lib);
+#undef ADD_BENCHMARK
+
+	execute_benchmark(functionmap, options);
 }
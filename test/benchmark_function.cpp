@@ -1,4 +1,5 @@
 #include "kaguya/kaguya.hpp"
+#include "benchmark_function.hpp"
 
 namespace
 {
@@ -7,6 +8,15 @@ namespace
 	{
 		return arg;
 	}
+
+	//! chunk receives iterations as `...`
+	void time_lua_chunk(kaguya::State& state, benchmark::Context& context, const char* chunk)
+	{
+		kaguya::LuaFunction f = state.loadstring(chunk);
+		context.start();
+		f.call<void>(static_cast<int>(context.iterations()));
+		context.stop();
+	}
 }
 
 namespace kaguya_api_benchmark______
@@ -27,7 +37,7 @@ namespace kaguya_api_benchmark______
 	private:
 		double _i;
 	};
-	void simple_get_set(kaguya::State& state)
+	void simple_get_set(kaguya::State& state, benchmark::Context& context)
 	{
 		state["SetGet"].setClass(kaguya::ClassMetatable<SetGet>()
 			.addConstructor()
@@ -36,10 +46,10 @@ namespace kaguya_api_benchmark______
 			.addProperty("a", &SetGet::a)
 			);
 
-		state(
+		time_lua_chunk(state, context,
 			"local getset = SetGet.new()\n"
 			//"getset={set = function(self,v) self.i = v end,get=function(self) return self.i end}\n"
-			"local times = 1000000\n"
+			"local times = ...\n"
 			"for i=1,times do\n"
 			"getset:set(i)\n"
 			"if(getset:get() ~= i)then\n"
@@ -48,7 +58,7 @@ namespace kaguya_api_benchmark______
 			"end\n"
 			"");
 	}
-	void object_pointer_register_get_set(kaguya::State& state)
+	void object_pointer_register_get_set(kaguya::State& state, benchmark::Context& context)
 	{
 		state["SetGet"].setClass(kaguya::ClassMetatable<SetGet>()
 			.addConstructor()
@@ -58,8 +68,8 @@ namespace kaguya_api_benchmark______
 
 		SetGet getset;
 		state["getset"] = &getset;
-		state(
-			"local times = 1000000\n"
+		time_lua_chunk(state, context,
+			"local times = ...\n"
 			"for i=1,times do\n"
 			"getset:set(i)\n"
 			"if(getset:get() ~= i)then\n"
@@ -68,11 +78,11 @@ namespace kaguya_api_benchmark______
 			"end\n"
 			);
 	}
-	void call_native_function(kaguya::State& state)
+	void call_native_function(kaguya::State& state, benchmark::Context& context)
 	{
 		state["nativefun"] = &test_native_function;
-		state(
-			"local times = 1000000\n"
+		time_lua_chunk(state, context,
+			"local times = ...\n"
 			"for i=1,times do\n"
 			"local r = nativefun(i)\n"
 			"if(r ~= i)then\n"
@@ -81,73 +91,91 @@ namespace kaguya_api_benchmark______
 			"end\n"
 			);
 	}
-	void call_lua_function(kaguya::State& state)
+	void call_lua_function(kaguya::State& state, benchmark::Context& context)
 	{
 		state("lua_function=function(i)return i;end");
 
 		kaguya::LuaRef lua_function = state["lua_function"];
-		for (int i = 0; i < 1000000; i++)
+		int times = static_cast<int>(context.iterations());
+		context.start();
+		for (int i = 0; i < times; i++)
 		{
 			int r = lua_function.call<int>(i);
 			if (r != i) { throw std::logic_error(""); }
 		}
+		context.stop();
 	}
-	void call_lua_function_operator_functional(kaguya::State& state)
+	void call_lua_function_operator_functional(kaguya::State& state, benchmark::Context& context)
 	{
 		state("lua_function=function(i)return i;end");
 
 		kaguya::LuaRef lua_function = state["lua_function"];
-		for (int i = 0; i < 1000000; i++)
+		int times = static_cast<int>(context.iterations());
+		context.start();
+		for (int i = 0; i < times; i++)
 		{
 			int r = lua_function(i);
 			if (r != i) { throw std::logic_error(""); }
 		}
+		context.stop();
 	}
 	
-	void lua_table_access(kaguya::State& state)
+	void lua_table_access(kaguya::State& state, benchmark::Context& context)
 	{
 		state("lua_table={value=0}");
 		kaguya::LuaTable lua_table = state["lua_table"];
-		for (int i = 0; i < 1000000; i++)
+		int times = static_cast<int>(context.iterations());
+		context.start();
+		for (int i = 0; i < times; i++)
 		{
 			lua_table.setField("value", i);
 			int v = lua_table.getField<int>("value");
 			if (v != i) { throw std::logic_error(""); }
 		}
+		context.stop();
 	}
 
-	void lua_table_bracket_operator_access(kaguya::State& state)
+	void lua_table_bracket_operator_access(kaguya::State& state, benchmark::Context& context)
 	{
 		state("lua_table={value=0}");
 		kaguya::LuaTable lua_table = state["lua_table"];
-		for (int i = 0; i < 1000000; i++)
+		int times = static_cast<int>(context.iterations());
+		context.start();
+		for (int i = 0; i < times; i++)
 		{
 			lua_table["value"] = i;
 			int v = lua_table["value"];
 			if (v != i) { throw std::logic_error(""); }
 		}
+		context.stop();
 	}
-	void lua_table_bracket_operator_assign(kaguya::State& state)
+	void lua_table_bracket_operator_assign(kaguya::State& state, benchmark::Context& context)
 	{
 		state("lua_table={value=0}");
 		kaguya::LuaTable lua_table = state["lua_table"];
-		for (int i = 0; i < 1000000; i++)
+		int times = static_cast<int>(context.iterations());
+		context.start();
+		for (int i = 0; i < times; i++)
 		{
 			lua_table.setField("value",i);
 			int v = lua_table["value"];
 			if (v != i) { throw std::logic_error(""); }
 		}
+		context.stop();
 	}
-	void lua_table_bracket_operator_get(kaguya::State& state)
+	void lua_table_bracket_operator_get(kaguya::State& state, benchmark::Context& context)
 	{
 		state("lua_table={value=0}");
 		kaguya::LuaTable lua_table = state["lua_table"];
-		for (int i = 0; i < 1000000; i++)
+		int times = static_cast<int>(context.iterations());
+		context.start();
+		for (int i = 0; i < times; i++)
 		{
 			lua_table["value"] = i;
 			int v = lua_table.getField<int>("value");
 			if (v != i) { throw std::logic_error(""); }
 		}
+		context.stop();
 	}
 
 	struct Prop
@@ -156,17 +184,17 @@ namespace kaguya_api_benchmark______
 
 		double d;
 	};
-	void property_access(kaguya::State& state)
+	void property_access(kaguya::State& state, benchmark::Context& context)
 	{
 		state["Prop"].setClass(kaguya::ClassMetatable<Prop>()
 			.addConstructor()
 			.addProperty("d", &Prop::d)
 			);
 
-		state(
+		time_lua_chunk(state, context,
 			"local getset = Prop.new()\n"
 			//"getset={set = function(self,v) self.i = v end,get=function(self) return self.i end}\n"
-			"local times = 1000000\n"
+			"local times = ...\n"
 			"for i=1,times do\n"
 			"getset.d =i\n"
 			"if(getset.d ~= i)then\n"
@@ -175,6 +203,282 @@ namespace kaguya_api_benchmark______
 			"end\n"
 			"");
 	}
+
+	template<int N> struct OverloadTag {};
+	template<int N> int overload_target(const OverloadTag<N>*) { return N; }
+	template<int N> void register_overload_tag(kaguya::State& state)
+	{
+		state["OverloadTag" + kaguya::standard::to_string(N)].setClass(kaguya::ClassMetatable<OverloadTag<N> >()
+			.addConstructor());
+	}
+	kaguya::FunctorOverloadType overload_set(int size)
+	{
+		switch (size)
+		{
+		case 1:
+			return kaguya::overload(&overload_target<7>);
+		case 4:
+			return kaguya::overload(&overload_target<4>, &overload_target<5>, &overload_target<6>, &overload_target<7>);
+		default:
+			return kaguya::overload(&overload_target<0>, &overload_target<1>, &overload_target<2>, &overload_target<3>,
+				&overload_target<4>, &overload_target<5>, &overload_target<6>, &overload_target<7>);
+		}
+	}
+	template<int N> void overload_dispatch(kaguya::State& state, benchmark::Context& context)
+	{
+		register_overload_tag<0>(state);
+		register_overload_tag<1>(state);
+		register_overload_tag<2>(state);
+		register_overload_tag<3>(state);
+		register_overload_tag<4>(state);
+		register_overload_tag<5>(state);
+		register_overload_tag<6>(state);
+		register_overload_tag<7>(state);
+		state["overloaded"] = overload_set(N);
+		time_lua_chunk(state, context,
+			"local times = ...\n"
+			"local tag = OverloadTag7.new()\n"
+			"for i=1,times do\n"
+			"if(overloaded(tag) ~= 7)then\n"
+			"error('error')\n"
+			"end\n"
+			"end\n");
+	}
+	template void overload_dispatch<1>(kaguya::State& state, benchmark::Context& context);
+	template void overload_dispatch<4>(kaguya::State& state, benchmark::Context& context);
+	template void overload_dispatch<8>(kaguya::State& state, benchmark::Context& context);
+
+	template<int N> struct Level :Level<N - 1> {};
+	template<> struct Level<0>
+	{
+		Level() :value_(0) {}
+		int value()const { return value_; }
+		int value_;
+	};
+	template<int N> struct register_level
+	{
+		static void apply(kaguya::State& state)
+		{
+			register_level<N - 1>::apply(state);
+			state["Level" + kaguya::standard::to_string(N)].setClass(kaguya::ClassMetatable<Level<N>, Level<N - 1> >()
+				.addConstructor());
+		}
+	};
+	template<> struct register_level<0>
+	{
+		static void apply(kaguya::State& state)
+		{
+			state["Level0"].setClass(kaguya::ClassMetatable<Level<0> >()
+				.addConstructor()
+				.addMember("value", &Level<0>::value));
+		}
+	};
+	template<int N> void inheritance_depth(kaguya::State& state, benchmark::Context& context)
+	{
+		register_level<N>::apply(state);
+		state["object"] = kaguya::standard::shared_ptr<Level<N> >(new Level<N>());
+		time_lua_chunk(state, context,
+			"local times = ...\n"
+			"local object = object\n"
+			"for i=1,times do\n"
+			"if(object:value() ~= 0)then\n"
+			"error('error')\n"
+			"end\n"
+			"end\n");
+	}
+	template void inheritance_depth<0>(kaguya::State& state, benchmark::Context& context);
+	template void inheritance_depth<1>(kaguya::State& state, benchmark::Context& context);
+	template void inheritance_depth<3>(kaguya::State& state, benchmark::Context& context);
+
+	double shared_ptr_value(kaguya::standard::shared_ptr<SetGet> object)
+	{
+		return object->get();
+	}
+	double shared_ptr_const_ref_value(const kaguya::standard::shared_ptr<SetGet>& object)
+	{
+		return object->get();
+	}
+	void shared_ptr_argument(kaguya::State& state, benchmark::Context& context)
+	{
+		state["SetGet"].setClass(kaguya::ClassMetatable<SetGet>());
+		state["shared_object"] = kaguya::standard::shared_ptr<SetGet>(new SetGet());
+		state["shared_ptr_value"] = &shared_ptr_value;
+		time_lua_chunk(state, context,
+			"local times = ...\n"
+			"local object = shared_object\n"
+			"for i=1,times do\n"
+			"if(shared_ptr_value(object) ~= 0)then\n"
+			"error('error')\n"
+			"end\n"
+			"end\n");
+	}
+	void shared_ptr_const_ref_argument(kaguya::State& state, benchmark::Context& context)
+	{
+		state["SetGet"].setClass(kaguya::ClassMetatable<SetGet>());
+		state["shared_object"] = kaguya::standard::shared_ptr<SetGet>(new SetGet());
+		state["shared_ptr_value"] = &shared_ptr_const_ref_value;
+		time_lua_chunk(state, context,
+			"local times = ...\n"
+			"local object = shared_object\n"
+			"for i=1,times do\n"
+			"if(shared_ptr_value(object) ~= 0)then\n"
+			"error('error')\n"
+			"end\n"
+			"end\n");
+	}
+	struct RefCountedSetGet :SetGet, kaguya::RefCounted<RefCountedSetGet>
+	{
+	};
+	double intrusive_ptr_value(kaguya::IntrusivePtr<RefCountedSetGet> object)
+	{
+		return object->get();
+	}
+	void intrusive_ptr_argument(kaguya::State& state, benchmark::Context& context)
+	{
+		state["SetGet"].setClass(kaguya::ClassMetatable<RefCountedSetGet>());
+		state["intrusive_object"] = kaguya::IntrusivePtr<RefCountedSetGet>(new RefCountedSetGet());
+		state["intrusive_ptr_value"] = &intrusive_ptr_value;
+		time_lua_chunk(state, context,
+			"local times = ...\n"
+			"local object = intrusive_object\n"
+			"for i=1,times do\n"
+			"if(intrusive_ptr_value(object) ~= 0)then\n"
+			"error('error')\n"
+			"end\n"
+			"end\n");
+	}
+
+	std::vector<int> make_vector(int size)
+	{
+		std::vector<int> v(size);
+		for (int i = 0; i < size; ++i) { v[i] = i; }
+		return v;
+	}
+	std::map<std::string, int> make_map(int size)
+	{
+		std::map<std::string, int> m;
+		for (int i = 0; i < size; ++i) { m["key" + kaguya::standard::to_string(i)] = i; }
+		return m;
+	}
+	template<int N> void vector_to_table(kaguya::State& state, benchmark::Context& context)
+	{
+		std::vector<int> v = make_vector(N);
+		lua_State* l = state.state();
+		context.start();
+		for (size_t i = 0; i < context.iterations(); ++i)
+		{
+			kaguya::lua_type_traits<std::vector<int> >::push(l, v);
+			lua_pop(l, 1);
+		}
+		context.stop();
+	}
+	template<int N> void table_to_vector(kaguya::State& state, benchmark::Context& context)
+	{
+		kaguya::LuaRef table = state.newRef(make_vector(N));
+		context.start();
+		for (size_t i = 0; i < context.iterations(); ++i)
+		{
+			std::vector<int> v = table.get<std::vector<int> >();
+			if (static_cast<int>(v.size()) != N) { throw std::logic_error(""); }
+		}
+		context.stop();
+	}
+	template<int N> void map_to_table(kaguya::State& state, benchmark::Context& context)
+	{
+		std::map<std::string, int> m = make_map(N);
+		lua_State* l = state.state();
+		context.start();
+		for (size_t i = 0; i < context.iterations(); ++i)
+		{
+			kaguya::lua_type_traits<std::map<std::string, int> >::push(l, m);
+			lua_pop(l, 1);
+		}
+		context.stop();
+	}
+	template<int N> void table_to_map(kaguya::State& state, benchmark::Context& context)
+	{
+		kaguya::LuaRef table = state.newRef(make_map(N));
+		context.start();
+		for (size_t i = 0; i < context.iterations(); ++i)
+		{
+			std::map<std::string, int> m = table.get<std::map<std::string, int> >();
+			if (static_cast<int>(m.size()) != N) { throw std::logic_error(""); }
+		}
+		context.stop();
+	}
+#define KAGUYA_BENCHMARK_CONVERSION_SIZE(N) \
+	template void vector_to_table<N>(kaguya::State& state, benchmark::Context& context);\
+	template void table_to_vector<N>(kaguya::State& state, benchmark::Context& context);\
+	template void map_to_table<N>(kaguya::State& state, benchmark::Context& context);\
+	template void table_to_map<N>(kaguya::State& state, benchmark::Context& context);
+	KAGUYA_BENCHMARK_CONVERSION_SIZE(10)
+	KAGUYA_BENCHMARK_CONVERSION_SIZE(1000)
+	KAGUYA_BENCHMARK_CONVERSION_SIZE(100000)
+#undef KAGUYA_BENCHMARK_CONVERSION_SIZE
+
+	void coroutine_resume(kaguya::State& state, benchmark::Context& context)
+	{
+		state("generator = coroutine.create(function() local i = 0 while true do i = i + 1 coroutine.yield(i) end end)");
+		kaguya::LuaThread generator = state["generator"];
+		context.start();
+		for (size_t i = 0; i < context.iterations(); ++i)
+		{
+			int r = generator.resume<int>();
+			if (r != static_cast<int>(i + 1)) { throw std::logic_error(""); }
+		}
+		context.stop();
+	}
+
+	std::string string_concat(const std::string& a, const std::string& b)
+	{
+		return a + b;
+	}
+	void string_argument_native_function(kaguya::State& state, benchmark::Context& context)
+	{
+		state["string_concat"] = &string_concat;
+		time_lua_chunk(state, context,
+			"local times = ...\n"
+			"local a = string.rep('a', 64)\n"
+			"local b = string.rep('b', 64)\n"
+			"for i=1,times do\n"
+			"if(#string_concat(a, b) ~= 128)then\n"
+			"error('error')\n"
+			"end\n"
+			"end\n");
+	}
+	void string_argument_lua_function(kaguya::State& state, benchmark::Context& context)
+	{
+		state("lua_function=function(a, b)return a .. b;end");
+		kaguya::LuaFunction lua_function = state["lua_function"];
+		std::string a(64, 'a');
+		std::string b(64, 'b');
+		context.start();
+		for (size_t i = 0; i < context.iterations(); ++i)
+		{
+			std::string r = lua_function.call<std::string>(a, b);
+			if (r.size() != 128) { throw std::logic_error(""); }
+		}
+		context.stop();
+	}
+
+	void state_creation(kaguya::State&, benchmark::Context& context)
+	{
+		context.start();
+		for (size_t i = 0; i < context.iterations(); ++i)
+		{
+			kaguya::State state;
+		}
+		context.stop();
+	}
+	void state_creation_no_lib(kaguya::State&, benchmark::Context& context)
+	{
+		context.start();
+		for (size_t i = 0; i < context.iterations(); ++i)
+		{
+			kaguya::State state((kaguya::NoLoadLib()));
+		}
+		context.stop();
+	}
 }
 
 
@@ -187,14 +491,14 @@ namespace original_api_no_type_check
 		lua_pushnumber(L,result);
 		return 1;
 	}
-	void call_native_function(kaguya::State& state)
+	void call_native_function(kaguya::State& state, benchmark::Context& context)
 	{
 		lua_State* s = state.state();
 		lua_pushcclosure(s, static_native_function_binding, 0);  /* closure with those upvalues */
 		lua_setglobal(s,"nativefun");
 
-		state(
-			"local times = 1000000\n"
+		time_lua_chunk(state, context,
+			"local times = ...\n"
 			"for i=1,times do\n"
 			"local r = nativefun(i)\n"
 			"if(r ~= i)then\n"
@@ -203,13 +507,15 @@ namespace original_api_no_type_check
 			"end\n"
 			);
 	}
-	void call_lua_function(kaguya::State& state)
+	void call_lua_function(kaguya::State& state, benchmark::Context& context)
 	{
 		lua_State* s = state.state();
 		luaL_dostring(s,"lua_function=function(i)return i;end");
 		lua_getglobal(s, "lua_function");
 		int funref = luaL_ref(s, LUA_REGISTRYINDEX);
-		for (int i = 0; i < 1000000; i++)
+		int times = static_cast<int>(context.iterations());
+		context.start();
+		for (int i = 0; i < times; i++)
 		{
 			lua_rawgeti(s, LUA_REGISTRYINDEX, funref);
 			lua_pushnumber(s, i);
@@ -218,12 +524,15 @@ namespace original_api_no_type_check
 			if (r != i) { throw std::logic_error(""); }
 			lua_pop(s, 1);
 		}
+		context.stop();
 	}
-	void lua_table_access(kaguya::State& state)
+	void lua_table_access(kaguya::State& state, benchmark::Context& context)
 	{
 		lua_State* s = state.state();
 		luaL_dostring(s, "lua_table={value=0}");
-		for (int i = 0; i < 1000000; i++)
+		int times = static_cast<int>(context.iterations());
+		context.start();
+		for (int i = 0; i < times; i++)
 		{
 			lua_getglobal(s, "lua_table");
 			lua_pushnumber(s,i);
@@ -236,5 +545,6 @@ namespace original_api_no_type_check
 			if (v != i) { throw std::logic_error(""); }
 			lua_settop(s,0);
 		}
+		context.stop();
 	}
 }
\ No newline at end of file
@@ -1,25 +1,88 @@
 #pragma once
+
+#include <ctime>
+#include "kaguya/kaguya.hpp"
+
+#if KAGUYA_USE_CPP11
+#include <chrono>
+#endif
+
+namespace benchmark
+{
+	/**
+	* Timer of one sample. Scenario does setup with the given fresh State,
+	* then runs iterations() operations between start() and stop().
+	*/
+	class Context
+	{
+	public:
+		explicit Context(size_t iterations) :iterations_(iterations), start_(0), elapsed_(0) {}
+
+		size_t iterations()const { return iterations_; }
+		void start() { start_ = now(); }
+		void stop() { elapsed_ += now() - start_; }
+		double elapsedNanoseconds()const { return elapsed_; }
+	private:
+		static double now()
+		{
+#if KAGUYA_USE_CPP11
+			return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+			return double(std::clock()) * (1e9 / CLOCKS_PER_SEC);
+#endif
+		}
+		size_t iterations_;
+		double start_;
+		double elapsed_;
+	};
+
+	typedef void(*function_t)(kaguya::State&, Context&);
+}
+
 namespace kaguya_api_benchmark______
 {
+	void simple_get_set(kaguya::State& state, benchmark::Context& context);
+	void object_pointer_register_get_set(kaguya::State& state, benchmark::Context& context);
+
+	void call_native_function(kaguya::State& state, benchmark::Context& context);
+
+	void call_lua_function(kaguya::State& state, benchmark::Context& context);
+	void call_lua_function_operator_functional(kaguya::State& state, benchmark::Context& context);
+	void lua_table_access(kaguya::State& state, benchmark::Context& context);
+	void lua_table_bracket_operator_access(kaguya::State& state, benchmark::Context& context);
+	void lua_table_bracket_operator_assign(kaguya::State& state, benchmark::Context& context);
+	void lua_table_bracket_operator_get(kaguya::State& state, benchmark::Context& context);
+
+	void property_access(kaguya::State& state, benchmark::Context& context);
 
-	void simple_get_set(kaguya::State& state);
-	void object_pointer_register_get_set(kaguya::State& state);
+	//! call overloaded function. matched overload is the last of N
+	template<int N> void overload_dispatch(kaguya::State& state, benchmark::Context& context);
+	//! call base class member with object of N level derived class
+	template<int N> void inheritance_depth(kaguya::State& state, benchmark::Context& context);
 
-	void call_native_function(kaguya::State& state);
+	void shared_ptr_argument(kaguya::State& state, benchmark::Context& context);
+	void shared_ptr_const_ref_argument(kaguya::State& state, benchmark::Context& context);
+	void intrusive_ptr_argument(kaguya::State& state, benchmark::Context& context);
 
-	void call_lua_function(kaguya::State& state);
-	void call_lua_function_operator_functional(kaguya::State& state);
-	void lua_table_access(kaguya::State& state);
-	void lua_table_bracket_operator_access(kaguya::State& state);
-	void lua_table_bracket_operator_assign(kaguya::State& state);
-	void lua_table_bracket_operator_get(kaguya::State& state);
+	//! std::vector<int> of N elements
+	template<int N> void vector_to_table(kaguya::State& state, benchmark::Context& context);
+	template<int N> void table_to_vector(kaguya::State& state, benchmark::Context& context);
+	//! std::map<std::string, int> of N elements
+	template<int N> void map_to_table(kaguya::State& state, benchmark::Context& context);
+	template<int N> void table_to_map(kaguya::State& state, benchmark::Context& context);
 
-	void property_access(kaguya::State& state);
+	void coroutine_resume(kaguya::State& state, benchmark::Context& context);
+
+	void string_argument_native_function(kaguya::State& state, benchmark::Context& context);
+	void string_argument_lua_function(kaguya::State& state, benchmark::Context& context);
+
+	void state_creation(kaguya::State& state, benchmark::Context& context);
+	void state_creation_no_lib(kaguya::State& state, benchmark::Context& context);
 }
 
 namespace original_api_no_type_check
 {
-	void call_native_function(kaguya::State& state);
-	void call_lua_function(kaguya::State& state);
-	void lua_table_access(kaguya::State& state);
-}
\ No newline at end of file
+	void call_native_function(kaguya::State& state, benchmark::Context& context);
+	void call_lua_function(kaguya::State& state, benchmark::Context& context);
+	void lua_table_access(kaguya::State& state, benchmark::Context& context);
+}
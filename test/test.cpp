@@ -2,6 +2,8 @@
 #include <cassert>
 #include <sstream>
 #include "kaguya/kaguya.hpp"
+#include "kaguya/executor.hpp"
+#include "kaguya/scheduler.hpp"
 
 #ifdef _MSC_VER
 #define NOMINMAX // do not define min and max macros that conflict with standard lib
@@ -443,6 +445,38 @@ namespace t_02_classreg
 		TEST_EQUAL(derived.b , 2);
 	}
 
+	struct Derived2 :Derived
+	{
+		Derived2() :c(0) {};
+		int c;
+	};
+	void multi_level_derived_class(kaguya::State& state)
+	{
+		state["Base"].setClass(kaguya::ClassMetatable<Base>()
+			.addMember("a", &Base::a)
+			);
+		state["Derived"].setClass(kaguya::ClassMetatable<Derived, Base>()
+			.addMember("b", &Derived::b)
+			);
+		state["Derived2"].setClass(kaguya::ClassMetatable<Derived2, Derived>()
+			.addMember("c", &Derived2::c)
+			);
+
+		Derived2 derived2;
+		state["derived2"] = &derived2;
+		state["shared_derived2"] = kaguya::standard::shared_ptr<Derived2>(new Derived2());
+		state["base_function"] = &base_function;
+		state["derived_function"] = &derived_function;
+		TEST_CHECK(state("assert(1 == base_function(derived2))"));
+		TEST_CHECK(state("assert(2 == derived_function(derived2))"));
+		TEST_CHECK(state("assert(2 == derived_function(shared_derived2))"));
+		TEST_CHECK(state("assert(1 == derived2:a())"));
+		TEST_CHECK(state("assert(2 == derived2:b())"));
+		TEST_EQUAL(derived2.a, 1);
+		TEST_EQUAL(derived2.b, 2);
+
+	}
+
 	int receive_shared_ptr_function(kaguya::standard::shared_ptr<Derived> d) {
 		d->b = 5;
 		return d->b;
@@ -475,6 +509,70 @@ namespace t_02_classreg
 		TEST_EQUAL(derived->b , 5);
 	}
 
+	struct Entity :kaguya::RefCounted<Entity>
+	{
+		Entity(int i = 0) :id(i) { alive++; }
+		virtual ~Entity() { alive--; }
+		int id;
+		static int alive;
+	};
+	int Entity::alive = 0;
+	struct Player :Entity
+	{
+		Player() :Entity(7) {}
+	};
+	size_t entity_use_count(const Entity& e) { return e.useCount(); }
+	int entity_handle_id(kaguya::IntrusivePtr<Entity> e) { return e ? e->id : -1; }
+	kaguya::IntrusivePtr<Entity> keep_entity;
+	void keep_entity_handle(kaguya::IntrusivePtr<Entity> e) { keep_entity = e; }
+	void registering_intrusive_ptr(kaguya::State&)
+	{
+		{
+			kaguya::State state;
+			state["Entity"].setClass(kaguya::ClassMetatable<Entity>()
+				.addConstructor()
+				.addMember("id", &Entity::id)
+				);
+			state["Player"].setClass(kaguya::ClassMetatable<Player, Entity>());
+			state["entity_use_count"] = &entity_use_count;
+			state["entity_handle_id"] = &entity_handle_id;
+			state["keep_entity_handle"] = &keep_entity_handle;
+
+			kaguya::IntrusivePtr<Entity> entity(new Entity(3));
+			TEST_EQUAL(entity->useCount(), 1);
+			state["entity"] = entity;
+			TEST_EQUAL(entity->useCount(), 2);
+			TEST_CHECK(state("assert(entity_use_count(entity) == 2)"));
+			TEST_CHECK(state("assert(entity:id() == 3)"));
+			TEST_CHECK(state("assert(entity_handle_id(entity) == 3)"));
+			TEST_CHECK(state("assert(entity_handle_id(nil) == -1)"));
+			TEST_EQUAL(entity->useCount(), 2);
+
+			state["player"] = kaguya::IntrusivePtr<Player>(new Player());
+			TEST_CHECK(state("assert(entity_handle_id(player) == 7)"));
+			TEST_CHECK(state("keep_entity_handle(player)"));
+			TEST_EQUAL(keep_entity->id, 7);
+			TEST_EQUAL(keep_entity->useCount(), 2);
+
+			Entity raw(5);
+			state["raw"] = &raw;
+			TEST_CHECK(state("assert(entity_use_count(raw) == 0)"));
+			//objects not owned by IntrusivePtr are not adopted
+			TEST_CHECK(state("assert(not pcall(entity_handle_id, raw))"));
+			TEST_CHECK(state("assert(not pcall(entity_handle_id, Entity.new())) collectgarbage()"));
+			TEST_EQUAL(raw.useCount(), 0);
+
+			kaguya::IntrusivePtr<Entity> got = state["entity"];
+			TEST_CHECK(got == entity);
+			TEST_EQUAL(entity->useCount(), 3);
+			TEST_EQUAL(Entity::alive, 3);
+		}
+		TEST_EQUAL(Entity::alive, 1);
+		TEST_EQUAL(keep_entity->useCount(), 1);
+		keep_entity.reset();
+		TEST_EQUAL(Entity::alive, 0);
+	}
+
 	struct shared_ptr_fun
 	{
 		kaguya::standard::shared_ptr<int>& ptr;
@@ -495,6 +593,23 @@ namespace t_02_classreg
 	
 
 
+	long shared_ptr_const_ref_use_count(const kaguya::standard::shared_ptr<Base>& p)
+	{
+		return p ? p.use_count() : -1;
+	}
+	void shared_ptr_const_ref_argument(kaguya::State& state)
+	{
+		state["Base"].setClass(kaguya::ClassMetatable<Base>()
+			.addMember("a", &Base::a)
+			);
+		kaguya::standard::shared_ptr<Base> base(new Base());
+		state["base"] = base;
+		state["use_count"] = &shared_ptr_const_ref_use_count;
+		TEST_EQUAL(base.use_count(), 2);
+		TEST_CHECK(state("assert(use_count(base) == 2)"));
+		TEST_CHECK(state("assert(use_count(nil) == -1)"));
+	}
+
 	void add_property(kaguya::State& state)
 	{
 		state["Base"].setClass(kaguya::ClassMetatable<Base>()
@@ -518,6 +633,49 @@ namespace t_02_classreg
 		TEST_EQUAL(derived.b , 3);
 	}
 
+	void inherited_property(kaguya::State& state)
+	{
+		state["Base"].setClass(kaguya::ClassMetatable<Base>()
+			.addProperty("a", &Base::a)
+			);
+		state["Derived"].setClass(kaguya::ClassMetatable<Derived, Base>()
+			.addMember("b", &Derived::b)
+			);
+
+		Derived derived;
+		const Base const_base;
+		state["derived"] = &derived;
+		state["const_base"] = &const_base;
+		TEST_CHECK(state("derived.a = 4"));
+		TEST_CHECK(state("assert(4 == derived.a)"));
+		TEST_CHECK(state("derived:b(5)"));
+		TEST_CHECK(state("assert(5 == derived:b())"));
+		TEST_EQUAL(derived.a, 4);
+		TEST_EQUAL(derived.b, 5);
+		TEST_CHECK(state("assert(0 == const_base.a)"));
+		TEST_CHECK(state("assert(pcall(function() derived.unknown = 1 end) == false)"));
+		TEST_CHECK(state("assert(pcall(function() const_base.a = 1 end) == false)"));
+	}
+
+	struct SampleFrame
+	{
+		SampleFrame() :buffer(4, 1.0), samples(&buffer[0], buffer.size()) {}
+		std::vector<double> buffer;
+		kaguya::TypedArray<double> samples;
+	};
+	void typed_array_property(kaguya::State& state)
+	{
+		state["SampleFrame"].setClass(kaguya::ClassMetatable<SampleFrame>()
+			.addConstructor()
+			.addProperty("samples", &SampleFrame::samples)
+			);
+		//typed array returned by property getter is not object wrapper
+		TEST_CHECK(state("frame = SampleFrame.new() samples = frame.samples"));
+		TEST_CHECK(state("assert(#samples == 4 and samples[1] == 1)"));
+		TEST_CHECK(state("samples[2] = 5 collectgarbage()"));
+		TEST_CHECK(state("assert(frame.samples[2] == 5)"));
+	}
+
 	struct Prop
 	{
 		Prop() :a(0){}
@@ -575,6 +733,21 @@ namespace t_03_function
 		TEST_CHECK(state["free2"]() == 12.0);
 	}
 
+	int throw_function(int)
+	{
+		throw std::runtime_error("throw_function");
+	}
+	void function_pointer_trampoline(kaguya::State& state)
+	{
+		state["throw_function"] = &throw_function;
+		TEST_CHECK(state("assert(pcall(throw_function, 1) == false)"));
+		TEST_CHECK(state("local ok, message = pcall(throw_function, 1) assert(string.find(message, 'throw_function'))"));
+
+		int(*null_function)() = 0;
+		state["null_function"] = null_function;
+		TEST_CHECK(state("assert(null_function == nil)"));
+	}
+
 	struct Foo
 	{
 		std::string bar;
@@ -745,6 +918,140 @@ namespace t_03_function
 #endif
 	}
 
+	struct UnpushableElement {};
+}
+namespace kaguya
+{
+	template<> struct lua_type_traits<t_03_function::UnpushableElement>
+	{
+		static int push(lua_State*, const t_03_function::UnpushableElement&) { return 0; }
+	};
+}
+namespace t_03_function
+{
+	std::string sequence_error;
+	void store_sequence_error(int, const char* message)
+	{
+		sequence_error = message ? message : "";
+	}
+	size_t vector_size(const std::vector<double>& v) { return v.size(); }
+	int map_size(const std::map<std::string, double>& m) { return -int(m.size()); }
+	void vector_sequence_type_check(kaguya::State& state)
+	{
+#if !defined(KAGUYA_NO_STD_VECTOR_TO_TABLE) && !defined(KAGUYA_NO_STD_MAP_TO_TABLE)
+		state["container_size"] = kaguya::overload(vector_size, map_size);
+		TEST_CHECK(state("assert(container_size({1,2,3.5}) == 3)"));
+		TEST_CHECK(state("assert(container_size({}) == 0)"));
+		TEST_CHECK(state("assert(container_size({a=1,b=2}) == -2)"));
+		TEST_CHECK(state("assert(not pcall(container_size, {1,2,x=3}))"));//not a sequence
+		TEST_CHECK(state("assert(not pcall(container_size, {1,nil,3}))"));//hole
+		TEST_CHECK(state("assert(not pcall(container_size, {1,'x'}))"));
+
+		std::vector<int> ints;
+		for (int i = 0; i < 1000; ++i) { ints.push_back(i * 3); }
+		state["ints"] = ints;
+		TEST_CHECK(state("assert(#ints == 1000 and ints[1] == 0 and ints[1000] == 2997)"));
+		std::vector<int> back = state["ints"];
+		TEST_CHECK(back == ints);
+
+		std::vector<bool> flags; flags.push_back(true); flags.push_back(false);
+		state["flags"] = flags;
+		TEST_CHECK(state("assert(flags[1] == true and flags[2] == false)"));
+		std::vector<bool> flags_back = state["flags"];
+		TEST_CHECK(flags_back == flags);
+
+		state("strs = {'a','b',3}");
+		kaguya::LuaRef strs = state["strs"];
+		TEST_CHECK(strs.weakTypeTest<std::vector<std::string> >());
+		TEST_CHECK(!strs.typeTest<std::vector<std::string> >());
+		TEST_CHECK(!strs.weakTypeTest<std::vector<int> >());
+
+		//element push failure does not leave a table with holes
+		kaguya::State local;
+		local.setErrorHandler(store_sequence_error);
+		std::vector<UnpushableElement> unpushable(3);
+		local["unpushable"] = unpushable;
+		TEST_CHECK(sequence_error.find("can not push vector element") != std::string::npos);
+		TEST_CHECK(local("assert(unpushable == nil)"));
+#endif
+	}
+
+	double typed_array_sum(kaguya::TypedArray<const double> array)
+	{
+		double sum = 0;
+		for (const double* it = array.begin(); it != array.end(); ++it) { sum += *it; }
+		return sum;
+	}
+	kaguya::TypedArray<double> typed_array_create(int size)
+	{
+		kaguya::TypedArray<double> array = kaguya::TypedArray<double>::create(size);
+		for (int i = 0; i < size; ++i) { array[i] = i; }
+		return array;
+	}
+	struct TypedArrayOwner
+	{
+		TypedArrayOwner() :values(4, 2.0) {}
+		std::vector<double> values;
+	};
+	kaguya::TypedArray<double> typed_array_of(TypedArrayOwner* owner, int size)
+	{
+		return kaguya::TypedArray<double>(&owner->values[0], static_cast<size_t>(size));
+	}
+	int typed_array_owner_size(TypedArrayOwner* owner)
+	{
+		return owner ? static_cast<int>(owner->values.size()) : -1;
+	}
+	void typed_array(kaguya::State& state)
+	{
+		std::vector<double> frame(8, 1.0);
+		state["frame"] = kaguya::TypedArray<double>(&frame[0], frame.size());
+		TEST_CHECK(state("assert(#frame == 8 and frame:size() == 8)"));
+		TEST_CHECK(state("frame[1] = frame[2] * 3"));
+		TEST_EQUAL(frame[0], 3.0);//borrowed buffer is modified in place
+		TEST_CHECK(state("assert(frame[0] == nil and frame[9] == nil)"));
+		TEST_CHECK(state("assert(not pcall(function() frame[9] = 1 end))"));
+		TEST_CHECK(state("assert(not pcall(function() frame[1] = 'x' end))"));
+
+		TEST_CHECK(state("part = frame:slice(3, 5)"));
+		TEST_CHECK(state("assert(#part == 3)"));
+		TEST_CHECK(state("part[1] = 7"));
+		TEST_EQUAL(frame[2], 7.0);
+		TEST_CHECK(state("assert(#frame:slice(9) == 0)"));
+		TEST_CHECK(state("assert(not pcall(frame.slice, frame, 0, 2))"));
+
+		state["sum"] = &typed_array_sum;
+		TEST_CHECK(state("assert(sum(frame) == 3 + 1 + 7 + 5)"));
+
+		state["create"] = &typed_array_create;
+		TEST_CHECK(state("owned = create(4) tbl = owned:slice(2):totable() owned = nil collectgarbage()"));
+		TEST_CHECK(state("assert(#tbl == 3 and tbl[1] == 1 and tbl[3] == 3)"));
+
+		kaguya::TypedArray<double> copied = kaguya::TypedArray<double>::copy(frame);
+		TEST_CHECK(copied.owned());
+		state["readonly"] = kaguya::TypedArray<const double>(copied);
+		TEST_CHECK(state("assert(readonly[1] == 3)"));
+		TEST_CHECK(state("assert(not pcall(function() readonly[1] = 1 end))"));
+		kaguya::TypedArray<const double> back = state["readonly"];
+		TEST_EQUAL(back.size(), 8);
+		TEST_EQUAL(back.data(), copied.data());
+
+		TEST_CHECK(state("assert(not pcall(function() frame[1e300] = 1 end))"));
+#if LUA_VERSION_NUM >= 503
+		TEST_CHECK(state("assert(math.type(#frame) == 'integer')"));
+#endif
+
+		//typed array is not object wrapper. returned with userdata argument and passed as class pointer
+		state["TypedArrayOwner"].setClass(kaguya::ClassMetatable<TypedArrayOwner>()
+			.addConstructor()
+			);
+		state["typed_array_of"] = &typed_array_of;
+		state["typed_array_owner_size"] = &typed_array_owner_size;
+		TEST_CHECK(state("owner = TypedArrayOwner.new() view = typed_array_of(owner, 3)"));
+		TEST_CHECK(state("assert(#view == 3 and view[1] == 2)"));
+		TEST_CHECK(state("assert(typed_array_owner_size(owner) == 4)"));
+		TEST_CHECK(state("assert(typed_array_owner_size(view) == -1)"));
+	}
+
 
 
 	void coroutine(kaguya::State& state)
@@ -935,6 +1242,33 @@ namespace t_03_function
 	}
 
 
+	struct OverloadA {};
+	struct OverloadB {};
+	int overload4(OverloadA*)
+	{
+		return 4;
+	}
+	int overload5(const OverloadB&)
+	{
+		return 5;
+	}
+
+	void overload_changing_argument_types(kaguya::State& state)
+	{
+		state["OverloadA"].setClass(kaguya::ClassMetatable<OverloadA>());
+		state["OverloadB"].setClass(kaguya::ClassMetatable<OverloadB>());
+		state["overloaded_function"] = kaguya::overload(overload1, overload2, overload3, overload4, overload5);
+		state["a"] = OverloadA();
+		state["b"] = OverloadB();
+
+		//same call site with changing argument types
+		TEST_CHECK(state("local args = {'str', 12, a, b, 'str', b, a, 13}\n"
+			"local expects = {2, 3, 4, 5, 2, 5, 4, 3}\n"
+			"for i = 1, #args do assert(overloaded_function(args[i]) == expects[i]) end"));
+		TEST_CHECK(state("for i = 1, 4 do assert(overloaded_function() == 1) assert(overloaded_function(a) == 4) end"));
+	}
+
+
 	void result_to_table(kaguya::State& state)
 	{
 		state["result_to_table"] = kaguya::function(overload1);
@@ -962,6 +1296,21 @@ namespace t_03_function
 
 		return result == DoDoe;
 	}
+#if KAGUYA_USE_STRING_VIEW
+	size_t string_view_size(std::string_view s)
+	{
+		return s.size();
+	}
+	void string_view_argument(kaguya::State& state)
+	{
+		state["string_view_size"] = &string_view_size;
+		TEST_CHECK(state("assert(string_view_size('abc') == 3)"));
+		TEST_CHECK(state("assert(string_view_size('a\\0b') == 3)"));
+		TEST_CHECK(state("assert(string_view_size(123) == 3)"));
+		state["view"] = std::string_view("kaguya");
+		TEST_EQUAL(state["view"], "kaguya");
+	}
+#endif
 }
 
 namespace t_04_lua_ref
@@ -1263,6 +1612,247 @@ namespace t_04_lua_ref
 		TEST_CHECK(state["value"]["abc"]["ccc"] != "tes");
 	}
 
+	struct stack_ref_sum
+	{
+		int& sum;
+		int& count;
+		stack_ref_sum(int& s, int& c) :sum(s), count(c) {}
+		void operator()(const kaguya::LuaStackRef& key, const kaguya::LuaStackRef& value)
+		{
+			TEST_EQUAL(key.type(), LUA_TSTRING);
+			sum += value.get<int>();
+			count++;
+		}
+	};
+	void lua_stack_ref(kaguya::State& state)
+	{
+		state("value = {a=1, b=2, c=4}");
+		kaguya::LuaTable table = state["value"];
+		int sum = 0;
+		int count = 0;
+		int top = lua_gettop(state.state());
+		table.foreach_table(stack_ref_sum(sum, count));
+		TEST_EQUAL(sum, 7);
+		TEST_EQUAL(count, 3);
+		TEST_EQUAL(top, lua_gettop(state.state()));
+
+		lua_pushinteger(state.state(), 3);
+		lua_pushinteger(state.state(), 5);
+		kaguya::LuaStackRef first(state.state(), -2);
+		kaguya::LuaStackRef second(state.state(), -1);
+		TEST_CHECK(first < second);
+		TEST_CHECK(first != second);
+		TEST_EQUAL(first.get<int>(), 3);
+		kaguya::LuaRef escaped = second;
+		lua_pop(state.state(), 2);
+		TEST_EQUAL(escaped, 5);
+	}
+
+	struct KeyTarget
+	{
+		KeyTarget() :value(3) {}
+		int getValue()const { return value; }
+		int value;
+	};
+	void interned_key(kaguya::State& state)
+	{
+		kaguya::Key position = state.key("position");
+		TEST_CHECK(position == state.key(std::string("position")));
+		TEST_CHECK(position != state.key("velocity"));
+		TEST_CHECK(kaguya::Key().isNilref());
+
+		state[position] = 5;
+		TEST_EQUAL(state["position"], 5);
+		TEST_EQUAL(state[position], 5);
+		TEST_CHECK(state("assert(position == 5)"));
+
+		state("tbl = {position = 1, sub = {position = 2}}");
+		kaguya::LuaTable table = state["tbl"];
+		TEST_EQUAL(table[position], 1);
+		TEST_EQUAL(table.getField<int>(position), 1);
+		TEST_EQUAL(state["tbl"]["sub"][position], 2);
+		table.setField(position, 8);
+		TEST_CHECK(state("assert(tbl.position == 8)"));
+		table[position] = 9;
+		TEST_CHECK(state("assert(tbl.position == 9)"));
+
+		state["KeyTarget"].setClass(kaguya::ClassMetatable<KeyTarget>()
+			.addConstructor()
+			.addMember("getValue", &KeyTarget::getValue)
+			.addProperty("value", &KeyTarget::value)
+			);
+		TEST_CHECK(state("obj = KeyTarget.new()"));
+		const kaguya::LuaRef obj = state["obj"];
+		kaguya::LuaRef method = obj[state.key("getValue")];
+		TEST_EQUAL(method.call<int>(obj), 3);
+		TEST_EQUAL(obj[state.key("value")], 3);
+		TEST_CHECK(state("assert(obj:getValue() == 3 and obj.value == 3)"));
+
+		//key of other lua_State is pushed as string
+		kaguya::State other;
+		other("tbl = {position = 4}");
+		TEST_EQUAL(other["tbl"][position], 4);
+		kaguya::LuaThread thread = state.newThread();
+		lua_State* co = thread.get<lua_State*>();
+		position.push(co);
+		TEST_EQUAL(std::string(lua_tostring(co, -1)), "position");
+		lua_pop(co, 1);
+	}
+
+	struct ConfigRecord
+	{
+		ConfigRecord() :width(0), height(0), scale(1.0) {}
+		std::string name;
+		int width;
+		int height;
+		double scale;
+	};
+	void field_mapping(kaguya::State& state)
+	{
+		kaguya::FieldMapping<ConfigRecord> mapping = kaguya::FieldMapping<ConfigRecord>()
+			.addField("name", &ConfigRecord::name)
+			.addField("width", &ConfigRecord::width)
+			.addField("height", &ConfigRecord::height)
+			.addField("scale", &ConfigRecord::scale);
+
+		state("config = {name='window', width=640, height=480}");
+		kaguya::LuaTable table = state["config"];
+		ConfigRecord config;
+		TEST_CHECK(table.load(mapping, config));
+		TEST_EQUAL(config.name, "window");
+		TEST_EQUAL(config.width, 640);
+		TEST_EQUAL(config.height, 480);
+		TEST_EQUAL(config.scale, 1.0);//nil field is not assigned
+
+		config.width = 800;
+		config.scale = 2.5;
+		kaguya::LuaTable out = state.newTable();
+		TEST_CHECK(out.store(mapping, config));
+		state["out"] = out;
+		TEST_CHECK(state("assert(out.name == 'window' and out.width == 800 and out.height == 480 and out.scale == 2.5)"));
+
+		ConfigRecord reload;
+		TEST_CHECK(out.load(mapping, reload));
+		TEST_EQUAL(reload.width, 800);
+		TEST_EQUAL(reload.scale, 2.5);
+
+		//mapping can be extended after use
+		kaguya::FieldMapping<ConfigRecord> name_width;
+		name_width.addField("name", &ConfigRecord::name);
+		ConfigRecord extended;
+		TEST_CHECK(table.load(name_width, extended));
+		TEST_EQUAL(extended.width, 0);
+		name_width.addField("width", &ConfigRecord::width);
+		TEST_EQUAL(name_width.size(), 2);
+		TEST_CHECK(table.load(name_width, extended));
+		TEST_EQUAL(extended.width, 640);
+
+		//mapping outlives lua_States that used it, and equal mappings share key array
+		for (int i = 0; i < 2; ++i)
+		{
+			kaguya::State local;
+			local("config = {name='local', width=320}");
+			kaguya::LuaTable local_table = local["config"];
+			ConfigRecord local_config;
+			for (int j = 0; j < 10; ++j)
+			{
+				kaguya::FieldMapping<ConfigRecord> same;
+				same.addField("name", &ConfigRecord::name).addField("width", &ConfigRecord::width);
+				TEST_CHECK(local_table.load(same, local_config));
+			}
+			TEST_CHECK(local_table.load(name_width, local_config));
+			TEST_EQUAL(local_config.name, "local");
+			TEST_EQUAL(local_config.width, 320);
+			lua_pushlightuserdata(local.state(), kaguya::field_mapping_detail::cache_key());
+			lua_rawget(local.state(), LUA_REGISTRYINDEX);
+			kaguya::LuaTable cache(local.state(), kaguya::StackTop());
+			TEST_EQUAL(cache.keys().size(), 1);
+		}
+	}
+
+	void table_dump(kaguya::State& state)
+	{
+		state("dumped_a = {} for i = 10, 1, -1 do dumped_a['k' .. i] = i end dumped_a[2] = true dumped_a[1] = 'one' dumped_a.nested = {b = 2, a = 1}");
+		state("dumped_b = {nested = {a = 1, b = 2}, [1] = 'one', [2] = true} for i = 1, 10 do dumped_b['k' .. i] = i end");
+		std::ostringstream a, b, nested;
+		kaguya::LuaRef dumped_a = state["dumped_a"];
+		kaguya::LuaRef dumped_b = state["dumped_b"];
+		kaguya::LuaRef dumped_nested = state["dumped_a"]["nested"];
+		dumped_a.dump(a);
+		dumped_b.dump(b);
+		TEST_EQUAL(a.str(), b.str());
+		dumped_nested.dump(nested);
+		TEST_EQUAL(nested.str(), "{'a' = 1,'b' = 2}");
+		TEST_CHECK(a.str().find("{1 = 'one',2 = 1,'k1' = 1,'k10' = 10,'k2' = 2,") == 0);
+	}
+	void table_range(kaguya::State& state)
+	{
+		state("tbl = {10,20,30,[4]=40,x=1,[5.5]=2}");
+		kaguya::LuaTable table = state["tbl"];
+		int top = lua_gettop(state.state());
+
+		int value_sum = 0;
+		int count = 0;
+		{
+			kaguya::TablePairsRange<> range = table.pairs();
+			for (kaguya::TablePairsRange<>::iterator it = range.begin(); it != range.end(); ++it)
+			{
+				value_sum += (*it).second.get<int>();
+				++count;
+			}
+		}
+		TEST_EQUAL(value_sum, 103);
+		TEST_EQUAL(count, 6);
+		TEST_EQUAL(top, lua_gettop(state.state()));
+
+		//converting number key to string does not break traversal
+		std::map<std::string, int> strmap;
+		{
+			kaguya::TablePairsRange<std::string, int> range = table.pairs<std::string, int>();
+			for (kaguya::TablePairsRange<std::string, int>::iterator it = range.begin(); it != range.end(); ++it)
+			{
+				strmap[it.key()] = it.value();
+			}
+		}
+		TEST_EQUAL(strmap.size(), 6);
+		TEST_EQUAL(strmap["x"], 1);
+		TEST_EQUAL(strmap["4"], 40);
+		TEST_EQUAL(top, lua_gettop(state.state()));
+
+		std::vector<int> array;
+		{
+			kaguya::TableIPairsRange<int> range = table.ipairs<int>();
+			TEST_EQUAL(range.size(), 4);
+			for (kaguya::TableIPairsRange<int>::iterator it = range.begin(); it != range.end(); ++it)
+			{
+				TEST_EQUAL(it.index(), int(array.size() + 1));
+				array.push_back(*it);
+			}
+		}
+		TEST_EQUAL(array.size(), 4);
+		TEST_EQUAL(array[3], 40);
+		TEST_EQUAL(top, lua_gettop(state.state()));
+
+		kaguya::LuaRef empty;
+		TEST_CHECK(empty.pairs().begin() == empty.pairs().end());
+		kaguya::LuaRef number = state.newRef(3);
+		TEST_CHECK(number.pairs().begin() == number.pairs().end());
+		TEST_EQUAL(number.ipairs().size(), 0);
+		TEST_EQUAL(top, lua_gettop(state.state()));
+
+		state("arr = {1,2,3}");
+		std::vector<int> vec = state["arr"];
+		TEST_EQUAL(vec.size(), 3);
+		kaguya::LuaRef tblref = state["tbl"];
+		kaguya::LuaRef arrref = state["arr"];
+		TEST_CHECK(!tblref.typeTest<std::vector<int> >());
+		TEST_CHECK(arrref.typeTest<std::vector<int> >());
+
+		std::stringstream ss;
+		ss << state["arr"];
+		TEST_EQUAL(ss.str(), "{1 = 1,2 = 2,3 = 3}");
+	}
+
 	void metatable(kaguya::State& state)
 	{
 		kaguya::LuaTable table = state.newTable();
@@ -1382,6 +1972,564 @@ namespace t_06_state
 
 		TEST_CHECK(state("assert(otherEnv.foo == 'dar')"));
 	}
+	void allocator(kaguya::State&)
+	{
+		kaguya::standard::shared_ptr<kaguya::PoolAllocator> pool(new kaguya::PoolAllocator());
+		{
+			kaguya::State state(pool);
+			TEST_CHECK(state.allocator() == pool);
+			TEST_CHECK(state("t = {} for i = 1, 1000 do t[i] = {i, tostring(i)} end"));
+			TEST_CHECK(pool->stats().live_bytes > 0);
+			TEST_CHECK(pool->stats().peak_bytes >= pool->stats().live_bytes);
+			TEST_CHECK(pool->stats().size_class_count[kaguya::AllocatorStats::sizeClass(1)] > 0);
+			size_t live = pool->stats().live_bytes;
+			TEST_CHECK(state("t = nil collectgarbage()"));
+			TEST_CHECK(pool->stats().live_bytes < live);
+		}
+		TEST_EQUAL(pool->stats().live_bytes, 0);
+		TEST_EQUAL(pool->stats().allocation_count, pool->stats().deallocation_count);
+
+		kaguya::standard::shared_ptr<kaguya::ArenaAllocator> arena(new kaguya::ArenaAllocator());
+		for (int i = 0; i < 3; ++i)
+		{
+			{
+				kaguya::State state(arena, kaguya::NoLoadLib());
+				state["value"] = i;
+				TEST_EQUAL(state["value"], i);
+			}
+			TEST_EQUAL(arena->stats().live_bytes, 0);
+			size_t reserved = arena->reservedBytes();
+			arena->reset();
+			TEST_EQUAL(arena->reservedBytes(), reserved);
+		}
+		{
+			kaguya::ArenaAllocator shrink_arena;
+			void* first = shrink_arena.allocate(64);
+			void* second = shrink_arena.allocate(64);
+			TEST_CHECK(shrink_arena.reallocate(first, 64, 16) == first);
+			TEST_CHECK(shrink_arena.reallocate(second, 64, 16) == second);
+			TEST_CHECK(shrink_arena.allocate(16) == static_cast<char*>(second) + 16);
+		}
+
+		kaguya::State state(kaguya::standard::shared_ptr<kaguya::Allocator>(new kaguya::DefaultAllocator()));
+		TEST_CHECK(state("assert(string.rep('a', 1000):len() == 1000)"));
+		TEST_CHECK(state.allocator()->stats().size_class_count[kaguya::AllocatorStats::LARGE_SIZE_CLASS] > 0);
+
+		kaguya::State null_allocator_state((kaguya::standard::shared_ptr<kaguya::Allocator>()));
+		TEST_CHECK(null_allocator_state.allocator());
+		TEST_CHECK(null_allocator_state("assert(string.rep('a', 100):len() == 100)"));
+	}
+	std::string last_error_message;
+	void store_error_message(int status, const char* message)
+	{
+		last_error_message = message ? message : "";
+	}
+	void memory_budget(kaguya::State&)
+	{
+		kaguya::standard::shared_ptr<kaguya::LimitedAllocator> budget(new kaguya::LimitedAllocator(1024 * 1024));
+		kaguya::State state(budget);
+		state.setErrorHandler(store_error_message);
+		TEST_CHECK(!state("local t = {} for i = 1, 1000000 do t[i] = string.rep('x', 64) .. i end"));
+		TEST_CHECK(last_error_message.find("not enough memory") != std::string::npos);
+		TEST_CHECK(budget->limitFailureCount() > 0);
+		TEST_CHECK(budget->peakBytes() <= budget->hardLimit());
+		state.garbageCollect();
+		TEST_CHECK(budget->liveBytes() < 256 * 1024);
+		TEST_CHECK(state("assert(#string.rep('y', 1000) == 1000)"));//state is still usable
+
+		kaguya::standard::shared_ptr<kaguya::LimitedAllocator> soft(new kaguya::LimitedAllocator(0, 256 * 1024));
+		kaguya::State soft_state(soft);
+		//stopped collector does not run emergency collection. allocation is not refused
+		soft_state.gc().stop();
+		TEST_CHECK(soft_state("for i = 1, 100000 do local garbage = {i} end"));
+		TEST_EQUAL(soft->softCollectCount(), 0);
+		TEST_CHECK(soft->collectPending());
+		soft_state.gc().collect();
+		TEST_CHECK(!soft->collectPending());
+#if LUA_VERSION_NUM >= 502
+		soft_state.gc().restart();
+		soft_state.gc().setpause(10000);
+		TEST_CHECK(soft_state("for i = 1, 100000 do local garbage = {i} end"));
+		TEST_CHECK(soft->softCollectCount() > 0);
+		//stopped from Lua is told by setCollectorRunning
+		TEST_CHECK(soft_state("collectgarbage('collect') collectgarbage('stop')"));
+		soft->setCollectorRunning(false);
+		size_t collected = soft->softCollectCount();
+		TEST_CHECK(soft_state("for i = 1, 100000 do local garbage = {i} end"));
+		TEST_EQUAL(soft->softCollectCount(), collected);
+		TEST_CHECK(soft->collectPending());
+#endif
+		TEST_CHECK(soft->limitFailureCount() == 0);
+	}
+	struct PoolObject
+	{
+		PoolObject() :value(1) {}
+		int value;
+	};
+	void pool_initializer(kaguya::State& state)
+	{
+		state["PoolObject"].setClass(kaguya::ClassMetatable<PoolObject>()
+			.addConstructor()
+			.addProperty("value", &PoolObject::value)
+			);
+		state("config = {mode = 'default'}");
+	}
+	void state_pool(kaguya::State&)
+	{
+		kaguya::StatePool pool(2, &pool_initializer);
+		TEST_EQUAL(pool.idleCount(), 2);
+		{
+			kaguya::StatePool::Lease lease = pool.acquire();
+			TEST_CHECK(lease.valid());
+			TEST_EQUAL(pool.idleCount(), 1);
+			kaguya::State& state = *lease;
+			TEST_CHECK(state("obj = PoolObject.new() obj.value = 3"));
+			TEST_CHECK(state("leaked = 1 config = nil string.leaked = true"));
+			TEST_CHECK(state("setmetatable(_G, {__index = function() return 'x' end})"));
+			TEST_CHECK(state("PoolObject.new = nil"));
+		}
+		TEST_EQUAL(pool.idleCount(), 2);
+		{
+			kaguya::StatePool::Lease first = pool.acquire();
+			kaguya::StatePool::Lease second = pool.acquire();
+			TEST_CHECK(first.get() != second.get());
+			TEST_CHECK((*first)("assert(leaked == nil and obj == nil and string.leaked == nil)"));
+			TEST_CHECK((*second)("assert(leaked == nil and obj == nil and string.leaked == nil)"));
+			TEST_CHECK((*first)("assert(config.mode == 'default' and getmetatable(_G) == nil)"));
+			TEST_CHECK((*first)("assert(PoolObject.new().value == 1)"));
+
+			kaguya::StatePool::Lease third = pool.acquire();//miss
+			TEST_CHECK((*third)("assert(PoolObject.new().value == 1)"));
+			kaguya::StatePool::Lease moved = third;
+			TEST_CHECK(!third.valid());
+			TEST_CHECK(moved.valid());
+		}
+		kaguya::StatePoolStats stats = pool.stats();
+		TEST_EQUAL(stats.acquire_count, 4);
+		TEST_EQUAL(stats.hit_count, 3);
+		TEST_EQUAL(stats.created_count, 3);
+		TEST_EQUAL(stats.reset_count, 3);
+		TEST_EQUAL(stats.reset_failure_count, 0);
+		TEST_EQUAL(stats.overflow_count, 1);//State created by miss is not kept beyond pool size
+		TEST_CHECK(stats.hitRate() == 0.75);
+		TEST_EQUAL(pool.idleCount(), 2);
+
+#if LUA_VERSION_NUM == 502 || LUA_VERSION_NUM == 503
+		//error in __gc during restore. State is closed instead of pooled
+		{
+			kaguya::StatePool::Lease lease = pool.acquire();
+			TEST_CHECK((*lease)("setmetatable({}, {__gc = function() error('finalizer') end})"));
+		}
+		TEST_EQUAL(pool.stats().reset_failure_count, 1);
+		TEST_EQUAL(pool.idleCount(), 1);
+		pool.refill();
+		TEST_EQUAL(pool.idleCount(), 2);
+#endif
+
+		kaguya::StatePool recreate(1, &pool_initializer, kaguya::StatePool::RESET_RECREATE);
+		{
+			kaguya::StatePool::Lease lease = recreate.acquire();
+			TEST_CHECK((*lease)("leaked = 1"));
+		}
+		TEST_EQUAL(recreate.idleCount(), 0);
+		recreate.refill();
+		TEST_EQUAL(recreate.idleCount(), 1);
+		{
+			kaguya::StatePool::Lease lease = recreate.acquire();
+			TEST_CHECK((*lease)("assert(leaked == nil and config.mode == 'default')"));
+		}
+		TEST_EQUAL(recreate.stats().created_count, 2);
+	}
+	void chunk_cache(kaguya::State&)
+	{
+		kaguya::standard::shared_ptr<kaguya::ChunkCache> cache(new kaguya::ChunkCache("."));
+		const char* code = "cached_value = (cached_value or 0) + 1 return cached_value";
+		std::string key = kaguya::ChunkCache::stringKey(code, strlen(code));
+		std::remove(cache->diskPath(key).c_str());
+		std::string long_code(100000, ' ');
+		TEST_CHECK(kaguya::ChunkCache::stringKey(long_code.data(), long_code.size()).size() < 64);
+		TEST_CHECK(kaguya::ChunkCache::stringKey(long_code.data(), long_code.size() - 1) != kaguya::ChunkCache::stringKey(long_code.data(), long_code.size()));
+		{
+			kaguya::State state;
+			state.setChunkCache(cache);
+			TEST_CHECK(state(code));
+			TEST_EQUAL(state.loadstring(code)(), 2);
+			TEST_EQUAL(cache->stats().miss_count, 1);
+			TEST_EQUAL(cache->stats().hit_count, 1);
+		}
+		{
+			kaguya::State state;
+			state.setChunkCache(cache);
+			TEST_CHECK(state(code));
+			TEST_EQUAL(state["cached_value"], 1);
+			TEST_EQUAL(cache->stats().hit_count, 2);
+			TEST_CHECK(!state.loadstring("return +"));//syntax error is not cached
+			TEST_EQUAL(cache->stats().miss_count, 2);
+			TEST_EQUAL(cache->stats().entry_count, 1);
+		}
+
+		const char* file_name = "kaguya_chunk_cache_test.lua";
+		FILE* file = fopen(file_name, "w");
+		TEST_CHECK(file);
+		fputs("local a = ... return (a or 0) + 10", file);
+		fclose(file);
+		{
+			kaguya::State state;
+			state.setChunkCache(cache);
+			TEST_EQUAL(state.loadfile(file_name)(5), 15);
+			TEST_CHECK(state.dofile(file_name));
+			TEST_EQUAL(cache->stats().hit_count, 3);
+		}
+
+		//bytecode in cache directory
+		kaguya::standard::shared_ptr<kaguya::ChunkCache> reloaded(new kaguya::ChunkCache("."));
+		{
+			kaguya::State state;
+			state.setChunkCache(reloaded);
+			TEST_CHECK(state(code));
+			TEST_EQUAL(state.loadfile(file_name)(1), 11);
+			TEST_EQUAL(reloaded->stats().disk_hit_count, 2);
+			TEST_EQUAL(reloaded->stats().miss_count, 0);
+		}
+
+		//edit keeping size in the same second is not served from cache
+		std::string first_key = kaguya::ChunkCache::fileKey(file_name);
+		file = fopen(file_name, "w");
+		TEST_CHECK(file);
+		fputs("local a = ... return (a or 0) + 20", file);
+		fclose(file);
+		{
+			kaguya::State state;
+			state.setChunkCache(cache);
+			TEST_EQUAL(state.loadfile(file_name)(5), 25);
+		}
+		std::remove(cache->diskPath(first_key).c_str());
+		std::remove(cache->diskPath(key).c_str());
+		std::remove(cache->diskPath(kaguya::ChunkCache::fileKey(file_name)).c_str());
+		std::remove(file_name);
+		reloaded->clear();
+		TEST_EQUAL(reloaded->stats().entry_count, 0);
+	}
+	//! yield chunk one character at a time
+	struct CharacterReader :kaguya::ChunkReader
+	{
+		std::string source;
+		size_t position;
+		CharacterReader(const std::string& src) :source(src), position(0) {}
+		virtual const char* read(size_t& size)
+		{
+			size = position < source.size() ? 1 : 0;
+			return size ? &source[position++] : 0;
+		}
+	};
+	void mapped_file_and_stream(kaguya::State&)
+	{
+		const char* file_name = "kaguya_mapped_file_test.lua";
+		FILE* file = fopen(file_name, "wb");
+		TEST_CHECK(file);
+		fputs("\xEF\xBB\xBF#!/usr/bin/lua\nlocal t = {\n", file);
+		for (int i = 1; i <= 5000; ++i)
+		{
+			fprintf(file, "  %d,\n", i);
+		}
+		fputs("}\nmapped_size = #t\nreturn #t, t[5000]\n", file);
+		fclose(file);
+
+		kaguya::State state;
+		state.setErrorHandler(store_error_message);
+		TEST_CHECK(state.domappedfile(file_name));
+		TEST_EQUAL(state["mapped_size"], 5000);
+		kaguya::MappedFileReader small_window(file_name, 1);//multiple windows
+		TEST_CHECK(small_window.isOpen());
+		TEST_CHECK(small_window.fileSize() > 4096);
+		kaguya::LuaFunction f = state.loadstream(small_window, "@mapped");
+		TEST_EQUAL(f.call<int>(), 5000);
+
+		file = fopen(file_name, "wb");
+		fputs("#comment\nerror('mapped error')", file);
+		fclose(file);
+		TEST_CHECK(!state.domappedfile(file_name));
+		TEST_CHECK(last_error_message.find("kaguya_mapped_file_test.lua:2:") != std::string::npos);
+		std::remove(file_name);
+		TEST_CHECK(!state.domappedfile(file_name));
+		TEST_CHECK(last_error_message.find("cannot open") != std::string::npos);
+		TEST_CHECK(!state.loadmappedfile(file_name));
+
+		CharacterReader reader("stream_value = 1 + 2 return stream_value");
+		TEST_EQUAL(state.loadstream(reader).call<int>(), 3);
+		CharacterReader broken("return +");
+		TEST_CHECK(!state.dostream(broken, "=broken"));
+		TEST_CHECK(last_error_message.find("broken") != std::string::npos);
+	}
+#if KAGUYA_USE_BINDING_PROFILER
+	int profiled_add(int a, int b) { return a + b; }
+	struct ProfiledObject
+	{
+		int value()const { return 1; }
+	};
+	int profiled_overload_int(int a) { return a; }
+	std::string profiled_overload_string(const std::string& a) { return a; }
+	const kaguya::BindingProfileEntry* find_profile(const std::vector<kaguya::BindingProfileEntry>& entries, const std::string& name, const std::string& signature = "")
+	{
+		for (size_t i = 0; i < entries.size(); ++i)
+		{
+			if (entries[i].name == name && entries[i].signature.compare(0, signature.size(), signature) == 0) { return &entries[i]; }
+		}
+		return 0;
+	}
+	void binding_profiler(kaguya::State&)
+	{
+		kaguya::State state;
+		state["add"] = &profiled_add;
+		state["over"] = kaguya::overload(&profiled_overload_int, &profiled_overload_string);
+		TEST_CHECK(state("function lua_callee(x) return add(x, 1) end"));
+		kaguya::BindingProfiler& profiler = state.bindingProfiler();
+		TEST_CHECK(!profiler.running());
+		TEST_CHECK(state("add(1, 2)"));
+		TEST_CHECK(profiler.entries().empty());
+
+		profiler.start();
+		kaguya::LuaFunction callee = state["lua_callee"];
+		for (int i = 0; i < 10; ++i)
+		{
+			TEST_EQUAL(callee.call<int>(i), i + 1);
+		}
+		TEST_CHECK(state("over(1) over('a') over('b')"));
+		profiler.stop();
+		TEST_CHECK(state("add(1, 2)"));
+
+		std::vector<kaguya::BindingProfileEntry> entries = profiler.entries();
+		const kaguya::BindingProfileEntry* add = find_profile(entries, "add");
+		TEST_CHECK(add && add->native && add->call_count == 10);
+		const kaguya::BindingProfileEntry* lua = find_profile(entries, "lua_callee");
+		TEST_CHECK(lua && !lua->native && lua->call_count == 10);
+		TEST_CHECK(lua && add && lua->body_ns >= add->total_ns());
+		const kaguya::BindingProfileEntry* over_int = find_profile(entries, "over", std::string(typeid(int).name()) + ",");
+		const kaguya::BindingProfileEntry* over_string = find_profile(entries, "over", std::string(typeid(std::string).name()) + ",");
+		TEST_CHECK(over_int && over_int->call_count == 1);
+		TEST_CHECK(over_string && over_string->call_count == 2);
+		for (size_t i = 1; i < entries.size(); ++i)
+		{
+			TEST_CHECK(entries[i - 1].total_ns() >= entries[i].total_ns());
+		}
+		std::string report = profiler.report();
+		TEST_CHECK(report.find("[lua] lua_callee") != std::string::npos);
+		TEST_CHECK(report.find("add") != std::string::npos);
+
+		//profiled functions are not collected until reset, and their addresses are not reused
+		TEST_CHECK(state("weak = setmetatable({}, {__mode = 'k'}) temporary = function() end weak[temporary] = true"));
+		profiler.start();
+		kaguya::LuaFunction temporary = state["temporary"];
+		temporary();
+		temporary = kaguya::LuaFunction();
+		profiler.stop();
+		TEST_CHECK(state("temporary = nil collectgarbage() assert(next(weak))"));
+		profiler.reset();
+		TEST_CHECK(profiler.entries().empty());
+		TEST_CHECK(state("collectgarbage() assert(next(weak) == nil)"));
+
+		//close while running. objects are collected after the profiler
+		{
+			kaguya::State closing;
+			closing["ProfiledObject"].setClass(kaguya::ClassMetatable<ProfiledObject>()
+				.addConstructor()
+				.addMember("value", &ProfiledObject::value));
+			closing.bindingProfiler().start();
+			TEST_CHECK(closing("objects = {} for i = 1, 200 do objects[i] = ProfiledObject.new() objects[i]:value() end"));
+		}
+	}
+#endif
+	void call_lua_callback(kaguya::LuaFunction f)
+	{
+		f();
+	}
+	void user_hook(lua_State*, lua_Debug*)
+	{
+	}
+	void sampling_profiler(kaguya::State&)
+	{
+		kaguya::State state;
+		state["call_lua_callback"] = &call_lua_callback;
+		TEST_CHECK(state("function hot() local s = 0 for i = 1, 100000 do s = s + i end return s end "
+			"function outer() return hot() + 1 end"));
+		kaguya::SamplingProfiler& profiler = state.samplingProfiler();
+		TEST_CHECK(!profiler.running());
+		profiler.start(20000, 100);
+		TEST_CHECK(profiler.running());
+		TEST_CHECK(state("for i = 1, 20 do outer() call_lua_callback(hot) end"));
+		profiler.stop();
+		TEST_CHECK(!profiler.running());
+		size_t samples = profiler.sampleCount();
+		TEST_CHECK(samples > 0);
+		TEST_CHECK(state("outer()"));
+		TEST_EQUAL(profiler.sampleCount(), samples);
+
+		kaguya::SamplingProfiler::FoldedStacks stacks = profiler.foldedStacks();
+		size_t total = 0;
+		for (kaguya::SamplingProfiler::FoldedStacks::const_iterator it = stacks.begin(); it != stacks.end(); ++it)
+		{
+			total += it->second;
+		}
+		TEST_EQUAL(total, samples);
+		std::string report = profiler.report();
+		TEST_CHECK(report.find("outer;hot ") != std::string::npos);
+		TEST_CHECK(report.find("call_lua_callback;hot ") != std::string::npos);
+		profiler.reset();
+		TEST_EQUAL(profiler.sampleCount(), 0);
+		TEST_CHECK(profiler.report().empty());
+
+		//threads created before start
+		kaguya::LuaThread pooled = state.coroutinePool().acquire();
+		state.coroutinePool().release(pooled);
+		TEST_CHECK(state("function repeat_hot() for i = 1, 20 do hot() end end "
+			"co = coroutine.create(repeat_hot)"));
+		profiler.start(20000, 100);
+		pooled = state.coroutinePool().acquire();
+		lua_State* pooled_thread = pooled.get<lua_State*>();
+		TEST_CHECK(lua_gethook(pooled_thread) == lua_gethook(state.state()));
+		kaguya::LuaFunction repeat_hot = state["repeat_hot"];
+		pooled.resume<void>(repeat_hot);
+		size_t pooled_samples = profiler.sampleCount();
+		TEST_CHECK(pooled_samples > 0);
+		kaguya::LuaThread co = state["co"];
+		profiler.attach(co.get<lua_State*>());
+		TEST_CHECK(state("assert(coroutine.resume(co))"));
+		profiler.stop();
+		TEST_CHECK(profiler.sampleCount() > pooled_samples);
+		TEST_CHECK(profiler.report().find("repeat_hot;hot ") != std::string::npos);
+		state.coroutinePool().release(pooled);
+
+		//hook of the thread itself is kept
+		pooled = state.coroutinePool().acquire();
+		pooled_thread = pooled.get<lua_State*>();
+		lua_sethook(pooled_thread, &user_hook, LUA_MASKCOUNT, 10);
+		state.coroutinePool().release(pooled);
+		profiler.start(20000, 100);
+		pooled = state.coroutinePool().acquire();
+		TEST_CHECK(pooled.get<lua_State*>() == pooled_thread);
+		TEST_CHECK(lua_gethook(pooled_thread) == &user_hook);
+		profiler.stop();
+		lua_sethook(pooled_thread, 0, 0, 0);
+		state.coroutinePool().release(pooled);
+
+		//sampled functions are not collected until reset, and their addresses are not reused
+		profiler.reset();
+		TEST_CHECK(state("sampled = setmetatable({}, {__mode = 'k'}) "
+			"temporary = function() local s = 0 for i = 1, 1000000 do s = s + i end return s end sampled[temporary] = true"));
+		profiler.start(20000, 100);
+		TEST_CHECK(state("temporary()"));
+		profiler.stop();
+		TEST_CHECK(profiler.sampleCount() > 0);
+		TEST_CHECK(state("temporary = nil collectgarbage() assert(next(sampled))"));
+		profiler.reset();
+		TEST_CHECK(state("collectgarbage() assert(next(sampled) == nil)"));
+	}
+	void gc_tuning(kaguya::State&)
+	{
+		kaguya::State state;
+		kaguya::State::GCType gc = state.gc();
+		int pause = gc.setpause(150);
+		TEST_EQUAL(gc.setpause(pause), 150);
+		int stepmul = gc.setstepmul(300);
+		TEST_EQUAL(gc.setstepmul(stepmul), 300);
+		TEST_EQUAL(gc.countBytes() / 1024, size_t(gc.count()));
+#if LUA_VERSION_NUM >= 504
+		TEST_CHECK(!gc.generational());
+		TEST_CHECK(gc.incremental());
+#endif
+
+		gc.stop();
+		TEST_CHECK(state("garbage = {} for i = 1, 10000 do garbage[i] = {} end garbage = nil"));
+		TEST_EQUAL(gc.stats().step_count, 0);
+		size_t calls = 0;
+		while (!gc.stepFor(100) && calls < 100000) { calls++; }
+		kaguya::GCStats stats = gc.stats();
+		TEST_CHECK(stats.step_count > calls);
+		TEST_EQUAL(stats.cycle_count, 1);
+		TEST_EQUAL(stats.collect_count, 0);
+		TEST_CHECK(stats.total_ns >= stats.max_ns);
+
+		gc.collect();
+		stats = gc.stats();
+		TEST_EQUAL(stats.collect_count, 1);
+		TEST_EQUAL(stats.cycle_count, 2);
+		TEST_CHECK(stats.freed_bytes > 10000 * sizeof(void*));
+		TEST_CHECK(stats.last_after_bytes <= stats.last_before_bytes);
+		gc.resetStats();
+		TEST_EQUAL(state.gc().stats().cycle_count, 0);
+		gc.restart();
+	}
+	void ignore_error(int, const char*)
+	{
+	}
+	void coroutine_pool(kaguya::State&)
+	{
+		kaguya::State state;
+		state.setErrorHandler(&ignore_error);
+		TEST_CHECK(state("function add(a, b) return a + b end function yield_once() coroutine.yield(1) return 2 end function fail() error('fail') end"));
+		kaguya::LuaFunction add = state["add"];
+		kaguya::LuaFunction yield_once = state["yield_once"];
+		kaguya::LuaFunction fail = state["fail"];
+		kaguya::CoroutinePool& pool = state.coroutinePool();
+		TEST_CHECK(&pool == &state.coroutinePool());
+		pool.setMaxPooled(2);
+
+		kaguya::LuaThread thread = pool.acquire();
+		lua_State* co = thread.get<lua_State*>();
+		TEST_EQUAL(thread.resume<int>(add, 1, 2), 3);
+		TEST_CHECK(pool.release(thread));
+		TEST_CHECK(thread.isNilref());
+		TEST_EQUAL(pool.stats().pooled_count, 1);
+
+		thread = pool.acquire();
+		TEST_CHECK(thread.get<lua_State*>() == co);
+		TEST_EQUAL(thread.resume<int>(yield_once), 1);
+		TEST_EQUAL(thread.resume<int>(), 2);
+		TEST_CHECK(pool.release(thread));
+		TEST_EQUAL(pool.stats().created_count, 1);
+		TEST_EQUAL(pool.stats().reused_count, 1);
+
+		thread = pool.acquire();
+		thread.resume<void>(fail);
+#if LUA_VERSION_NUM >= 504
+		TEST_CHECK(pool.release(thread));
+#else
+		TEST_CHECK(!pool.release(thread));
+#endif
+
+		std::vector<kaguya::LuaThread> threads;
+		for (int i = 0; i < 3; ++i)
+		{
+			threads.push_back(pool.acquire());
+			TEST_EQUAL(threads.back().resume<int>(add, i, 1), i + 1);
+		}
+		for (size_t i = 0; i < threads.size(); ++i)
+		{
+			pool.release(threads[i]);
+		}
+		TEST_EQUAL(pool.stats().pooled_count, 2);
+		pool.setMaxPooled(1);
+		TEST_EQUAL(pool.stats().pooled_count, 1);
+		pool.clear();
+		TEST_EQUAL(pool.stats().pooled_count, 0);
+		TEST_EQUAL(pool.maxPooled(), 256);
+
+		thread = pool.acquire();
+		TEST_EQUAL(thread.resume<int>(add, 1, 1), 2);
+		kaguya::LuaThread copy = thread;
+		TEST_CHECK(pool.release(thread));
+		TEST_CHECK(!pool.release(copy));//already pooled
+		TEST_EQUAL(pool.stats().pooled_count, 1);
+		kaguya::LuaThread first = pool.acquire();
+		kaguya::LuaThread second = pool.acquire();
+		TEST_CHECK(first.get<lua_State*>() != second.get<lua_State*>());
+		copy = first;
+		TEST_CHECK(pool.release(first));
+		pool.clear();
+		TEST_CHECK(pool.release(copy));//discarded from pool, can be pooled again
+		TEST_CHECK(pool.release(second));
+		TEST_EQUAL(pool.stats().pooled_count, 2);
+	}
 	void no_standard_lib(kaguya::State&)
 	{
 		kaguya::State state(kaguya::NoLoadLib());
@@ -1508,6 +2656,8 @@ namespace t_07_any_type_test
 }
 
 #if KAGUYA_USE_CPP11
+#include <future>
+#include <thread>
 
 namespace t_08_cxx11_feature
 {
@@ -1636,6 +2786,216 @@ namespace t_08_cxx11_feature
 		kaguya::LuaRef nullref = state.newRef(nullptr);
 		TEST_CHECK(nullref == nullptr);
 	}
+
+	void error_handler_per_thread(kaguya::State& state)
+	{
+		std::vector<int> counts(4, 0);
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < counts.size(); ++i)
+		{
+			int* count = &counts[i];
+			threads.push_back(std::thread([count]() {
+				kaguya::State local;
+				local.setErrorHandler([count](int status, const char* message) { ++*count; });
+				for (int j = 0; j < 100; ++j)
+				{
+					local("error('thread error')");
+				}
+			}));
+		}
+		for (size_t i = 0; i < threads.size(); ++i)
+		{
+			threads[i].join();
+		}
+		for (size_t i = 0; i < counts.size(); ++i)
+		{
+			TEST_EQUAL(counts[i], 100);
+		}
+		TEST_CHECK(kaguya::ErrorHandler::findHandler(state.state()));
+	}
+
+	template<typename Exception, typename T>
+	bool future_throws(std::future<T>& result)
+	{
+		try
+		{
+			result.get();
+		}
+		catch (const Exception&)
+		{
+			return true;
+		}
+		return false;
+	}
+#if KAGUYA_USE_THREAD_LOCAL
+	void executor(kaguya::State& state)
+	{
+		kaguya::Executor executor(4, [](kaguya::State& worker) {
+			worker["scale"] = 3;
+			worker["twice"] = kaguya::function([](int a) {return a * 2; });
+		});
+		TEST_EQUAL(executor.size(), 4);
+
+		std::vector<std::future<int> > results;
+		for (int i = 0; i < 200; ++i)
+		{
+			results.push_back(executor.execute<int>("local a, b = ... return twice(a) * b * scale", i, 2));
+		}
+		int sum = 0;
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			sum += results[i].get();
+		}
+		TEST_EQUAL(sum, 12 * (199 * 200 / 2));
+
+		std::tuple<int, std::string> values = executor.execute<std::tuple<int, std::string> >("return 1, 'a'").get();
+		TEST_EQUAL(std::get<0>(values), 1);
+		TEST_EQUAL(std::get<1>(values), "a");
+
+		std::future<int> scale = executor.submit([](kaguya::State& worker) { return worker["scale"].get<int>(); });
+		TEST_EQUAL(scale.get(), 3);
+		executor.execute<void>("executor_global = 1").get();
+		TEST_CHECK(!state["executor_global"]);
+
+		std::future<int> runtime_error = executor.execute<int>("error('rule error')");
+		TEST_CHECK(future_throws<kaguya::LuaException>(runtime_error));
+		std::future<int> syntax_error = executor.execute<int>("return +");
+		TEST_CHECK(future_throws<kaguya::LuaException>(syntax_error));
+		std::future<int> mismatch = executor.execute<int>("return 'x'");
+		TEST_CHECK(future_throws<kaguya::LuaTypeMismatch>(mismatch));
+
+		kaguya::ExecutorStats stats = executor.stats();
+		TEST_EQUAL(stats.submitted_count, 206);
+		TEST_EQUAL(stats.executed_count, 206);
+
+		//compiled chunk cache of worker is bounded
+		kaguya::Executor single(1);
+		for (int i = 0; i < KAGUYA_EXECUTOR_CHUNK_CACHE_SIZE + 10; ++i)
+		{
+			std::ostringstream chunk;
+			chunk << "return " << i;
+			TEST_EQUAL(single.execute<int>(chunk.str()).get(), i);
+		}
+		size_t cached = single.submit([](kaguya::State& worker) {
+			lua_State* l = worker.state();
+			kaguya::util::ScopedSavedStack save(l);
+			lua_getfield(l, LUA_REGISTRYINDEX, KAGUYA_EXECUTOR_CHUNK_CACHE);
+			size_t count = 0;
+			lua_pushnil(l);
+			while (lua_next(l, -2) != 0)
+			{
+				lua_pop(l, 1);
+				count += lua_type(l, -1) == LUA_TSTRING ? 1 : 0;
+			}
+			return count;
+		}).get();
+		TEST_CHECK(cached > 0 && cached <= KAGUYA_EXECUTOR_CHUNK_CACHE_SIZE);
+
+		bool thrown = false;
+		try
+		{
+			kaguya::Executor failed(2, [](kaguya::State& worker) { throw std::runtime_error("init"); });
+		}
+		catch (const std::runtime_error&)
+		{
+			thrown = true;
+		}
+		TEST_CHECK(thrown);
+	}
+#endif
+
+	void scheduler(kaguya::State&)
+	{
+		kaguya::State state;
+		std::string error_message;
+		state.setErrorHandler([&](int, const char* message) { error_message = message ? message : ""; });
+		kaguya::Scheduler scheduler(state);
+		scheduler.install(state.globalTable());
+		std::vector<kaguya::Completion> pending;
+		state["request"] = kaguya::function([&](int id) { pending.push_back(scheduler.completion()); return pending.back(); });
+		std::vector<std::future<void> > producers;//completed by other threads
+		state["twice_async"] = kaguya::function([&](int v) {
+			kaguya::Completion c = scheduler.completion();
+			producers.push_back(std::async(std::launch::async, [c, v]() mutable { c.complete(v * 2); }));
+			return c;
+		});
+		state["fail_async"] = kaguya::function([&]() {
+			kaguya::Completion c = scheduler.completion();
+			producers.push_back(std::async(std::launch::async, [c]() mutable { c.fail("async failure"); }));
+			return c;
+		});
+		state["immediate"] = kaguya::function([&](int v) { kaguya::Completion c = scheduler.completion(); c.complete(v, "done"); return c; });
+		TEST_CHECK(state("results = {} "
+			"function session(id) local r = await(request(id)) yield() local v = await(twice_async(r)) await(sleep(0.001)) results[id] = v end "
+			"function early() local c = immediate(7) yield() local v, s = await(c) early_result = v .. s end "
+			"function failing() await(fail_async()) results.failed = true end"));
+
+		const int sessions = 1000;
+		for (int i = 1; i <= sessions; ++i)
+		{
+			scheduler.spawn(state["session"], i);
+		}
+		scheduler.spawn(state["early"]);
+		scheduler.spawn(state["failing"]);
+		TEST_EQUAL(scheduler.size(), sessions + 2);
+		TEST_CHECK(scheduler.runOnce());
+		TEST_EQUAL(scheduler.waitingCount(), size_t(sessions + 1));
+		TEST_EQUAL(pending.size(), size_t(sessions));
+
+		std::thread completer([&] {
+			for (size_t i = 0; i < pending.size(); ++i)
+			{
+				pending[i].complete(int(i) + 1);
+			}
+		});
+		scheduler.run();
+		completer.join();
+		TEST_EQUAL(scheduler.size(), 0);
+		for (int i = 1; i <= sessions; ++i)
+		{
+			TEST_EQUAL(state["results"][i], i * 2);
+		}
+		TEST_EQUAL(state["early_result"], "7done");
+		TEST_CHECK(!state["results"]["failed"]);
+		TEST_CHECK(error_message.find("async failure") != std::string::npos);
+		TEST_CHECK(!pending[0].complete(0));
+
+		kaguya::SchedulerStats stats = scheduler.stats();
+		TEST_EQUAL(stats.spawned_count, size_t(sessions + 2));
+		TEST_EQUAL(stats.finished_count, size_t(sessions + 1));
+		TEST_EQUAL(stats.error_count, 1);
+	}
+
+	struct SchedulerClient
+	{
+		int count;
+	};
+	void scheduler_completion_lifetime(kaguya::State&)
+	{
+		kaguya::State state;
+		kaguya::Scheduler scheduler(state);
+		scheduler.install(state.globalTable());
+		state["Client"].setClass(kaguya::ClassMetatable<SchedulerClient>().addConstructor().addProperty("count", &SchedulerClient::count));
+		state["client_sleep"] = kaguya::function([&](SchedulerClient* client, int count) { client->count = count; return scheduler.sleep(0.001); });
+		std::shared_ptr<int> token = std::make_shared<int>(0);
+		state["abandoned"] = kaguya::function([&]() { kaguya::Completion c = scheduler.completion(); c.complete(token); return c; });
+		TEST_CHECK(state("client = Client.new() "
+			"function wait_client() await(client_sleep(client, 3)) client_done = true end "
+			"function abandon() local c = abandoned() yield() end "
+			"function never_awaited() sleep(0) end"));
+
+		scheduler.spawn(state["wait_client"]);
+		scheduler.spawn(state["abandon"]);
+		scheduler.spawn(state["never_awaited"]);
+		scheduler.run();
+		TEST_EQUAL(scheduler.size(), 0);
+		TEST_CHECK(state["client_done"]);
+		TEST_CHECK(state("assert(client.count == 3)"));
+
+		//results of completions nobody awaited are freed with the completion
+		state.gc().collect();
+		TEST_EQUAL(token.use_count(), 1);
+	}
 }
 #endif
 
@@ -1754,23 +3114,35 @@ int main()
 		ADD_TEST(t_02_classreg::noncopyable_class_test);
 		ADD_TEST(t_02_classreg::registering_object_instance);
 		ADD_TEST(t_02_classreg::registering_derived_class);
+		ADD_TEST(t_02_classreg::multi_level_derived_class);
 		ADD_TEST(t_02_classreg::registering_shared_ptr);
+		ADD_TEST(t_02_classreg::registering_intrusive_ptr);
 		ADD_TEST(t_02_classreg::shared_ptr_null);
+		ADD_TEST(t_02_classreg::shared_ptr_const_ref_argument);
 		ADD_TEST(t_02_classreg::add_property);
+		ADD_TEST(t_02_classreg::inherited_property);
+		ADD_TEST(t_02_classreg::typed_array_property);
 		ADD_TEST(t_02_classreg::add_property_ref_check);
 		ADD_TEST(t_03_function::free_standing_function_test);
+		ADD_TEST(t_03_function::function_pointer_trampoline);
 		ADD_TEST(t_03_function::member_function_test);
 		ADD_TEST(t_03_function::variadic_function_test);
 		ADD_TEST(t_03_function::multi_return_function_test);
 		ADD_TEST(t_03_function::vector_and_map_from_table_mapping);
 		ADD_TEST(t_03_function::vector_and_map_to_table_mapping);
+		ADD_TEST(t_03_function::vector_sequence_type_check);
+		ADD_TEST(t_03_function::typed_array);
 		ADD_TEST(t_03_function::coroutine);
 		ADD_TEST(t_03_function::zero_to_nullpointer);
 		ADD_TEST(t_03_function::arg_class_ref);
 
 		ADD_TEST(t_03_function::native_function_call_test);
 		ADD_TEST(t_03_function::overload);
+		ADD_TEST(t_03_function::overload_changing_argument_types);
 		ADD_TEST(t_03_function::result_to_table);
+#if KAGUYA_USE_STRING_VIEW
+		ADD_TEST(t_03_function::string_view_argument);
+#endif
 
 		ADD_TEST(t_04_lua_ref::access);
 		ADD_TEST(t_04_lua_ref::newtable);
@@ -1786,6 +3158,11 @@ int main()
 		ADD_TEST(t_04_lua_ref::lua_table_set);
 		ADD_TEST(t_04_lua_ref::lua_table_size);
 		ADD_TEST(t_04_lua_ref::lua_table_reference);
+		ADD_TEST(t_04_lua_ref::lua_stack_ref);
+		ADD_TEST(t_04_lua_ref::field_mapping);
+		ADD_TEST(t_04_lua_ref::interned_key);
+		ADD_TEST(t_04_lua_ref::table_range);
+		ADD_TEST(t_04_lua_ref::table_dump);
 		ADD_TEST(t_04_lua_ref::luafun_loadstring);
 		ADD_TEST(t_04_lua_ref::metatable);
 		ADD_TEST(t_05_error_handler::set_error_function);
@@ -1793,6 +3170,17 @@ int main()
 		ADD_TEST(t_06_state::other_state);
 		ADD_TEST(t_06_state::load_string);
 		ADD_TEST(t_06_state::load_with_other_env);
+		ADD_TEST(t_06_state::allocator);
+		ADD_TEST(t_06_state::memory_budget);
+		ADD_TEST(t_06_state::state_pool);
+		ADD_TEST(t_06_state::chunk_cache);
+		ADD_TEST(t_06_state::mapped_file_and_stream);
+		ADD_TEST(t_06_state::sampling_profiler);
+		ADD_TEST(t_06_state::coroutine_pool);
+		ADD_TEST(t_06_state::gc_tuning);
+#if KAGUYA_USE_BINDING_PROFILER
+		ADD_TEST(t_06_state::binding_profiler);
+#endif
 		ADD_TEST(t_06_state::no_standard_lib);
 		ADD_TEST(t_06_state::load_lib_constructor);
 		
@@ -1809,6 +3197,12 @@ int main()
 		ADD_TEST(t_08_cxx11_feature::put_unique_ptr);
 		
 		ADD_TEST(t_08_cxx11_feature::compare_null_ptr);
+		ADD_TEST(t_08_cxx11_feature::error_handler_per_thread);
+#if KAGUYA_USE_THREAD_LOCAL
+		ADD_TEST(t_08_cxx11_feature::executor);
+#endif
+		ADD_TEST(t_08_cxx11_feature::scheduler);
+		ADD_TEST(t_08_cxx11_feature::scheduler_completion_lifetime);
 
 		
 #endif